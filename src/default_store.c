@@ -0,0 +1,142 @@
+/* Functions without a store argument, which work with a default store. It's a separate module,
+ * so the default store doesn't take RAM of applications, which use uwlkv_store_* functions only.
+ */
+
+#include "uwlkv.h"
+
+static uwlkv_store default_store;
+
+/**
+ * @brief	Reads NVRAM content and builds map of the default store, see uwlkv_store_init().
+ *
+ * @param [in]	interface	NVRAM access insterface.
+ *
+ * @returns	- NVRAM capacity in entries. This value, divided by UWLKV_MAX_ENTRIES gives you an
+ * 			expected leveling factor or write cycles multiplier.
+ * 			- 0 if NVRAM size is too small to fit all entries or its layout can't be migrated.
+ */
+uwlkv_offset uwlkv_init(const uwlkv_nvram_interface * interface)
+{
+    return uwlkv_store_init(&default_store, interface);
+}
+
+#ifdef UWLKV_LAZY_INIT
+/**
+ * @brief	Boots the default store without building its map, see uwlkv_store_init_lazy().
+ *
+ * @param [in]	interface	NVRAM access insterface.
+ *
+ * @returns	Same as uwlkv_init().
+ */
+uwlkv_offset uwlkv_init_lazy(const uwlkv_nvram_interface * interface)
+{
+    return uwlkv_store_init_lazy(&default_store, interface);
+}
+
+/**
+ * @brief	Adds some entries to map of the default store, see uwlkv_store_init_step().
+ *
+ * @param 	entries	Maximum number of entries to be read.
+ *
+ * @returns	Number of entries which are still not indexed, 0 when map is complete.
+ */
+uwlkv_offset uwlkv_init_step(uwlkv_offset entries)
+{
+    return uwlkv_store_init_step(&default_store, entries);
+}
+#endif
+
+/**
+ * @brief	Get value of specifiend key
+ *
+ * @param 	   	key  	The key.
+ * @param [out]	value	Read value if success.
+ *
+ * @returns	UWLKV_E_SUCCESS on sucesseful read.
+ */
+uwlkv_error uwlkv_get_value(uwlkv_key key, uwlkv_value * value)
+{
+    return uwlkv_store_get_value(&default_store, key, value);
+}
+
+/**
+ * @brief	Set value of specified key.
+ *
+ * @param 	key  	The key.
+ * @param 	value	Value to be written.
+ *
+ * @returns	UWLKV_E_SUCCESS on sucesseful read.
+ */
+uwlkv_error uwlkv_set_value(uwlkv_key key, uwlkv_value value)
+{
+    return uwlkv_store_set_value(&default_store, key, value);
+}
+
+/**
+ * @brief	Deletes a key, see uwlkv_store_delete_value().
+ *
+ * @param 	key	The key.
+ *
+ * @returns	- UWLKV_E_SUCCESS on sucesseful write or
+ * 			- UWLKV_E_NOT_EXIST if there is no such key.
+ */
+uwlkv_error uwlkv_delete_value(uwlkv_key key)
+{
+    return uwlkv_store_delete_value(&default_store, key);
+}
+
+/**
+ * @brief	Performs a wrap-around now, see uwlkv_store_compact().
+ *
+ * @returns	UWLKV_E_SUCCESS or UWLKV_E_NOT_STARTED.
+ */
+uwlkv_error uwlkv_compact(void)
+{
+    return uwlkv_store_compact(&default_store);
+}
+
+/**
+ * @brief	Calls a function for each stored key, see uwlkv_store_foreach().
+ *
+ * @param 	callback	Receives key, value and context. Return non-zero to stop iteration.
+ * 						Storage must not be modified from the callback.
+ * @param 	context 	User pointer passed to callback.
+ *
+ * @returns	UWLKV_E_SUCCESS if all keys were visited or iteration was stopped by callback.
+ */
+uwlkv_error uwlkv_foreach(uwlkv_foreach_callback callback, void * context)
+{
+    return uwlkv_store_foreach(&default_store, callback, context);
+}
+
+/**
+ * @brief	Returns number of unique key values in use.
+ *
+ * @returns	Number of keys.
+ */
+uwlkv_key uwlkv_get_entries_number(void)
+{
+    return uwlkv_store_get_entries_number(&default_store);
+}
+
+/**
+ * @brief	Returns number of free unique key values.
+ *
+ * @returns	Number of keys.
+ */
+uwlkv_key uwlkv_get_free_entries(void)
+{
+    return uwlkv_store_get_free_entries(&default_store);
+}
+
+#ifdef UWLKV_WEAR
+/**
+ * @brief	Reports erase counters of the default store, see uwlkv_store_get_wear().
+ *
+ * @param [out]	wear	Counters and projection.
+ */
+void uwlkv_get_wear(uwlkv_wear * wear)
+{
+    uwlkv_store_get_wear(&default_store, wear);
+}
+#endif
@@ -0,0 +1,361 @@
+/* This module is a drop-in replacement of storage.c for byte-writable EEPROM. It is enabled by
+ * UWLKV_EEPROM. EEPROM needs no bulk erase, so there is no log, no reserved area and no
+ * wrap-around: NVRAM is split into UWLKV_MAX_ENTRIES rings of slots, one key per ring, and each
+ * write overwrites the oldest slot of its ring, round-robin. Every write costs the same and all
+ * slots of a ring wear at the same pace.
+ * A slot ends with a sequence number, which follows the one of the previous slot, so the newest
+ * slot is the last one of a run of consecutive numbers. The number is written last, so a write
+ * torn by power loss leaves the ring as it was. A ring has less slots than there are numbers,
+ * so an old number in the next slot never continues the run. The top bit of the number marks
+ * a tombstone, so a deleted key stays deleted even if the rest of its slot is damaged later.
+ * Rings are scanned only on boot and when a new key takes a free ring. Map points to the newest
+ * slot of each key, so a lookup is a single read and the next slot is known without a search.
+ * Metadata at the beginning of NVRAM marks it as formatted. Its magic differs from the one of
+ * the log, so NVRAM written by storage.c isn't read as rings. NVRAM without it has unknown
+ * content, all slots are blanked once before the first use.
+ */
+
+#include <string.h>
+#include "uwlkv.h"
+#include "entry.h"
+#include "map.h"
+#include "storage.h"
+#include "stats.h"
+#include "trace.h"
+
+#ifdef UWLKV_EEPROM
+
+#define UWLKV_SEQUENCE_MASK     (0x7F)                          /* Bits of sequence number */
+#define UWLKV_SEQUENCE_TOMBSTONE (0x80)                         /* Flag of a slot with tombstone */
+#define UWLKV_MAX_RING_SLOTS    (UWLKV_SEQUENCE_MASK - 1)       /* Less than sequence numbers */
+
+/** @brief	Returns size of a ring in bytes. */
+static inline uwlkv_offset get_ring_size(uwlkv_store * store)
+{
+    return store->ring_slots * (uwlkv_offset)UWLKV_ENTRY_SIZE;
+}
+
+/** @brief	Returns offset of a slot of a ring. */
+static inline uwlkv_offset get_slot_offset(uwlkv_store * store, const uwlkv_key ring, const uwlkv_offset slot)
+{
+    return UWLKV_METADATA_SIZE + ring * get_ring_size(store) + slot * (uwlkv_offset)UWLKV_ENTRY_SIZE;
+}
+
+/** @brief	Returns offset of the first slot of a ring which contains given offset. */
+static inline uwlkv_offset get_ring_start(uwlkv_store * store, const uwlkv_offset offset)
+{
+    return offset - (offset - UWLKV_METADATA_SIZE) % get_ring_size(store);
+}
+
+/**
+ * @brief	Returns sequence number which follows the one of given byte, without tombstone flag.
+ * 			Number bits of erased byte are skipped, so a blank slot never continues a run and
+ * 			the first slot written after it gets 0.
+ */
+static inline uint8_t next_sequence(const uint8_t sequence)
+{
+    const uint8_t next = (uint8_t)((sequence + 1) & UWLKV_SEQUENCE_MASK);
+
+    return ((UWLKV_ERASED_BYTE_VALUE & UWLKV_SEQUENCE_MASK) == next)
+         ? (uint8_t)((next + 1) & UWLKV_SEQUENCE_MASK)
+         : next;
+}
+
+/** @brief	Checks that sequence byte of a slot continues the run after the previous one. */
+static inline uint8_t continues_run(const uint8_t previous, const uint8_t sequence)
+{
+    return next_sequence(previous) == (sequence & UWLKV_SEQUENCE_MASK);
+}
+
+/**
+ * @brief	Calculates how many slots a ring of each key has.
+ *
+ * @param 	size	NVRAM size in bytes.
+ *
+ * @returns	Number of slots in a ring.
+ */
+uwlkv_offset uwlkv_ring_slots(const uwlkv_offset size)
+{
+    const uwlkv_offset slots = (size > UWLKV_METADATA_SIZE)
+                             ? ((size - UWLKV_METADATA_SIZE) / UWLKV_MAX_ENTRIES / UWLKV_ENTRY_SIZE)
+                             : 0;
+
+    return (slots > UWLKV_MAX_RING_SLOTS) ? UWLKV_MAX_RING_SLOTS : slots;
+}
+
+/**
+ * @brief	Finds the newest slot of a ring: the one, which isn't followed by the next sequence
+ * 			number. Slots are read in chunks of UWLKV_SCAN_ENTRIES.
+ *
+ * @param 	   	store 	The store.
+ * @param 	   	ring  	Ring number.
+ * @param [out]	newest	Number of the newest slot. The last one, if the ring is blank.
+ *
+ * @returns	- UWLKV_E_SUCCESS if newest slot is found,
+ * 			- UWLKV_E_NOT_EXIST if the ring is blank or
+ * 			- UWLKV_E_NVRAM_ERROR if it can't be read.
+ */
+static uwlkv_error find_newest_slot(uwlkv_store * store, const uwlkv_key ring, uwlkv_offset * newest)
+{
+    uint8_t blocks[UWLKV_SCAN_ENTRIES * UWLKV_ENTRY_SIZE];
+    uint8_t previous = UWLKV_ERASED_BYTE_VALUE;
+
+    for (uwlkv_offset slot = 0; slot < store->ring_slots; slot += UWLKV_SCAN_ENTRIES)
+    {
+        uwlkv_offset count = store->ring_slots - slot;
+        if (count > UWLKV_SCAN_ENTRIES)
+        {
+            count = UWLKV_SCAN_ENTRIES;
+        }
+
+        if (UWLKV_E_SUCCESS != uwlkv_read_entries(store, get_slot_offset(store, ring, slot), blocks, count))
+        {
+            return UWLKV_E_NVRAM_ERROR;
+        }
+
+        for (uwlkv_offset i = 0; i < count; i++)
+        {
+            const uint8_t sequence = blocks[i * UWLKV_ENTRY_SIZE + UWLKV_O_ENTRY_SEQUENCE];
+            if ((UWLKV_ERASED_BYTE_VALUE != previous) && !continues_run(previous, sequence))
+            {
+                *newest = slot + i - 1;
+                return UWLKV_E_SUCCESS;
+            }
+            previous = sequence;
+        }
+    }
+
+    /* No break inside the ring: either it is blank or the run ends at the last slot */
+    *newest = store->ring_slots - 1;
+
+    return (UWLKV_ERASED_BYTE_VALUE != previous) ? UWLKV_E_SUCCESS : UWLKV_E_NOT_EXIST;
+}
+
+/**
+ * @brief	Adds the newest entry of a ring to the map. A corrupted entry is skipped in favour of
+ * 			the previous one of the same run. A tombstone leaves the ring free, it is known by
+ * 			the flag of its sequence number, so a damaged one never brings an older value back.
+ *
+ * @param 	store	The store.
+ * @param 	ring 	Ring number.
+ */
+static void load_ring(uwlkv_store * store, const uwlkv_key ring)
+{
+    uwlkv_offset slot;
+    if (UWLKV_E_SUCCESS != find_newest_slot(store, ring, &slot))
+    {
+        return;
+    }
+
+    uint8_t newer = UWLKV_ERASED_BYTE_VALUE;
+    for (uwlkv_offset walked = 0; walked < store->ring_slots; walked++)
+    {
+        const uwlkv_offset offset = get_slot_offset(store, ring, slot);
+        uint8_t block[UWLKV_ENTRY_SIZE];
+        if (UWLKV_E_SUCCESS != uwlkv_read_entries(store, offset, block, 1))
+        {
+            break;
+        }
+
+        const uint8_t sequence = block[UWLKV_O_ENTRY_SEQUENCE];
+        if (    ((walked > 0) && ((UWLKV_ERASED_BYTE_VALUE == sequence) || !continues_run(sequence, newer)))
+            ||  (sequence & UWLKV_SEQUENCE_TOMBSTONE) )
+        {
+            break;
+        }
+
+        uwlkv_key   key;
+        uwlkv_value value;
+        const uwlkv_error ret = uwlkv_decode_entry(block, &key, &value);
+        if (UWLKV_E_CORRUPTED != ret)
+        {
+            if ((UWLKV_E_SUCCESS == ret) && (UWLKV_TOMBSTONE_KEY != key))
+            {
+                uwlkv_update_entry(store, key, offset);
+            }
+            break;
+        }
+
+        newer = sequence;
+        slot  = (0 == slot) ? (store->ring_slots - 1) : (slot - 1);
+    }
+}
+
+/**
+ * @brief	Blanks all slots of NVRAM with unknown content. Metadata is written last, so an
+ * 			interrupted format is started over on the next boot.
+ *
+ * @param 	store	The store.
+ */
+static void format(uwlkv_store * store)
+{
+    uint8_t blank[UWLKV_SCAN_ENTRIES * UWLKV_ENTRY_SIZE];
+    memset(blank, UWLKV_ERASED_BYTE_VALUE, sizeof(blank));
+
+    const uwlkv_offset end = get_slot_offset(store, UWLKV_MAX_ENTRIES, 0);
+    for (uwlkv_offset offset = UWLKV_METADATA_SIZE; offset < end; offset += sizeof(blank))
+    {
+        const uwlkv_offset size = ((end - offset) < sizeof(blank)) ? (end - offset) : sizeof(blank);
+        uwlkv_nvram_write(store, blank, offset, size);
+    }
+
+    uint8_t metadata[UWLKV_METADATA_SIZE] = { UWLKV_EEPROM_FORMAT_STARTED, UWLKV_EEPROM_FORMAT_FINISHED };
+    uwlkv_nvram_write(store, metadata, 0, UWLKV_METADATA_SIZE);
+}
+
+/**
+ * @brief	Builds the map from the newest slots of all rings. There is nothing to recover: an
+ * 			interrupted write is either complete or not a part of its ring.
+ *
+ * @param 	store	The store.
+ * @param 	lazy 	Not used, rings are always loaded.
+ *
+ * @returns	UWLKV_E_SUCCESS.
+ */
+uwlkv_error uwlkv_cold_boot(uwlkv_store * store, const uint8_t lazy)
+{
+    (void)lazy;
+
+    uwlkv_reset_map(store);
+    store->ring_slots = uwlkv_ring_slots(store->nvram.size);
+
+    uint8_t metadata[UWLKV_METADATA_SIZE];
+    const uint8_t formatted = (0 == uwlkv_nvram_read(store, metadata, 0, UWLKV_METADATA_SIZE))
+                           && (UWLKV_EEPROM_FORMAT_STARTED  == metadata[UWLKV_O_ERASE_STARTED])
+                           && (UWLKV_EEPROM_FORMAT_FINISHED == metadata[UWLKV_O_ERASE_FINISHED]);
+    UWLKV_STAT_ADD(boots[formatted ? UWLKV_S_CLEAN : UWLKV_S_BLANK], 1);
+
+    if (!formatted)
+    {
+        format(store);
+        return UWLKV_E_SUCCESS;
+    }
+
+    for (uwlkv_key ring = 0; ring < UWLKV_MAX_ENTRIES; ring++)
+    {
+        load_ring(store, ring);
+    }
+
+    return UWLKV_E_SUCCESS;
+}
+
+/**
+ * @brief	Finds a ring which doesn't hold any key.
+ *
+ * @param 	   	store 	The store.
+ * @param [out]	newest	Offset of the newest slot of that ring. The last slot, if the ring is blank.
+ *
+ * @returns	UWLKV_E_SUCCESS or UWLKV_E_NVRAM_ERROR if the ring can't be read.
+ */
+static uwlkv_error find_free_ring(uwlkv_store * store, uwlkv_offset * newest)
+{
+    uint8_t used[(UWLKV_MAX_ENTRIES + 7) / 8] = { 0 };
+
+    for (uwlkv_key i = 0; i < uwlkv_get_used_entries(store); i++)
+    {
+        const uwlkv_offset ring = (uwlkv_get_entry_by_id(store, i)->offset - UWLKV_METADATA_SIZE) / get_ring_size(store);
+        used[ring / 8] |= (uint8_t)(1u << (ring % 8));
+    }
+
+    uwlkv_key ring = 0;
+    while ((ring < (UWLKV_MAX_ENTRIES - 1)) && (used[ring / 8] & (1u << (ring % 8))))
+    {
+        ring++;
+    }
+
+    uwlkv_offset slot;
+    if (UWLKV_E_NVRAM_ERROR == find_newest_slot(store, ring, &slot))
+    {
+        return UWLKV_E_NVRAM_ERROR;
+    }
+
+    *newest = get_slot_offset(store, ring, slot);
+    return UWLKV_E_SUCCESS;
+}
+
+/**
+ * @brief	Returns offset of the slot which follows the newest one in the ring of a key. A new
+ * 			key takes a free ring. Caller checks that map has space for a new key.
+ *
+ * @param 	   	store 	The store.
+ * @param 	   	key   	Key to be written.
+ * @param [out]	offset	Starting position of new block.
+ *
+ * @returns	UWLKV_E_SUCCESS or UWLKV_E_NVRAM_ERROR if a free ring can't be read.
+ */
+uwlkv_error uwlkv_get_next_block(uwlkv_store * store, uwlkv_key key, uwlkv_offset * offset)
+{
+    UWLKV_TRACE_BEGIN(UWLKV_OP_GET_NEXT_BLOCK, key);
+    uwlkv_entry * entry;
+    uwlkv_offset newest = 0;
+    uwlkv_error ret = UWLKV_E_SUCCESS;
+    if (UWLKV_E_SUCCESS == uwlkv_get_entry(store, key, &entry))
+    {
+        newest = entry->offset;
+    }
+    else
+    {
+        ret = find_free_ring(store, &newest);
+    }
+
+    uwlkv_offset next = 0;
+    if (UWLKV_E_SUCCESS == ret)
+    {
+        const uwlkv_offset ring_start = get_ring_start(store, newest);
+        next = newest + UWLKV_ENTRY_SIZE;
+        if (next >= (ring_start + get_ring_size(store)))
+        {
+            next = ring_start;
+        }
+        *offset = next;
+    }
+    UWLKV_TRACE_END(UWLKV_OP_GET_NEXT_BLOCK, next);
+
+    return ret;
+}
+
+/**
+ * @brief	Writes an entry to a slot returned by uwlkv_get_next_block(). Its sequence number
+ * 			follows the one of the previous slot and has a flag if the entry is a tombstone.
+ *
+ * @param 	store 	The store.
+ * @param 	offset	Offset of the slot.
+ * @param 	key   	Entry key.
+ * @param 	value 	Entry value.
+ *
+ * @returns	UWLKV_E_SUCCESS on successeful write.
+ */
+uwlkv_error uwlkv_write_block(uwlkv_store * store, uwlkv_offset offset, uwlkv_key key, uwlkv_value value)
+{
+    const uwlkv_offset ring_start = get_ring_start(store, offset);
+    const uwlkv_offset previous   = (offset == ring_start)
+                                  ? (ring_start + get_ring_size(store) - UWLKV_ENTRY_SIZE)
+                                  : (offset - UWLKV_ENTRY_SIZE);
+
+    uint8_t sequence;
+    if (uwlkv_nvram_read(store, &sequence, previous + UWLKV_O_ENTRY_SEQUENCE, sizeof(sequence)))
+    {
+        return UWLKV_E_NVRAM_ERROR;
+    }
+
+    const uint8_t tombstone = (UWLKV_TOMBSTONE_KEY == key) ? UWLKV_SEQUENCE_TOMBSTONE : 0;
+
+    return uwlkv_write_slot(store, offset, key, value, (uint8_t)(next_sequence(sequence) | tombstone));
+}
+
+/** @brief	Rings are never compacted, see uwlkv_compact(). */
+void uwlkv_compact_storage(uwlkv_store * store)
+{
+    (void)store;
+}
+
+/** @brief	There is no cold area, see uwlkv_forget_cold_entry() of storage.c. */
+uwlkv_error uwlkv_forget_cold_entry(uwlkv_store * store, uwlkv_key key)
+{
+    (void)store;
+    (void)key;
+
+    return UWLKV_E_SUCCESS;
+}
+
+#endif
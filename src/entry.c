@@ -1,74 +1,285 @@
 /* This module accesess NVRAM and serializes/deserializes data.
+ * With UWLKV_CRC an entry is followed by a checksum of its key and value, so an entry which
+ * was partially written or damaged later is not taken for a valid one.
+ * With UWLKV_EEPROM an entry ends with a sequence number of its slot, see eeprom.c.
  */
 
+#include <string.h>
 #include "uwlkv.h"
 #include "entry.h"
+#include "stats.h"
+#include "trace.h"
+#include "wear.h"
 
-extern uwlkv_nvram_interface nvram_interface;
+#ifdef UWLKV_CRC
+#define UWLKV_O_ENTRY_CRC   (sizeof(uwlkv_key) + sizeof(uwlkv_value))  /* Offset of checksum in entry */
+
+#ifdef UWLKV_CRC_HOOK
+#define UWLKV_CRC32         UWLKV_CRC_HOOK
+#else
+#define UWLKV_CRC32         uwlkv_crc32
+#endif
+
+/** @brief	Calculates checksum of a raw entry. */
+static inline uwlkv_crc entry_crc(const uint8_t * block)
+{
+    return (uwlkv_crc)UWLKV_CRC32(block, UWLKV_O_ENTRY_CRC);
+}
+#endif
+
+/**
+ * @brief	Reads raw data from NVRAM. All reads of the library go through this function.
+ *
+ * @param [in] 	store	The store.
+ * @param [out]	data 	Buffer for data.
+ * @param 	   	start	Offset in bytes.
+ * @param 	   	size 	Number of bytes to read.
+ *
+ * @returns	Result of interface read function, 0 on success.
+ */
+int uwlkv_nvram_read(uwlkv_store * store, uint8_t * data, const uwlkv_offset start, const uwlkv_offset size)
+{
+    UWLKV_STAT_ADD(reads, 1);
+    UWLKV_STAT_ADD(bytes_read, size);
+
+    UWLKV_TRACE_BEGIN(UWLKV_OP_NVRAM_READ, start);
+    const int ret = store->nvram.read(data, start, size);
+    UWLKV_TRACE_END(UWLKV_OP_NVRAM_READ, start);
+
+    return ret;
+}
+
+/**
+ * @brief	Writes raw data to NVRAM. All writes of the library go through this function.
+ *
+ * @param [in]	store	The store.
+ * @param [in]	data 	Data to be written.
+ * @param 	  	start	Offset in bytes.
+ * @param 	  	size 	Number of bytes to write.
+ *
+ * @returns	Result of interface write function, 0 on success.
+ */
+int uwlkv_nvram_write(uwlkv_store * store, uint8_t * data, const uwlkv_offset start, const uwlkv_offset size)
+{
+    UWLKV_STAT_ADD(writes, 1);
+    UWLKV_STAT_ADD(bytes_written, size);
+
+    UWLKV_TRACE_BEGIN(UWLKV_OP_NVRAM_WRITE, start);
+    const int ret = store->nvram.write(data, start, size);
+    UWLKV_TRACE_END(UWLKV_OP_NVRAM_WRITE, start);
+
+    return ret;
+}
+
+/**
+ * @brief	Erases an area of NVRAM. All erases of the library go through this function.
+ *
+ * @param [in]	store	The store.
+ * @param 	  	area 	Area to be erased.
+ *
+ * @returns	Result of interface erase function, 0 on success.
+ */
+int uwlkv_nvram_erase(uwlkv_store * store, const uwlkv_area area)
+{
+    UWLKV_STAT_ADD(erases, 1);
+    UWLKV_WEAR_ERASED(store, area);
+
+    int ret = 1;
+    UWLKV_TRACE_BEGIN(UWLKV_OP_NVRAM_ERASE, area);
+    switch (area)
+    {
+    case UWLKV_MAIN:
+        ret = store->nvram.erase_main();
+        break;
+
+    case UWLKV_RESERVED:
+        ret = store->nvram.erase_reserve();
+        break;
+
+#ifdef UWLKV_HOT_COLD
+    case UWLKV_COLD:
+        ret = store->nvram.erase_cold();
+        break;
+#endif
+
+    default:
+        break;
+    }
+    UWLKV_TRACE_END(UWLKV_OP_NVRAM_ERASE, area);
+
+    return ret;
+}
 
 /**
  * @brief	Read entry from NVRAM by offset.
  *
+ * @param [in] 	store 	The store.
  * @param 	   	offset	Offset in bytes.
  * @param [out]	key   	Entry key.
  * @param [out]	value 	Entry value.
  *
  * @returns	UWLKV_E_SUCCESS on successeful read.
  */
-uwlkv_error uwlkv_read_entry(const uwlkv_offset offset, uwlkv_key * key, uwlkv_value * value)
+uwlkv_error uwlkv_read_entry(uwlkv_store * store, const uwlkv_offset offset, uwlkv_key * key, uwlkv_value * value)
 {
-    if ((offset + UWLKV_ENTRY_SIZE) > nvram_interface.size)
+    if ((offset + UWLKV_ENTRY_SIZE) > store->nvram.size)
     {
         return UWLKV_E_WRONG_OFFSET;
     }
 
     uint8_t block[UWLKV_ENTRY_SIZE];
-    if (nvram_interface.read((uint8_t *)&block, offset, UWLKV_ENTRY_SIZE))
+    if (uwlkv_nvram_read(store, (uint8_t *)&block, offset, UWLKV_ENTRY_SIZE))
+    {
+        return UWLKV_E_NVRAM_ERROR;
+    }
+
+    return uwlkv_decode_entry(block, key, value);
+}
+
+/**
+ * @brief	Reads several consecutive entries from NVRAM with a single interface call.
+ *
+ * @param [in] 	store 	The store.
+ * @param 	   	offset	Offset of the first entry in bytes.
+ * @param [out]	blocks	Buffer for raw entries, at least count * UWLKV_ENTRY_SIZE bytes.
+ * @param 	   	count 	Number of entries to read.
+ *
+ * @returns	UWLKV_E_SUCCESS on successeful read.
+ */
+uwlkv_error uwlkv_read_entries(uwlkv_store * store, const uwlkv_offset offset, uint8_t * blocks, const uwlkv_offset count)
+{
+    const uwlkv_offset size = count * (uwlkv_offset)UWLKV_ENTRY_SIZE;
+    if ((offset + size) > store->nvram.size)
+    {
+        return UWLKV_E_WRONG_OFFSET;
+    }
+
+    if (uwlkv_nvram_read(store, blocks, offset, size))
     {
         return UWLKV_E_NVRAM_ERROR;
     }
 
+    return UWLKV_E_SUCCESS;
+}
+
+/**
+ * @brief	Deserializes an entry previously read from NVRAM.
+ *
+ * @param [in] 	block	Raw entry, UWLKV_ENTRY_SIZE bytes.
+ * @param [out]	key  	Entry key.
+ * @param [out]	value	Entry value.
+ *
+ * @returns	- UWLKV_E_SUCCESS,
+ * 			- UWLKV_E_NOT_EXIST if block is erased or
+ * 			- UWLKV_E_CORRUPTED if checksum doesn't match (UWLKV_CRC).
+ */
+uwlkv_error uwlkv_decode_entry(const uint8_t * block, uwlkv_key * key, uwlkv_value * value)
+{
     if (uwlkv_is_block_erased(block, UWLKV_ENTRY_SIZE))
     {
         return UWLKV_E_NOT_EXIST;
     }
 
-    *key      = *(uwlkv_key*)&block[0];
-    *value    = *(uwlkv_value*)&block[sizeof(uwlkv_key)];
+#ifdef UWLKV_CRC
+    uwlkv_crc crc;
+    memcpy(&crc, &block[UWLKV_O_ENTRY_CRC], sizeof(crc));
+    if (crc != entry_crc(block))
+    {
+        UWLKV_STAT_ADD(corrupted, 1);
+        return UWLKV_E_CORRUPTED;
+    }
+#endif
+
+    *key      = *(const uwlkv_key*)&block[0];
+    *value    = *(const uwlkv_value*)&block[sizeof(uwlkv_key)];
 
     return UWLKV_E_SUCCESS;
 }
 
+/**
+ * @brief	Serializes an entry to be written to NVRAM.
+ *
+ * @param [out]	block	Buffer for raw entry, UWLKV_ENTRY_SIZE bytes.
+ * @param 	   	key  	Entry key.
+ * @param 	   	value	Entry value.
+ */
+static void encode_entry(uint8_t * block, const uwlkv_key key, const uwlkv_value value)
+{
+    uwlkv_key * key_in_block       = (uwlkv_key*)&block[0];
+    uwlkv_value * value_in_block   = (uwlkv_value*)&block[sizeof(uwlkv_key)];
+
+    *key_in_block   = key;
+    *value_in_block = value;
+#ifdef UWLKV_CRC
+    const uwlkv_crc crc = entry_crc(block);
+    memcpy(&block[UWLKV_O_ENTRY_CRC], &crc, sizeof(crc));
+#endif
+#ifdef UWLKV_EEPROM
+    block[UWLKV_O_ENTRY_SEQUENCE] = UWLKV_ERASED_BYTE_VALUE;
+#endif
+}
+
 /**
  * @brief	Write entry to NVRAM by offset.
  *
+ * @param 	store 	The store.
  * @param 	offset	Offset in bytes.
  * @param 	key   	Entry key.
  * @param 	value 	Entry value.
  *
  * @returns	UWLKV_E_SUCCESS on successeful write.
  */
-uwlkv_error uwlkv_write_entry(uwlkv_offset offset, uwlkv_key key, uwlkv_value value)
+uwlkv_error uwlkv_write_entry(uwlkv_store * store, uwlkv_offset offset, uwlkv_key key, uwlkv_value value)
 {
-    if ((offset + UWLKV_ENTRY_SIZE) > nvram_interface.size)
+    if ((offset + UWLKV_ENTRY_SIZE) > store->nvram.size)
     {
         return UWLKV_E_WRONG_OFFSET;
     }
 
     uint8_t block[UWLKV_ENTRY_SIZE];
-    uwlkv_key * key_in_block       = (uwlkv_key*)&block[0];
-    uwlkv_value * value_in_block   = (uwlkv_value*)&block[sizeof(uwlkv_key)];
+    encode_entry(block, key, value);
 
-    *key_in_block   = key;
-    *value_in_block = value;
+    if (uwlkv_nvram_write(store, (uint8_t *)&block, offset, UWLKV_ENTRY_SIZE))
+    {
+        return UWLKV_E_NVRAM_ERROR;
+    }
+
+    return UWLKV_E_SUCCESS;
+}
+
+#ifdef UWLKV_EEPROM
+/**
+ * @brief	Writes entry to a slot of EEPROM ring. Sequence number is the last byte and it is
+ * 			written by a separate write after the rest of the slot, so the slot joins its ring
+ * 			only when its content is complete, whatever order the device writes bytes in.
+ *
+ * @param 	store   	The store.
+ * @param 	offset  	Offset of the slot in bytes.
+ * @param 	key     	Entry key.
+ * @param 	value   	Entry value.
+ * @param 	sequence	Sequence number of the slot.
+ *
+ * @returns	UWLKV_E_SUCCESS on successeful write.
+ */
+uwlkv_error uwlkv_write_slot(uwlkv_store * store, uwlkv_offset offset, uwlkv_key key, uwlkv_value value, uint8_t sequence)
+{
+    if ((offset + UWLKV_ENTRY_SIZE) > store->nvram.size)
+    {
+        return UWLKV_E_WRONG_OFFSET;
+    }
+
+    uint8_t block[UWLKV_ENTRY_SIZE];
+    encode_entry(block, key, value);
 
-    if (nvram_interface.write((uint8_t *)&block, offset, UWLKV_ENTRY_SIZE))
+    if (   uwlkv_nvram_write(store, block, offset, UWLKV_O_ENTRY_SEQUENCE)
+        || uwlkv_nvram_write(store, &sequence, offset + UWLKV_O_ENTRY_SEQUENCE, UWLKV_SEQUENCE_SIZE) )
     {
         return UWLKV_E_NVRAM_ERROR;
     }
 
     return UWLKV_E_SUCCESS;
 }
+#endif
 
 /**
  * @brief	Checks that given block is fully erased (filled with UWLKV_ERASED_BYTE_VALUE)
@@ -81,7 +292,7 @@ uwlkv_error uwlkv_write_entry(uwlkv_offset offset, uwlkv_key key, uwlkv_value va
  */
 uint8_t uwlkv_is_block_erased(const uint8_t * data, const uwlkv_offset size)
 {
-    uint8_t erased_bytes = 0;
+    uwlkv_offset erased_bytes = 0;
     for (uwlkv_offset i = 0; i < size; i++)
     {
         if (data[i] == UWLKV_ERASED_BYTE_VALUE)
@@ -1,8 +1,18 @@
 #ifndef UWLKV_ENTRY_H
 #define UWLKV_ENTRY_H
 
-uwlkv_error uwlkv_read_entry(uwlkv_offset offset, uwlkv_key * key, uwlkv_value * value);
-uwlkv_error uwlkv_write_entry(uwlkv_offset offset, uwlkv_key key, uwlkv_value value);
+int uwlkv_nvram_read(uwlkv_store * store, uint8_t * data, uwlkv_offset start, uwlkv_offset size);
+int uwlkv_nvram_write(uwlkv_store * store, uint8_t * data, uwlkv_offset start, uwlkv_offset size);
+int uwlkv_nvram_erase(uwlkv_store * store, uwlkv_area area);
+uwlkv_error uwlkv_read_entry(uwlkv_store * store, uwlkv_offset offset, uwlkv_key * key, uwlkv_value * value);
+uwlkv_error uwlkv_read_entries(uwlkv_store * store, uwlkv_offset offset, uint8_t * blocks, uwlkv_offset count);
+uwlkv_error uwlkv_decode_entry(const uint8_t * block, uwlkv_key * key, uwlkv_value * value);
+uwlkv_error uwlkv_write_entry(uwlkv_store * store, uwlkv_offset offset, uwlkv_key key, uwlkv_value value);
 uint8_t uwlkv_is_block_erased(const uint8_t * data, const uwlkv_offset size);
+#ifdef UWLKV_EEPROM
+uwlkv_error uwlkv_write_slot(uwlkv_store * store, uwlkv_offset offset, uwlkv_key key, uwlkv_value value, uint8_t sequence);
+
+#define UWLKV_O_ENTRY_SEQUENCE      (UWLKV_ENTRY_SIZE - UWLKV_SEQUENCE_SIZE)  /* Offset of sequence number in entry */
+#endif
 
 #endif
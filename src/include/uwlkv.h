@@ -7,29 +7,143 @@
 typedef uint16_t uwlkv_key;                        /* Record key */
 typedef int32_t  uwlkv_value;                      /* Record value */
 typedef uint32_t uwlkv_offset;                     /* NVRAM address. Can be reduced to match memory size and save some RAM */
+typedef uint16_t uwlkv_crc;                        /* Entry checksum with UWLKV_CRC: low bytes of CRC-32. Any unsigned type */
 typedef int(* uwlkv_erase)(void);                  /* NVRAM erase function prototype */
+typedef int(* uwlkv_foreach_callback)(uwlkv_key key, uwlkv_value value, void * context); /* Return non-zero to stop */
 
 #define UWLKV_O_ERASE_STARTED       (0)            /* Offset of ERASE_STARTED flag */
 #define UWLKV_O_ERASE_FINISHED      (1)            /* Offset of ERASE_FINISHED flag */
-#define UWLKV_METADATA_SIZE         (2)            /* Number of bytes, that library use in the beginning of each area */
+#define UWLKV_O_ERASE_COUNTERS      (2)            /* Offset of erase counters of all areas, with UWLKV_WEAR */
+#define UWLKV_O_LAYOUT              (UWLKV_O_ERASE_COUNTERS + UWLKV_WEAR_SIZE) /* Offset of layout header, with UWLKV_MIGRATE */
+#define UWLKV_METADATA_SIZE         (UWLKV_O_LAYOUT + UWLKV_LAYOUT_SIZE) /* Number of bytes, that library use in the beginning of each area */
 #define UWLKV_NVRAM_ERASE_STARTED   (0xE2)         /* Magic for ERASE_STARTED flag */
 #define UWLKV_NVRAM_ERASE_FINISHED  (0x3E)         /* Magic for ERASE_FINISHED flag */
+#define UWLKV_NVRAM_FULL_ERASE_STARTED (0xC2)      /* Magic for ERASE_STARTED flag, when cold area is erased too */
+#define UWLKV_EEPROM_FORMAT_STARTED (0x5A)         /* EEPROM: magic for ERASE_STARTED flag, distinct from log NVRAM */
+#define UWLKV_EEPROM_FORMAT_FINISHED (0xA7)        /* EEPROM: magic for ERASE_FINISHED flag */
 
-#define UWLKV_ENTRY_SIZE            (sizeof(uwlkv_key) + sizeof(uwlkv_value))
+#define UWLKV_ENTRY_SIZE            (sizeof(uwlkv_key) + sizeof(uwlkv_value) + UWLKV_CRC_SIZE + UWLKV_SEQUENCE_SIZE)
 #define UWLKV_MINIMAL_SIZE          (UWLKV_ENTRY_SIZE + UWLKV_METADATA_SIZE)
+#ifdef UWLKV_KEYS_FILE
+#include UWLKV_KEYS_FILE                           /* Defines UWLKV_KEYS, see "Key registry" below */
+#endif
+#if defined(UWLKV_KEYS) && defined(UWLKV_MAX_ENTRIES)
+#error "UWLKV_MAX_ENTRIES is the number of keys in UWLKV_KEYS, it can't be set"
+#endif
+#ifdef UWLKV_KEYS
+#define UWLKV_KEY_COUNT(name, key)  + 1
+#define UWLKV_MAX_ENTRIES           (0 UWLKV_KEYS(UWLKV_KEY_COUNT))
+#endif
+#ifndef UWLKV_MAX_ENTRIES
 #define UWLKV_MAX_ENTRIES           (20)           /* Maximum amount of unique keys. Increases RAM consumption */
+#endif
 #define UWLKV_ERASED_BYTE_VALUE     (0xFF)         /* Value of erased byte of NVRAM */
+#define UWLKV_TOMBSTONE_KEY         ((uwlkv_key)-1)/* Reserved key. Such entry deletes a key stored as its value. NVRAM written
+                                                      by versions without deletes must not hold it, see README */
+
+/* Optional features. Uncomment here or pass as compiler definitions to enable */
+/* #define UWLKV_RAMLESS */                        /* Look keys up in NVRAM instead of keeping a map in RAM */
+/* #define UWLKV_HOT_COLD */                       /* Keep rarely updated entries in a separate area */
+/* #define UWLKV_STATS */                          /* Collect performance counters, see uwlkv_get_stats() */
+/* #define UWLKV_TRACE */                          /* Record events to a ring buffer, see uwlkv_get_trace() */
+/* #define UWLKV_WEAR */                           /* Keep erase counters in NVRAM, see uwlkv_get_wear(). Changes NVRAM layout */
+/* #define UWLKV_CRC */                            /* Protect each entry with a checksum, see uwlkv_crc. Changes NVRAM layout */
+/* #define UWLKV_CRC_HOOK my_crc32 */              /* CRC: use hardware CRC unit instead of uwlkv_crc32(), see below */
+/* #define UWLKV_KEYS_FILE "keys.h" */             /* Header with UWLKV_KEYS table of all keys, see below */
+/* #define UWLKV_LAZY_INIT */                      /* Build map in steps after init, see uwlkv_init_lazy() */
+/* #define UWLKV_EEPROM */                         /* Byte-writable EEPROM: a ring of slots per key, no erases. Changes NVRAM layout */
+/* #define UWLKV_MIGRATE */                        /* Keep layout in NVRAM, move entries when interface sizes change. Changes NVRAM layout */
+
+#if defined(UWLKV_RAMLESS) && defined(UWLKV_HOT_COLD)
+#error "UWLKV_HOT_COLD tracks updates in RAM map, it can't be used with UWLKV_RAMLESS"
+#endif
+#if defined(UWLKV_RAMLESS) && defined(UWLKV_KEYS)
+#error "UWLKV_KEYS assigns slots of RAM map, it can't be used with UWLKV_RAMLESS"
+#endif
+#if defined(UWLKV_EEPROM) && (defined(UWLKV_RAMLESS) || defined(UWLKV_HOT_COLD) || defined(UWLKV_WEAR) || defined(UWLKV_LAZY_INIT))
+#error "UWLKV_EEPROM has no log and no erases, it can't be used with UWLKV_RAMLESS, UWLKV_HOT_COLD, UWLKV_WEAR or UWLKV_LAZY_INIT"
+#endif
+#if defined(UWLKV_MIGRATE) && (defined(UWLKV_RAMLESS) || defined(UWLKV_EEPROM))
+#error "UWLKV_MIGRATE indexes the old layout in RAM map, it can't be used with UWLKV_RAMLESS or UWLKV_EEPROM"
+#endif
+
+#ifndef UWLKV_SCAN_ENTRIES
+#define UWLKV_SCAN_ENTRIES          (8)            /* Entries fetched by a single read during NVRAM scans */
+#endif
+#ifndef UWLKV_TAIL_INDEX_SIZE
+#define UWLKV_TAIL_INDEX_SIZE       (4)            /* RAM-less mode: recently written keys remembered in RAM */
+#endif
+#ifndef UWLKV_TRACE_SIZE
+#define UWLKV_TRACE_SIZE            (64)           /* Trace: number of events in ring buffer */
+#endif
+#ifndef UWLKV_ENDURANCE
+#define UWLKV_ENDURANCE             (10000)        /* Wear: erase cycles guaranteed by NVRAM manufacturer */
+#endif
+#ifndef UWLKV_COLD_THRESHOLD
+#define UWLKV_COLD_THRESHOLD        (1)            /* Hot/cold mode: entry updated less times between wrap-arounds is cold */
+#endif
+
+#ifdef UWLKV_HOT_COLD
+#define UWLKV_WEAR_AREAS            (3)            /* Areas with erase counters: main, reserved and cold */
+#else
+#define UWLKV_WEAR_AREAS            (2)            /* Areas with erase counters: main and reserved */
+#endif
+#ifdef UWLKV_WEAR
+#define UWLKV_WEAR_SIZE             (UWLKV_WEAR_AREAS * 4)
+#else
+#define UWLKV_WEAR_SIZE             (0)
+#endif
+#ifdef UWLKV_CRC
+#define UWLKV_CRC_SIZE              (sizeof(uwlkv_crc))
+#else
+#define UWLKV_CRC_SIZE              (0)
+#endif
+#ifdef UWLKV_MIGRATE
+#define UWLKV_LAYOUT_VERSION        (1)            /* Migrate: format of entries and metadata, kept in layout header */
+#define UWLKV_LAYOUT_SIZE           (3 + 3 * sizeof(uwlkv_offset)) /* Version, entry and metadata sizes, size, reserved and cold */
+#else
+#define UWLKV_LAYOUT_SIZE           (0)
+#endif
+#ifdef UWLKV_EEPROM
+#define UWLKV_SEQUENCE_SIZE         (1)            /* EEPROM: sequence number of a slot in its ring */
+#else
+#define UWLKV_SEQUENCE_SIZE         (0)
+#endif
+
+/* Key registry. When all keys are known at build time, list them as
+ *     #define UWLKV_KEYS(X)   X(BRIGHTNESS, 1) X(VOLUME, 2) X(BOOT_COUNT, 100)
+ * in the UWLKV_KEYS_FILE header (or define UWLKV_KEYS right here). The map then has exactly one
+ * slot per key and a key is found by a switch instead of a search. UWLKV_KEY_<name> constants
+ * name the keys, so a misspelled key doesn't compile, and so do duplicated key values. Any
+ * other key is rejected with UWLKV_E_UNKNOWN_KEY. Entries of keys removed from the table are
+ * ignored on boot and dropped by the next wrap-around.
+ */
+#ifdef UWLKV_KEYS
+#define UWLKV_KEY_NAME(name, key)   UWLKV_KEY_##name = (key),
+#define UWLKV_KEY_SLOT(name, key)   UWLKV_SLOT_##name,
+enum { UWLKV_KEYS(UWLKV_KEY_NAME) };
+enum { UWLKV_KEYS(UWLKV_KEY_SLOT) };
+#endif
 
 typedef struct
 {
     uwlkv_key      key;
     uwlkv_offset   offset;
+#ifdef UWLKV_HOT_COLD
+    uint8_t        updates;             /* Number of updates since the last wrap-around */
+#endif
 } uwlkv_entry;
 
 /* You must provide an interface to access storage device. 
  * Read/write functions should use logical address (starting from 0).
  * erase_main() should erase a main (large) area, without touching reserved area.
  * erase_reserve() should erase only a reserved area.
+ * With UWLKV_HOT_COLD, cold area of `cold` bytes is located right before reserved area.
+ * erase_cold() should erase only that area and erase_main() should not touch it.
+ * With UWLKV_EEPROM NVRAM is never erased: erase functions and `reserved` are not used and may
+ * be left zero, write() should overwrite bytes in place.
+ * With UWLKV_MIGRATE sizes may change between firmware versions: on init entries are moved to
+ * the new layout, see "Layout migration" in README.
  */
 typedef struct
 {
@@ -39,6 +153,10 @@ typedef struct
     uwlkv_erase  erase_reserve;
     uwlkv_offset size;                  /* Total size of provided memory */
     uwlkv_offset reserved;              /* Reserved area size in that memory */
+#ifdef UWLKV_HOT_COLD
+    uwlkv_erase  erase_cold;
+    uwlkv_offset cold;                  /* Cold area size in that memory */
+#endif
 } uwlkv_nvram_interface;
 
 typedef enum
@@ -49,12 +167,17 @@ typedef enum
     UWLKV_E_NOT_STARTED,                /* UWLKV haven't been initialized */
     UWLKV_E_NO_SPACE,                   /* No free space in map for new entry */
     UWLKV_E_WRONG_OFFSET,               /* Provided offset is out of NVRAM bounds */
+    UWLKV_E_RESERVED_KEY,               /* Key is reserved by library (UWLKV_TOMBSTONE_KEY) */
+    UWLKV_E_UNKNOWN_KEY,                /* Key is not listed in UWLKV_KEYS */
+    UWLKV_E_CORRUPTED,                  /* Entry checksum doesn't match its content (UWLKV_CRC) */
+    UWLKV_E_LAYOUT,                     /* NVRAM layout can't be migrated to the interface one (UWLKV_MIGRATE) */
 } uwlkv_error;
 
 typedef enum
 {
     UWLKV_MAIN,
-    UWLKV_RESERVED
+    UWLKV_RESERVED,
+    UWLKV_COLD
 } uwlkv_area;
 
 typedef enum
@@ -62,9 +185,144 @@ typedef enum
     UWLKV_S_BLANK,                      /* NVRAM is fully erased (new) */
     UWLKV_S_CLEAN,                      /* Last shutdown was clean */
     UWLKV_S_MAIN_ERASE_INTERRUPTED,     /* Main area erase was interrupted */
-    UWLKV_S_RESERVE_ERASE_INTERRUPTED   /* Reserved area erase was interrupted */
+    UWLKV_S_RESERVE_ERASE_INTERRUPTED,  /* Reserved area erase was interrupted */
+    UWLKV_S_NUMBER                      /* Number of states */
 } uwlkv_nvram_state;
 
+#if defined(UWLKV_STATS) || defined(UWLKV_TRACE)
+typedef uint32_t(* uwlkv_timestamp)(void);         /* Current time in any units */
+#endif
+
+#ifdef UWLKV_STATS
+typedef struct
+{
+    uint32_t reads;                     /* NVRAM interface calls */
+    uint32_t writes;
+    uint32_t erases;
+    uint32_t bytes_read;
+    uint32_t bytes_written;
+    uint32_t compactions;               /* Wrap-arounds, when main area was erased */
+    uint32_t boots[UWLKV_S_NUMBER];     /* Initializations by NVRAM state found */
+    uint32_t resumed_recoveries;        /* Interrupted wrap-arounds completed without erasing main area again */
+    uint32_t lookups;                   /* Searches of a key in map */
+    uint32_t lookup_probes;             /* Entries examined by all lookups */
+    uint32_t max_lookup_probes;         /* Entries examined by the longest lookup */
+    uint32_t compaction_time;           /* Total time spent in wrap-arounds, by timestamp hook */
+    uint32_t max_compaction_time;       /* The longest wrap-around */
+    uint32_t corrupted;                 /* Entries with wrong checksum found, with UWLKV_CRC */
+    uint32_t migrations;                /* Boots which moved entries to a new layout, with UWLKV_MIGRATE */
+} uwlkv_stats;
+#endif
+
+#ifdef UWLKV_TRACE
+typedef enum
+{
+    UWLKV_OP_SET_VALUE,
+    UWLKV_OP_GET_VALUE,
+    UWLKV_OP_DELETE_VALUE,
+    UWLKV_OP_GET_NEXT_BLOCK,
+    UWLKV_OP_RESTART_MAP,
+    UWLKV_OP_PREPARE_AREA,
+    UWLKV_OP_NVRAM_READ,
+    UWLKV_OP_NVRAM_WRITE,
+    UWLKV_OP_NVRAM_ERASE,
+    UWLKV_OP_NUMBER                     /* Number of operations */
+} uwlkv_trace_operation;
+
+typedef struct
+{
+    uint32_t timestamp;                 /* Value of timestamp hook */
+    uint32_t data;                      /* Key, NVRAM offset or area, depending on operation.
+                                           Wrap-around: offset of the next free block */
+    uint8_t  operation;                 /* uwlkv_trace_operation */
+    uint8_t  begin;                     /* 1 when operation begins, 0 when it ends */
+} uwlkv_trace_event;
+#endif
+
+#ifdef UWLKV_WEAR
+typedef struct
+{
+    uint32_t erases[UWLKV_WEAR_AREAS];  /* Erases of each area (by uwlkv_area) during NVRAM lifetime */
+    uint32_t writes;                    /* Entries written since uwlkv_init() */
+    uint32_t writes_per_erase;          /* Entries which can be written before the next wrap-around */
+    uint32_t remaining_erases;          /* Erases of the most worn area left until UWLKV_ENDURANCE */
+    uint32_t remaining_writes;          /* Entries which can be written until UWLKV_ENDURANCE */
+} uwlkv_wear;
+#endif
+
+/* Map of keys to their entries, a part of uwlkv_store */
+#ifdef UWLKV_RAMLESS
+typedef struct
+{
+    uwlkv_offset   sorted_end;          /* End of sorted prefix */
+    uwlkv_key      last_sorted_key;     /* Largest key of sorted prefix */
+    uwlkv_offset   log_end;             /* End of the last indexed entry */
+    uwlkv_key      used_entries;
+    uint8_t        used_entries_known;  /* used_entries is calculated lazily */
+    uwlkv_entry    found_entry;         /* Storage for uwlkv_get_entry() result */
+    uwlkv_entry    cursor;              /* Storage for uwlkv_get_entry_by_id() result */
+    uwlkv_key      cursor_number;
+    uint8_t        cursor_valid;
+    uwlkv_entry    tail_index[UWLKV_TAIL_INDEX_SIZE];
+    uwlkv_key      tail_index_used;
+    uwlkv_key      tail_index_next;     /* Slot to be replaced by the next new key */
+} uwlkv_map;
+#else
+typedef struct
+{
+    uwlkv_entry    entries[UWLKV_MAX_ENTRIES];
+    uwlkv_key      used_entries;
+#ifdef UWLKV_KEYS
+    uwlkv_key      positions[UWLKV_MAX_ENTRIES];  /* Entry index + 1 by slot, 0 if not stored */
+#endif
+} uwlkv_map;
+#endif
+
+/* State of a store: NVRAM interface, map and positions in NVRAM. Fields are private to the
+ * library, the structure is declared here only to be allocated by user. uwlkv_init() and other
+ * functions without a store argument use a default one, uwlkv_store_* functions work with any
+ * number of stores, e.g. one per flash chip. Stores share no state, so each store may be used
+ * from its own task without locks. Performance counters (UWLKV_STATS) and trace (UWLKV_TRACE)
+ * are global and not synchronized, so with them calls to all stores need one common lock.
+ */
+typedef struct
+{
+    uwlkv_nvram_interface nvram;
+    uwlkv_map      map;
+    uwlkv_offset   next_block;
+#ifdef UWLKV_HOT_COLD
+    uwlkv_offset   next_cold_block;
+#endif
+#ifdef UWLKV_WEAR
+    uint32_t       erases[UWLKV_WEAR_AREAS];
+    uint32_t       writes;              /* Entries written since boot */
+#endif
+#ifdef UWLKV_LAZY_INIT
+    uwlkv_offset   index_next;          /* Next entry to be added to map */
+    uint8_t        indexing;            /* Map doesn't cover all entries yet */
+#endif
+#ifdef UWLKV_EEPROM
+    uwlkv_offset   ring_slots;          /* Slots in the ring of each key */
+#endif
+    uwlkv_key      key_limit;           /* New keys are refused when this many are stored */
+    uint8_t        initialized;
+} uwlkv_store;
+
+/* Keys spread over several stores by a hash of key, see uwlkv_shard_of(). The number of shards
+ * and the hash define where keys are stored, so they can't change once data is written. A call
+ * locks only the shard of its key, so a wrap-around of one shard doesn't block the others.
+ * With UWLKV_STATS or UWLKV_TRACE lock and unlock have to take one lock for all shards.
+ */
+typedef void(* uwlkv_shard_lock)(uint8_t shard);   /* Serializes calls to a shard, e.g. takes a mutex */
+
+typedef struct
+{
+    uwlkv_store *    stores;            /* Array of stores, one per shard */
+    uint8_t          number;            /* Number of shards */
+    uwlkv_shard_lock lock;              /* Optional, null if all calls come from one task */
+    uwlkv_shard_lock unlock;
+} uwlkv_shards;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -74,6 +332,57 @@ extern "C" {
     uwlkv_key uwlkv_get_free_entries(void);
     uwlkv_error uwlkv_get_value(uwlkv_key key, uwlkv_value * value);
     uwlkv_error uwlkv_set_value(uwlkv_key key, uwlkv_value value);
+    uwlkv_error uwlkv_delete_value(uwlkv_key key);
+    uwlkv_error uwlkv_foreach(uwlkv_foreach_callback callback, void * context);
+    uwlkv_error uwlkv_compact(void);
+
+    uwlkv_offset uwlkv_store_init(uwlkv_store * store, const uwlkv_nvram_interface * nvram_interface);
+    uwlkv_key uwlkv_store_get_entries_number(uwlkv_store * store);
+    uwlkv_key uwlkv_store_get_free_entries(uwlkv_store * store);
+    void uwlkv_store_set_key_limit(uwlkv_store * store, uwlkv_key limit);
+    uwlkv_error uwlkv_store_get_value(uwlkv_store * store, uwlkv_key key, uwlkv_value * value);
+    uwlkv_error uwlkv_store_set_value(uwlkv_store * store, uwlkv_key key, uwlkv_value value);
+    uwlkv_error uwlkv_store_delete_value(uwlkv_store * store, uwlkv_key key);
+    uwlkv_error uwlkv_store_foreach(uwlkv_store * store, uwlkv_foreach_callback callback, void * context);
+    uwlkv_error uwlkv_store_compact(uwlkv_store * store);
+#ifdef UWLKV_LAZY_INIT
+    uwlkv_offset uwlkv_init_lazy(const uwlkv_nvram_interface * nvram_interface);
+    uwlkv_offset uwlkv_init_step(uwlkv_offset entries);
+    uwlkv_offset uwlkv_store_init_lazy(uwlkv_store * store, const uwlkv_nvram_interface * nvram_interface);
+    uwlkv_offset uwlkv_store_init_step(uwlkv_store * store, uwlkv_offset entries);
+#endif
+
+    uwlkv_offset uwlkv_shards_init(uwlkv_shards * shards, const uwlkv_nvram_interface * nvram_interfaces, uint8_t * failed);
+    uint8_t uwlkv_shard_of(const uwlkv_shards * shards, uwlkv_key key);
+    uint32_t uwlkv_shards_get_entries_number(uwlkv_shards * shards);
+    uwlkv_error uwlkv_shards_get_value(uwlkv_shards * shards, uwlkv_key key, uwlkv_value * value);
+    uwlkv_error uwlkv_shards_set_value(uwlkv_shards * shards, uwlkv_key key, uwlkv_value value);
+    uwlkv_error uwlkv_shards_delete_value(uwlkv_shards * shards, uwlkv_key key);
+    uwlkv_error uwlkv_shards_foreach(uwlkv_shards * shards, uwlkv_foreach_callback callback, void * context);
+#if defined(UWLKV_STATS) || defined(UWLKV_TRACE)
+    void uwlkv_set_timestamp_hook(uwlkv_timestamp hook);
+#endif
+#ifdef UWLKV_STATS
+    void uwlkv_get_stats(uwlkv_stats * stats);
+    void uwlkv_reset_stats(void);
+#endif
+#ifdef UWLKV_WEAR
+    void uwlkv_get_wear(uwlkv_wear * wear);
+    void uwlkv_store_get_wear(uwlkv_store * store, uwlkv_wear * wear);
+    uint32_t uwlkv_wear_time_left(const uwlkv_wear * wear, uint32_t uptime);
+#endif
+#ifdef UWLKV_CRC
+    uint32_t uwlkv_crc32(const uint8_t * data, uint32_t size);
+#endif
+#ifdef UWLKV_CRC_HOOK
+    /* CRC: Calculates the same CRC-32 as uwlkv_crc32() (zlib one) with hardware. Most MCU CRC
+     * units can be configured to it: polynomial 0x04C11DB7, reflected input and output, initial
+     * value 0xFFFFFFFF and final XOR 0xFFFFFFFF. Entries are hashed without their checksum. */
+    uint32_t UWLKV_CRC_HOOK(const uint8_t * data, uint32_t size);
+#endif
+#ifdef UWLKV_TRACE
+    uint32_t uwlkv_get_trace(uwlkv_trace_event * events, uint32_t size, uint32_t * position);
+#endif
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,185 @@
+#ifndef UWLKV_NVRAM_LIB_HPP
+#define UWLKV_NVRAM_LIB_HPP
+
+/* Typed C++ interface to a store of the C library. Key and value types, number of keys and NVRAM
+ * layout are template parameters, so one program may have several stores with different
+ * configurations. It is a wrapper and not a specialized engine: every call goes to uwlkv_store_*
+ * functions of the C library, which has to be linked, with the same NVRAM interface callbacks,
+ * entry size and map, so it is exactly as fast as the C functions.
+ *
+ * Layout describes NVRAM the same way as uwlkv_nvram_interface does, with static members:
+ *
+ *     struct Layout
+ *     {
+ *         static constexpr uwlkv_offset size     = 4096;   // Total size of provided memory
+ *         static constexpr uwlkv_offset reserved = 1024;   // Reserved area size in that memory
+ *         static int read(uint8_t * data, uwlkv_offset start, uwlkv_offset size);
+ *         static int write(uint8_t * data, uwlkv_offset start, uwlkv_offset size);
+ *         static int erase_main(void);
+ *         static int erase_reserve(void);
+ *     };
+ *
+ * With UWLKV_HOT_COLD Layout also has `cold` size and `erase_cold()`.
+ * Keys and values are stored as uwlkv_key and uwlkv_value, so Key and Value must fit them, and
+ * MaxEntries can't be larger than UWLKV_MAX_ENTRIES.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+#include "uwlkv.h"
+
+namespace uwlkv
+{
+
+template <typename Key, typename Value, uint32_t MaxEntries, typename Layout>
+class Store
+{
+public:
+    static constexpr uwlkv_offset entry_size    = UWLKV_ENTRY_SIZE;
+    static constexpr uwlkv_offset metadata_size = UWLKV_METADATA_SIZE;
+
+    static_assert(std::is_integral<Key>::value,             "Key must be an integer type");
+    static_assert(sizeof(Key) <= sizeof(uwlkv_key),         "Key is stored as uwlkv_key");
+    static_assert(std::is_trivially_copyable<Value>::value, "Value is stored as raw bytes");
+    static_assert(sizeof(Value) <= sizeof(uwlkv_value),     "Value is stored as uwlkv_value");
+    static_assert(MaxEntries <= UWLKV_MAX_ENTRIES,          "Map of the store has UWLKV_MAX_ENTRIES keys");
+    static_assert((Layout::reserved > metadata_size) && (Layout::reserved < Layout::size),
+                                                            "Reserved area size is wrong");
+
+    /**
+     * @brief	Reads NVRAM content and builds its map, same as uwlkv_init(). Number of keys is
+     * 			limited to MaxEntries.
+     *
+     * @returns	NVRAM capacity in entries or 0 if NVRAM is too small.
+     */
+    uwlkv_offset init(void)
+    {
+        uwlkv_nvram_interface nvram;
+        nvram.read          = &Layout::read;
+        nvram.write         = &Layout::write;
+        nvram.erase_main    = &Layout::erase_main;
+        nvram.erase_reserve = &Layout::erase_reserve;
+        nvram.size          = Layout::size;
+        nvram.reserved      = Layout::reserved;
+#ifdef UWLKV_HOT_COLD
+        nvram.erase_cold    = &Layout::erase_cold;
+        nvram.cold          = Layout::cold;
+#endif
+
+        const uwlkv_offset capacity = uwlkv_store_init(&store, &nvram);
+        uwlkv_store_set_key_limit(&store, static_cast<uwlkv_key>(MaxEntries));
+
+        return capacity;
+    }
+
+    /**
+     * @brief	Get value of specified key.
+     *
+     * @param 	   	key  	The key.
+     * @param [out]	value	Read value if success.
+     *
+     * @returns	UWLKV_E_SUCCESS on successful read.
+     */
+    uwlkv_error get(const Key key, Value & value)
+    {
+        uwlkv_value stored;
+        const uwlkv_error ret = uwlkv_store_get_value(&store, to_key(key), &stored);
+        if (UWLKV_E_SUCCESS == ret)
+        {
+            memcpy(&value, &stored, sizeof(Value));
+        }
+
+        return ret;
+    }
+
+    /**
+     * @brief	Set value of specified key.
+     *
+     * @param 	key  	The key.
+     * @param 	value	Value to be written.
+     *
+     * @returns	UWLKV_E_SUCCESS on successful write.
+     */
+    uwlkv_error set(const Key key, const Value & value)
+    {
+        uwlkv_value stored = 0;
+        memcpy(&stored, &value, sizeof(Value));
+        return uwlkv_store_set_value(&store, to_key(key), stored);
+    }
+
+    /**
+     * @brief	Deletes a key, same as uwlkv_delete_value().
+     *
+     * @param 	key	The key.
+     *
+     * @returns	- UWLKV_E_SUCCESS on successful write or
+     * 			- UWLKV_E_NOT_EXIST if there is no such key.
+     */
+    uwlkv_error remove(const Key key)
+    {
+        return uwlkv_store_delete_value(&store, to_key(key));
+    }
+
+    /**
+     * @brief	Calls a function for each stored key, same as uwlkv_foreach().
+     *
+     * @param 	callback	Receives key and value. Return non-zero to stop iteration. Storage
+     * 						must not be modified from the callback.
+     *
+     * @returns	UWLKV_E_SUCCESS or an error of NVRAM read.
+     */
+    template <typename Callback>
+    uwlkv_error for_each(Callback callback)
+    {
+        return uwlkv_store_foreach(&store, &visit<Callback>, &callback);
+    }
+
+    /** @brief	Returns number of unique keys in use. */
+    uint32_t get_entries_number(void)
+    {
+        return uwlkv_store_get_entries_number(&store);
+    }
+
+    /** @brief	Returns number of free unique keys. */
+    uint32_t free_entries(void)
+    {
+        return uwlkv_store_get_free_entries(&store);
+    }
+
+private:
+    uwlkv_store store = {};
+
+    /** @brief	Converts a key without sign extension, so only keys as wide as uwlkv_key may be
+     * 			UWLKV_TOMBSTONE_KEY, which C library rejects with UWLKV_E_RESERVED_KEY. */
+    static uwlkv_key to_key(const Key key)
+    {
+        return static_cast<uwlkv_key>(static_cast<typename std::make_unsigned<Key>::type>(key));
+    }
+
+    /** @brief	Passes an entry of uwlkv_store_foreach() to the callback with store types. */
+    template <typename Callback>
+    static int visit(const uwlkv_key key, const uwlkv_value value, void * context)
+    {
+        Value typed;
+        memcpy(&typed, &value, sizeof(Value));
+
+        return (*static_cast<Callback *>(context))(static_cast<Key>(key), typed) ? 1 : 0;
+    }
+};
+
+/* Definitions of constants, for the case they are bound to references (before C++17) */
+#define UWLKV_STORE_CONSTANT(type, name)                                            \
+    template <typename Key, typename Value, uint32_t MaxEntries, typename Layout>   \
+    constexpr type Store<Key, Value, MaxEntries, Layout>::name;
+
+UWLKV_STORE_CONSTANT(uwlkv_offset, entry_size)
+UWLKV_STORE_CONSTANT(uwlkv_offset, metadata_size)
+
+#undef UWLKV_STORE_CONSTANT
+
+}
+
+#endif
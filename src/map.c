@@ -2,112 +2,318 @@
  * any value within it's type range (uwlkv_key). Currently the cache is implemented as an array. 
  * Due to linear retrieval the access may become slower because of the large amount of unique keys 
  * (defined by UWLKV_MAX_ENTRIES).
+ * The map is a part of uwlkv_store, so each store has its own.
  * Also it is stored in RAM so if you want to reduce RAM usage, you may adjust UWLKV_MAX_ENTRIES
  * and data types uwlkv_key and uwlkv_offset. Also you may need to make struct uwlkv_entry packed.
+ * If even that is too much, define UWLKV_RAMLESS to replace this module with ramless.c.
+ * With UWLKV_KEYS each registered key has a slot, which points to its entry. A slot is found by
+ * a switch over all keys, which compiler turns into a jump table or a tree of comparisons, so
+ * lookups don't depend on the number of stored keys.
  */
 
 #include "uwlkv.h"
 #include "map.h"
 #include "entry.h"
+#include "stats.h"
 
-static uwlkv_entry           uwlkv_entries[UWLKV_MAX_ENTRIES];
-static uwlkv_key             used_entries;
+#ifndef UWLKV_RAMLESS
+
+#ifdef UWLKV_KEYS
+/* Registered keys can't be reserved ones */
+#define UWLKV_KEY_CHECK(name, value) \
+    typedef char uwlkv_key_##name##_is_reserved[((value) != UWLKV_TOMBSTONE_KEY) ? 1 : -1];
+UWLKV_KEYS(UWLKV_KEY_CHECK)
+
+/**
+ * @brief	Returns a slot of registered key.
+ *
+ * @param 	key	The key.
+ *
+ * @returns	Slot number or UWLKV_MAX_ENTRIES if the key is not in UWLKV_KEYS.
+ */
+uwlkv_key uwlkv_key_slot(const uwlkv_key key)
+{
+#define UWLKV_KEY_CASE(name, value) \
+    case (value):                   \
+        return UWLKV_SLOT_##name;
+
+    switch (key)
+    {
+    UWLKV_KEYS(UWLKV_KEY_CASE)
+
+    default:
+        return UWLKV_MAX_ENTRIES;
+    }
+}
+#endif
 
 /**
  * @brief	Returns a pointer to an entry with provided key.
  *
+ * @param [in] 	store	The store.
  * @param 	   	key  	The key.
- * @param [out]	entry	On success would be pointing to entry in uwlkv_entries.
+ * @param [out]	entry	On success would be pointing to entry in the map.
  *
  * @returns	- UWLKV_E_SUCCESS or
  * 			- UWLKV_E_NOT_EXIST if entry with this key is not found.
  */
-uwlkv_error uwlkv_get_entry(const uwlkv_key key, uwlkv_entry ** entry)
+uwlkv_error uwlkv_get_entry(uwlkv_store * store, const uwlkv_key key, uwlkv_entry ** entry)
 {
-    for(uwlkv_key i = 0; i < used_entries; i++)
+    uwlkv_map * map = &store->map;
+    UWLKV_STAT_ADD(lookups, 1);
+
+#ifdef UWLKV_KEYS
+    const uwlkv_key slot = uwlkv_key_slot(key);
+    UWLKV_STAT_ADD(lookup_probes, 1);
+    UWLKV_STAT_MAX(max_lookup_probes, 1);
+    if ((UWLKV_MAX_ENTRIES == slot) || (0 == map->positions[slot]))
     {
-        *entry = &uwlkv_entries[i];
-        if (key == uwlkv_entries[i].key)
+        return UWLKV_E_NOT_EXIST;
+    }
+
+    *entry = &map->entries[map->positions[slot] - 1];
+    return UWLKV_E_SUCCESS;
+#else
+    for(uwlkv_key i = 0; i < map->used_entries; i++)
+    {
+        *entry = &map->entries[i];
+        if (key == map->entries[i].key)
         {
+            UWLKV_STAT_ADD(lookup_probes, i + 1);
+            UWLKV_STAT_MAX(max_lookup_probes, i + 1);
             return UWLKV_E_SUCCESS;
         }
     }
 
+    UWLKV_STAT_ADD(lookup_probes, map->used_entries);
+    UWLKV_STAT_MAX(max_lookup_probes, map->used_entries);
     return UWLKV_E_NOT_EXIST;
+#endif
 }
 
 /**
  * @brief	Returns a pointer to an entry by it's position in cache
  *
+ * @param 	store 	The store.
  * @param 	number	Entry number
  *
  * @returns	Null if it fails, else a pointer to an uwlkv_entry.
  */
-uwlkv_entry * uwlkv_get_entry_by_id(const uwlkv_key number)
+uwlkv_entry * uwlkv_get_entry_by_id(uwlkv_store * store, const uwlkv_key number)
 {
     if (number >= UWLKV_MAX_ENTRIES)
     {
         return 0;
     }
 
-    return &uwlkv_entries[number];
+    return &store->map.entries[number];
 }
 
 /**
  * @brief	Reserves space for one entry and returns a pointer to it. This function does not
- * 			check for free space in uwlkv_entries.
+ * 			check for free space in the map.
+ *
+ * @param 	store	The store.
  *
  * @returns	Pointer to an uwlkv_entry.
  */
-uwlkv_entry * uwlkv_create_entry(void)
+uwlkv_entry * uwlkv_create_entry(uwlkv_store * store)
 {
-    used_entries += 1;
+    store->map.used_entries += 1;
 
-    return &uwlkv_entries[used_entries - 1];
+    return &store->map.entries[store->map.used_entries - 1];
 }
 
 /**
  * @brief	Updates the entry information. Creates a new one if entry with provided key currently
  * 			not exist in map.
  *
+ * @param 	store 	The store.
  * @param 	key   	Entry with this specified key would be modified.
  * @param 	offset	Logical offset of an entry in bytes.
  *
- * @returns	An uwlkv_error.
+ * @returns	- UWLKV_E_SUCCESS,
+ * 			- UWLKV_E_NO_SPACE if map is full or
+ * 			- UWLKV_E_UNKNOWN_KEY if the key is not in UWLKV_KEYS.
  */
-uwlkv_error uwlkv_update_entry(const uwlkv_key key, const uwlkv_offset offset)
+uwlkv_error uwlkv_update_entry(uwlkv_store * store, const uwlkv_key key, const uwlkv_offset offset)
 {
+    if (UWLKV_TOMBSTONE_KEY == key)
+    {
+        return UWLKV_E_RESERVED_KEY;
+    }
+
     uwlkv_entry *entry;
-    if (UWLKV_E_NOT_EXIST == uwlkv_get_entry(key, &entry))
+    if (UWLKV_E_NOT_EXIST == uwlkv_get_entry(store, key, &entry))
     {
-        if (0 == uwlkv_map_free_entries())
+        if (0 == uwlkv_map_free_entries(store))
         {
             return UWLKV_E_NO_SPACE;
         }
 
-        entry = uwlkv_create_entry();
+#ifdef UWLKV_KEYS
+        const uwlkv_key slot = uwlkv_key_slot(key);
+        if (UWLKV_MAX_ENTRIES == slot)
+        {
+            return UWLKV_E_UNKNOWN_KEY;
+        }
+#endif
+
+        entry = uwlkv_create_entry(store);
         entry->key = key;
+#ifdef UWLKV_KEYS
+        store->map.positions[slot] = store->map.used_entries;
+#endif
+#ifdef UWLKV_HOT_COLD
+        entry->updates = 0;
+#endif
     }
+#ifdef UWLKV_HOT_COLD
+    else if (entry->updates < UINT8_MAX)
+    {
+        entry->updates += 1;
+    }
+#endif
 
     entry->offset = offset;
 
     return UWLKV_E_SUCCESS;
 }
 
+/**
+ * @brief	Removes the entry from map, freeing its space for another key. The last entry takes
+ * 			place of removed one.
+ *
+ * @param 	store 	The store.
+ * @param 	key   	Key to be removed.
+ * @param 	offset	Logical offset of a tombstone entry. Not used by this map.
+ */
+void uwlkv_remove_entry(uwlkv_store * store, const uwlkv_key key, const uwlkv_offset offset)
+{
+    (void)offset;
+
+    uwlkv_map * map = &store->map;
+    uwlkv_entry *entry;
+    if (UWLKV_E_SUCCESS == uwlkv_get_entry(store, key, &entry))
+    {
+        map->used_entries -= 1;
+        *entry = map->entries[map->used_entries];
+#ifdef UWLKV_KEYS
+        map->positions[uwlkv_key_slot(entry->key)] = (uwlkv_key)(entry - map->entries + 1);
+        map->positions[uwlkv_key_slot(key)]        = 0;
+#endif
+    }
+}
+
+/**
+ * @brief	Passes every stored key and its value to the callback in the order of their offsets.
+ * 			Entries are read in chunks of UWLKV_SCAN_ENTRIES, so entries which are close to each
+ * 			other (e.g. right after a wrap-around) cost a single NVRAM read. Finding the next
+ * 			offset takes a pass over the map, so CPU time grows as a square of used entries.
+ *
+ * @param 	store   	The store.
+ * @param 	callback	Function to be called for each entry. Iteration stops when it returns
+ * 						non-zero. It must not modify the storage.
+ * @param 	context 	Pointer passed to callback as is.
+ *
+ * @returns	UWLKV_E_SUCCESS or an error of NVRAM read.
+ */
+uwlkv_error uwlkv_map_foreach(uwlkv_store * store, uwlkv_foreach_callback callback, void * context)
+{
+    const uwlkv_map * map = &store->map;
+    uint8_t blocks[UWLKV_SCAN_ENTRIES * UWLKV_ENTRY_SIZE];
+    uwlkv_offset chunk_start = 0;
+    uwlkv_offset chunk_end   = 0;
+    uwlkv_offset last_offset = 0;
+
+    for (uwlkv_key i = 0; i < map->used_entries; i++)
+    {
+        if (map->entries[i].offset > last_offset)
+        {
+            last_offset = map->entries[i].offset;
+        }
+    }
+
+    const uwlkv_entry * previous = 0;
+    for (uwlkv_key visited = 0; visited < map->used_entries; visited++)
+    {
+        const uwlkv_entry * next = 0;
+        for (uwlkv_key i = 0; i < map->used_entries; i++)
+        {
+            const uwlkv_entry * entry = &map->entries[i];
+            if (    ((0 == previous) || (entry->offset > previous->offset))
+                &&  ((0 == next)     || (entry->offset < next->offset)) )
+            {
+                next = entry;
+            }
+        }
+        previous = next;
+
+        if ((next->offset < chunk_start) || ((next->offset + UWLKV_ENTRY_SIZE) > chunk_end))
+        {
+            uwlkv_offset count = (last_offset - next->offset) / UWLKV_ENTRY_SIZE + 1;
+            if (count > UWLKV_SCAN_ENTRIES)
+            {
+                count = UWLKV_SCAN_ENTRIES;
+            }
+
+            const uwlkv_error ret = uwlkv_read_entries(store, next->offset, blocks, count);
+            if (UWLKV_E_SUCCESS != ret)
+            {
+                return ret;
+            }
+
+            chunk_start = next->offset;
+            chunk_end   = next->offset + count * (uwlkv_offset)UWLKV_ENTRY_SIZE;
+        }
+
+        uwlkv_key   key;
+        uwlkv_value value;
+        if (UWLKV_E_SUCCESS != uwlkv_decode_entry(&blocks[next->offset - chunk_start], &key, &value))
+        {
+            continue;
+        }
+
+        if (callback(key, value, context))
+        {
+            break;
+        }
+    }
+
+    return UWLKV_E_SUCCESS;
+}
+
 /** @brief	Resets map state to default (not containing any entry) */
-void uwlkv_reset_map(void)
+void uwlkv_reset_map(uwlkv_store * store)
 {
-    used_entries = 0;
+    store->map.used_entries = 0;
+#ifdef UWLKV_KEYS
+    for (uwlkv_key i = 0; i < UWLKV_MAX_ENTRIES; i++)
+    {
+        store->map.positions[i] = 0;
+    }
+#endif
 }
 
+#ifdef UWLKV_HOT_COLD
+/** @brief	Starts counting updates of all entries from zero, e.g. after a wrap-around. */
+void uwlkv_reset_updates(uwlkv_store * store)
+{
+    for (uwlkv_key i = 0; i < store->map.used_entries; i++)
+    {
+        store->map.entries[i].updates = 0;
+    }
+}
+#endif
+
 /**
  * @brief	Returns a number of stored unique keys.
  *
  * @returns	Number of entries.
  */
-uwlkv_key uwlkv_get_used_entries(void)
+uwlkv_key uwlkv_get_used_entries(uwlkv_store * store)
 {
-    return used_entries;
+    return store->map.used_entries;
 }
 
 /**
@@ -115,7 +321,9 @@ uwlkv_key uwlkv_get_used_entries(void)
  *
  * @returns	Number of entries.
  */
-uwlkv_key uwlkv_map_free_entries(void)
+uwlkv_key uwlkv_map_free_entries(uwlkv_store * store)
 {
-    return UWLKV_MAX_ENTRIES - used_entries;
+    return UWLKV_MAX_ENTRIES - store->map.used_entries;
 }
+
+#endif
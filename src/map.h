@@ -1,12 +1,20 @@
 #ifndef UWLKV_MAP_H
 #define UWLKV_MAP_H
 
-uwlkv_error uwlkv_get_entry(const uwlkv_key key, uwlkv_entry ** entry);
-uwlkv_entry * uwlkv_get_entry_by_id(const uwlkv_key number);
-uwlkv_entry * uwlkv_create_entry(void);
-uwlkv_error uwlkv_update_entry(const uwlkv_key key, const uwlkv_offset offset);
-void uwlkv_reset_map(void);
-uwlkv_key uwlkv_get_used_entries(void);
-uwlkv_key uwlkv_map_free_entries(void);
+uwlkv_error uwlkv_get_entry(uwlkv_store * store, const uwlkv_key key, uwlkv_entry ** entry);
+uwlkv_entry * uwlkv_get_entry_by_id(uwlkv_store * store, const uwlkv_key number);
+uwlkv_entry * uwlkv_create_entry(uwlkv_store * store);
+uwlkv_error uwlkv_update_entry(uwlkv_store * store, const uwlkv_key key, const uwlkv_offset offset);
+void uwlkv_remove_entry(uwlkv_store * store, const uwlkv_key key, const uwlkv_offset offset);
+void uwlkv_reset_map(uwlkv_store * store);
+#ifdef UWLKV_HOT_COLD
+void uwlkv_reset_updates(uwlkv_store * store);
+#endif
+uwlkv_error uwlkv_map_foreach(uwlkv_store * store, uwlkv_foreach_callback callback, void * context);
+uwlkv_key uwlkv_get_used_entries(uwlkv_store * store);
+uwlkv_key uwlkv_map_free_entries(uwlkv_store * store);
+#ifdef UWLKV_KEYS
+uwlkv_key uwlkv_key_slot(const uwlkv_key key);
+#endif
 
 #endif
@@ -0,0 +1,604 @@
+/* This module is a drop-in replacement of map.c for parts which can't spare RAM for
+ * uwlkv_entries. It is enabled by UWLKV_RAMLESS and keeps only a few offsets in RAM, main area
+ * itself serves as an index. These few offsets are a part of uwlkv_store, so each store has its own.
+ * Wrap-around writes live entries sorted by key, so the beginning of main area is a sorted
+ * prefix, which is binary searched. Entries appended after that prefix (a tail) are scanned
+ * backwards, newest first. A tiny tail index (UWLKV_TAIL_INDEX_SIZE entries) remembers the most
+ * recently written keys to skip that scan for frequently updated values.
+ * The prefix is not stored anywhere: it's the longest run of strictly increasing keys from the
+ * start of main area. Every key is unique within such run and its newer versions, if any, may
+ * only be located in the tail, which is always checked first.
+ * Tombstones are never a part of the prefix: wrap-around drops deleted keys.
+ */
+
+#include "uwlkv.h"
+#include "map.h"
+#include "entry.h"
+#include "stats.h"
+
+#ifdef UWLKV_RAMLESS
+
+#define UWLKV_LOG_START             (UWLKV_METADATA_SIZE)
+
+/**
+ * @brief	Looks the key up in tail index.
+ *
+ * @param 	key	The key.
+ *
+ * @returns	Null if key is not remembered, else a pointer to tail index slot.
+ */
+static uwlkv_entry * find_in_tail_index(uwlkv_map * map, const uwlkv_key key)
+{
+    for (uwlkv_key i = 0; i < map->tail_index_used; i++)
+    {
+        if (key == map->tail_index[i].key)
+        {
+            return &map->tail_index[i];
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief	Remembers an offset of the newest entry with provided key, forgetting the oldest
+ * 			remembered key if index is full.
+ */
+static void add_to_tail_index(uwlkv_map * map, const uwlkv_key key, const uwlkv_offset offset)
+{
+    uwlkv_entry * slot = find_in_tail_index(map, key);
+    if (0 == slot)
+    {
+        slot = &map->tail_index[map->tail_index_next];
+        map->tail_index_next = (uwlkv_key)((map->tail_index_next + 1) % UWLKV_TAIL_INDEX_SIZE);
+        if (map->tail_index_used < UWLKV_TAIL_INDEX_SIZE)
+        {
+            map->tail_index_used += 1;
+        }
+    }
+
+    slot->key    = key;
+    slot->offset = offset;
+}
+
+/**
+ * @brief	Forgets the key, so lookups don't return a deleted entry.
+ *
+ * @param 	key	The key.
+ */
+static void remove_from_tail_index(uwlkv_map * map, const uwlkv_key key)
+{
+    uwlkv_entry * slot = find_in_tail_index(map, key);
+    if (0 != slot)
+    {
+        map->tail_index_used -= 1;
+        *slot = map->tail_index[map->tail_index_used];
+        map->tail_index_next = map->tail_index_used;
+    }
+}
+
+/**
+ * @brief	Scans the tail from the newest entry to the oldest one.
+ *
+ * @param [in] 	store  	The store.
+ * @param 	   	key    	The key.
+ * @param [out]	offset 	Offset of the newest entry with provided key or of its tombstone.
+ * @param [out]	deleted	Set to 1 if the key was deleted.
+ *
+ * @returns	UWLKV_E_SUCCESS if found in tail.
+ */
+static uwlkv_error find_in_tail(uwlkv_store * store, const uwlkv_key key, uwlkv_offset * offset,
+                                uint8_t * deleted)
+{
+    const uwlkv_map * map = &store->map;
+    uint8_t blocks[UWLKV_SCAN_ENTRIES * UWLKV_ENTRY_SIZE];
+    uwlkv_offset end = map->log_end;
+
+    while (end > map->sorted_end)
+    {
+        uwlkv_offset count = (end - map->sorted_end) / UWLKV_ENTRY_SIZE;
+        if (count > UWLKV_SCAN_ENTRIES)
+        {
+            count = UWLKV_SCAN_ENTRIES;
+        }
+
+        const uwlkv_offset start = end - count * (uwlkv_offset)UWLKV_ENTRY_SIZE;
+        if (uwlkv_read_entries(store, start, blocks, count))
+        {
+            return UWLKV_E_NVRAM_ERROR;
+        }
+
+        for (uwlkv_offset i = count; i > 0; i--)
+        {
+            uwlkv_key   stored_key;
+            uwlkv_value value;
+            const uint8_t * block = &blocks[(i - 1) * UWLKV_ENTRY_SIZE];
+            UWLKV_STAT_ADD(lookup_probes, 1);
+            if (UWLKV_E_SUCCESS != uwlkv_decode_entry(block, &stored_key, &value))
+            {
+                continue;
+            }
+
+            *deleted = (UWLKV_TOMBSTONE_KEY == stored_key) && (key == (uwlkv_key)value);
+            if ((key == stored_key) || *deleted)
+            {
+                *offset = start + (i - 1) * (uwlkv_offset)UWLKV_ENTRY_SIZE;
+                return UWLKV_E_SUCCESS;
+            }
+        }
+
+        end = start;
+    }
+
+    return UWLKV_E_NOT_EXIST;
+}
+
+#ifdef UWLKV_CRC
+/**
+ * @brief	Linear search in sorted prefix, for the case when binary search hits a damaged entry
+ * 			and can't tell which half to search.
+ *
+ * @param [in] 	store 	The store.
+ * @param 	   	key   	The key.
+ * @param [out]	offset	Offset of an entry with provided key.
+ *
+ * @returns	UWLKV_E_SUCCESS if found in prefix.
+ */
+static uwlkv_error scan_prefix(uwlkv_store * store, const uwlkv_key key, uwlkv_offset * offset)
+{
+    for (uwlkv_offset start = UWLKV_LOG_START; start < store->map.sorted_end; start += UWLKV_ENTRY_SIZE)
+    {
+        uwlkv_key   stored_key;
+        uwlkv_value value;
+        UWLKV_STAT_ADD(lookup_probes, 1);
+        if (   (UWLKV_E_SUCCESS == uwlkv_read_entry(store, start, &stored_key, &value))
+            && (key == stored_key) )
+        {
+            *offset = start;
+            return UWLKV_E_SUCCESS;
+        }
+    }
+
+    return UWLKV_E_NOT_EXIST;
+}
+#endif
+
+/**
+ * @brief	Binary search in sorted prefix.
+ *
+ * @param [in] 	store 	The store.
+ * @param 	   	key   	The key.
+ * @param [out]	offset	Offset of an entry with provided key.
+ *
+ * @returns	UWLKV_E_SUCCESS if found in prefix.
+ */
+static uwlkv_error find_in_prefix(uwlkv_store * store, const uwlkv_key key, uwlkv_offset * offset)
+{
+    uwlkv_offset low  = 0;
+    uwlkv_offset high = (store->map.sorted_end - UWLKV_LOG_START) / UWLKV_ENTRY_SIZE;
+
+    while (low < high)
+    {
+        const uwlkv_offset middle = low + (high - low) / 2;
+        const uwlkv_offset middle_offset = UWLKV_LOG_START + middle * (uwlkv_offset)UWLKV_ENTRY_SIZE;
+        uwlkv_key   stored_key;
+        uwlkv_value value;
+        UWLKV_STAT_ADD(lookup_probes, 1);
+        const uwlkv_error ret = uwlkv_read_entry(store, middle_offset, &stored_key, &value);
+#ifdef UWLKV_CRC
+        if (UWLKV_E_CORRUPTED == ret)
+        {
+            return scan_prefix(store, key, offset);
+        }
+#endif
+        if (UWLKV_E_SUCCESS != ret)
+        {
+            return ret;
+        }
+
+        if (key == stored_key)
+        {
+            *offset = middle_offset;
+            return UWLKV_E_SUCCESS;
+        }
+
+        if (key < stored_key)
+        {
+            high = middle;
+        }
+        else
+        {
+            low = middle + 1;
+        }
+    }
+
+    return UWLKV_E_NOT_EXIST;
+}
+
+/**
+ * @brief	Finds the newest entry with provided key in main area.
+ *
+ * @param [in] 	store 	The store.
+ * @param 	   	key   	The key.
+ * @param [out]	offset	Offset of the newest entry.
+ *
+ * @returns	- UWLKV_E_SUCCESS or
+ * 			- UWLKV_E_NOT_EXIST if entry with this key is not found.
+ */
+static uwlkv_error lookup(uwlkv_store * store, const uwlkv_key key, uwlkv_offset * offset)
+{
+    const uwlkv_entry * remembered = find_in_tail_index(&store->map, key);
+    if (0 != remembered)
+    {
+        *offset = remembered->offset;
+        return UWLKV_E_SUCCESS;
+    }
+
+    uint8_t deleted;
+    const uwlkv_error ret = find_in_tail(store, key, offset, &deleted);
+    if ((UWLKV_E_SUCCESS == ret) && deleted)
+    {
+        return UWLKV_E_NOT_EXIST;
+    }
+
+    if (UWLKV_E_NOT_EXIST != ret)
+    {
+        return ret;
+    }
+
+    return find_in_prefix(store, key, offset);
+}
+
+/** @brief	Same as lookup(), counting entries examined in NVRAM as probes. */
+static uwlkv_error find_newest(uwlkv_store * store, const uwlkv_key key, uwlkv_offset * offset)
+{
+    UWLKV_STAT_ADD(lookups, 1);
+
+#ifdef UWLKV_STATS
+    const uint32_t probes = uwlkv_statistics.lookup_probes;
+    const uwlkv_error ret = lookup(store, key, offset);
+    UWLKV_STAT_MAX(max_lookup_probes, uwlkv_statistics.lookup_probes - probes);
+
+    return ret;
+#else
+    return lookup(store, key, offset);
+#endif
+}
+
+/**
+ * @brief	Finds the smallest key, which is greater than provided one, with a single pass over
+ * 			main area. The key may turn out to be deleted.
+ *
+ * @param [in] 	store	The store.
+ * @param 	   	any  	Non-zero to find the smallest key at all, ignoring after.
+ * @param 	   	after	Lower bound (exclusive) of the key.
+ * @param [out]	next 	Found key and offset of its newest entry.
+ * @param [out]	alive	Set to 0 if the key was deleted after its newest entry.
+ *
+ * @returns	- UWLKV_E_SUCCESS or
+ * 			- UWLKV_E_NOT_EXIST if there are no more keys.
+ */
+static uwlkv_error scan_next_key(uwlkv_store * store, const uint8_t any, const uwlkv_key after,
+                                 uwlkv_entry * next, uint8_t * alive)
+{
+    const uwlkv_map * map = &store->map;
+    uint8_t blocks[UWLKV_SCAN_ENTRIES * UWLKV_ENTRY_SIZE];
+    uint8_t found = 0;
+
+    for (uwlkv_offset start = UWLKV_LOG_START; start < map->log_end; )
+    {
+        uwlkv_offset count = (map->log_end - start) / UWLKV_ENTRY_SIZE;
+        if (count > UWLKV_SCAN_ENTRIES)
+        {
+            count = UWLKV_SCAN_ENTRIES;
+        }
+
+        if (uwlkv_read_entries(store, start, blocks, count))
+        {
+            return UWLKV_E_NVRAM_ERROR;
+        }
+
+        for (uwlkv_offset i = 0; i < count; i++)
+        {
+            uwlkv_key   key;
+            uwlkv_value value;
+            const uwlkv_offset offset = start + i * (uwlkv_offset)UWLKV_ENTRY_SIZE;
+            if (UWLKV_E_SUCCESS != uwlkv_decode_entry(&blocks[i * UWLKV_ENTRY_SIZE], &key, &value))
+            {
+                continue;
+            }
+
+            if (UWLKV_TOMBSTONE_KEY == key)
+            {
+                if (found && (next->key == (uwlkv_key)value))
+                {
+                    *alive = 0;
+                }
+                continue;
+            }
+
+            if ((!any && (key <= after)) || (found && (key > next->key)))
+            {
+                continue;
+            }
+
+            found        = 1;
+            *alive       = 1;
+            next->key    = key;
+            next->offset = offset;
+        }
+
+        start += count * (uwlkv_offset)UWLKV_ENTRY_SIZE;
+    }
+
+    return found ? UWLKV_E_SUCCESS : UWLKV_E_NOT_EXIST;
+}
+
+/**
+ * @brief	Finds the smallest live key, which is greater than provided one. Each deleted key on
+ * 			the way costs one more pass over main area.
+ *
+ * @param [in] 	store	The store.
+ * @param 	   	any  	Non-zero to find the smallest key at all, ignoring after.
+ * @param 	   	after	Lower bound (exclusive) of the key.
+ * @param [out]	next 	Found key and offset of its newest entry.
+ *
+ * @returns	- UWLKV_E_SUCCESS or
+ * 			- UWLKV_E_NOT_EXIST if there are no more keys.
+ */
+static uwlkv_error find_next_key(uwlkv_store * store, const uint8_t any, const uwlkv_key after,
+                                 uwlkv_entry * next)
+{
+    uint8_t alive = 0;
+    uwlkv_error ret = scan_next_key(store, any, after, next, &alive);
+
+    while ((UWLKV_E_SUCCESS == ret) && !alive)
+    {
+        ret = scan_next_key(store, 0, next->key, next, &alive);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief	Returns a pointer to an entry with provided key.
+ *
+ * @param [in] 	store	The store.
+ * @param 	   	key  	The key.
+ * @param [out]	entry	On success would be pointing to a copy of found entry in the store. It
+ * 						is valid until the next call.
+ *
+ * @returns	- UWLKV_E_SUCCESS or
+ * 			- UWLKV_E_NOT_EXIST if entry with this key is not found.
+ */
+uwlkv_error uwlkv_get_entry(uwlkv_store * store, const uwlkv_key key, uwlkv_entry ** entry)
+{
+    uwlkv_map * map = &store->map;
+    uwlkv_offset offset;
+    const uwlkv_error ret = find_newest(store, key, &offset);
+    if (UWLKV_E_SUCCESS != ret)
+    {
+        return UWLKV_E_NOT_EXIST;
+    }
+
+    map->found_entry.key    = key;
+    map->found_entry.offset = offset;
+    *entry = &map->found_entry;
+
+    return UWLKV_E_SUCCESS;
+}
+
+/**
+ * @brief	Returns a pointer to an entry by its position in key order. Each call performs a full
+ * 			scan of main area, so entries should be enumerated sequentially starting from 0.
+ *
+ * @param 	store 	The store.
+ * @param 	number	Entry number
+ *
+ * @returns	Null if it fails, else a pointer to an uwlkv_entry in the store, valid until the next
+ * 			call.
+ */
+uwlkv_entry * uwlkv_get_entry_by_id(uwlkv_store * store, const uwlkv_key number)
+{
+    uwlkv_map * map = &store->map;
+    if (number >= UWLKV_MAX_ENTRIES)
+    {
+        return 0;
+    }
+
+    if (!map->cursor_valid || (number < map->cursor_number))
+    {
+        if (find_next_key(store, 1, 0, &map->cursor))
+        {
+            return 0;
+        }
+
+        map->cursor_valid  = 1;
+        map->cursor_number = 0;
+    }
+
+    while (map->cursor_number < number)
+    {
+        if (find_next_key(store, 0, map->cursor.key, &map->cursor))
+        {
+            map->cursor_valid = 0;
+            return 0;
+        }
+
+        map->cursor_number += 1;
+    }
+
+    return &map->cursor;
+}
+
+/**
+ * @brief	Counts one more unique key. There is no storage to reserve in this mode.
+ *
+ * @param 	store	The store.
+ *
+ * @returns	Pointer to an uwlkv_entry in the store.
+ */
+uwlkv_entry * uwlkv_create_entry(uwlkv_store * store)
+{
+    store->map.used_entries += 1;
+
+    return &store->map.found_entry;
+}
+
+/**
+ * @brief	Indexes an entry which was just written to main area. Entries must be indexed in the
+ * 			order of their offsets.
+ *
+ * @param 	store 	The store.
+ * @param 	key   	Key of written entry.
+ * @param 	offset	Logical offset of an entry in bytes.
+ *
+ * @returns	An uwlkv_error.
+ */
+uwlkv_error uwlkv_update_entry(uwlkv_store * store, const uwlkv_key key, const uwlkv_offset offset)
+{
+    uwlkv_map * map = &store->map;
+    if (UWLKV_TOMBSTONE_KEY == key)
+    {
+        return UWLKV_E_RESERVED_KEY;
+    }
+
+    const uint8_t extends_prefix = (offset == map->sorted_end)
+                                && ((UWLKV_LOG_START == map->sorted_end) || (key > map->last_sorted_key));
+    uwlkv_offset previous;
+
+    if (map->used_entries_known && (extends_prefix || find_newest(store, key, &previous)))
+    {
+        if (0 == uwlkv_map_free_entries(store))
+        {
+            return UWLKV_E_NO_SPACE;
+        }
+
+        uwlkv_create_entry(store);
+    }
+
+    if (extends_prefix)
+    {
+        map->sorted_end     += UWLKV_ENTRY_SIZE;
+        map->last_sorted_key = key;
+    }
+    else
+    {
+        add_to_tail_index(map, key, offset);
+    }
+
+    map->log_end      = offset + (uwlkv_offset)UWLKV_ENTRY_SIZE;
+    map->cursor_valid = 0;
+
+    return UWLKV_E_SUCCESS;
+}
+
+/**
+ * @brief	Indexes a tombstone which was just written to main area.
+ *
+ * @param 	store 	The store.
+ * @param 	key   	Deleted key.
+ * @param 	offset	Logical offset of a tombstone entry.
+ */
+void uwlkv_remove_entry(uwlkv_store * store, const uwlkv_key key, const uwlkv_offset offset)
+{
+    uwlkv_map * map = &store->map;
+    uwlkv_offset previous;
+    if (map->used_entries_known && (UWLKV_E_SUCCESS == find_newest(store, key, &previous)))
+    {
+        map->used_entries -= 1;
+    }
+
+    remove_from_tail_index(map, key);
+    map->log_end      = offset + (uwlkv_offset)UWLKV_ENTRY_SIZE;
+    map->cursor_valid = 0;
+}
+
+/**
+ * @brief	Passes every stored key and its value to the callback in the order of keys. Each key
+ * 			costs a pass over main area, so prefer the RAM map if the storage is exported often.
+ *
+ * @param 	store   	The store.
+ * @param 	callback	Function to be called for each entry. Iteration stops when it returns
+ * 						non-zero. It must not modify the storage.
+ * @param 	context 	Pointer passed to callback as is.
+ *
+ * @returns	UWLKV_E_SUCCESS or an error of NVRAM read.
+ */
+uwlkv_error uwlkv_map_foreach(uwlkv_store * store, uwlkv_foreach_callback callback, void * context)
+{
+    uwlkv_entry next;
+    uwlkv_error ret = find_next_key(store, 1, 0, &next);
+
+    while (UWLKV_E_SUCCESS == ret)
+    {
+        uwlkv_key   key;
+        uwlkv_value value;
+        ret = uwlkv_read_entry(store, next.offset, &key, &value);
+        if (UWLKV_E_SUCCESS != ret)
+        {
+            return ret;
+        }
+
+        if (callback(key, value, context))
+        {
+            break;
+        }
+
+        ret = find_next_key(store, 0, next.key, &next);
+    }
+
+    return (UWLKV_E_NOT_EXIST == ret) ? UWLKV_E_SUCCESS : ret;
+}
+
+/** @brief	Resets map state to default (not containing any entry) */
+void uwlkv_reset_map(uwlkv_store * store)
+{
+    uwlkv_map * map = &store->map;
+    map->sorted_end         = UWLKV_LOG_START;
+    map->log_end            = UWLKV_LOG_START;
+    map->used_entries       = 0;
+    map->used_entries_known = 0;
+    map->cursor_valid       = 0;
+    map->tail_index_used    = 0;
+    map->tail_index_next    = 0;
+}
+
+/**
+ * @brief	Returns a number of stored unique keys. First call after reset scans main area once
+ * 			per each key.
+ *
+ * @returns	Number of entries.
+ */
+uwlkv_key uwlkv_get_used_entries(uwlkv_store * store)
+{
+    uwlkv_map * map = &store->map;
+    if (!map->used_entries_known)
+    {
+        uwlkv_entry next;
+        uwlkv_error ret = find_next_key(store, 1, 0, &next);
+
+        map->used_entries = 0;
+        while (UWLKV_E_SUCCESS == ret)
+        {
+            map->used_entries += 1;
+            ret = find_next_key(store, 0, next.key, &next);
+        }
+
+        map->used_entries_known = 1;
+    }
+
+    return map->used_entries;
+}
+
+/**
+ * @brief	Returns a number of available unique keys.
+ *
+ * @returns	Number of entries.
+ */
+uwlkv_key uwlkv_map_free_entries(uwlkv_store * store)
+{
+    return UWLKV_MAX_ENTRIES - uwlkv_get_used_entries(store);
+}
+
+#endif
@@ -0,0 +1,231 @@
+/* This module spreads keys over several stores, e.g. one per flash chip or per flash bank, so
+ * a wrap-around of one store doesn't hold writes of keys which belong to others. Stores share
+ * no state, a shard lock only serializes calls to one store and calls to different shards may
+ * run in parallel from different tasks. Performance counters and trace are the exception: they
+ * are global, so builds with UWLKV_STATS or UWLKV_TRACE need the same lock for every shard.
+ */
+
+#include "uwlkv.h"
+
+typedef struct
+{
+    uwlkv_foreach_callback callback;
+    void *                 context;
+    uint8_t                stopped;
+} shards_foreach_context;
+
+/**
+ * @brief	Takes lock of a shard, if there is one.
+ *
+ * @param 	shards	The shards.
+ * @param 	shard 	Shard number.
+ */
+static void lock(const uwlkv_shards * shards, const uint8_t shard)
+{
+    if (shards->lock)
+    {
+        shards->lock(shard);
+    }
+}
+
+/**
+ * @brief	Releases lock of a shard, if there is one.
+ *
+ * @param 	shards	The shards.
+ * @param 	shard 	Shard number.
+ */
+static void unlock(const uwlkv_shards * shards, const uint8_t shard)
+{
+    if (shards->unlock)
+    {
+        shards->unlock(shard);
+    }
+}
+
+/**
+ * @brief	Initializes a store of each shard. If any of them fails, all shards are left not
+ * 			started, so no key is written to some shards only.
+ *
+ * @param [in,out]	shards          	Shards with stores, number and optional locks set.
+ * @param [in]    	nvram_interfaces	Array of shards->number NVRAM interfaces, one per shard.
+ * @param [out]   	failed          	Optional, set to the number of the shard which failed
+ * 										or to shards->number if all of them are started.
+ *
+ * @returns	- Capacity in entries of the smallest shard.
+ * 			- 0 if there are no shards or a store of any shard can't be initialized, see
+ * 			uwlkv_store_init().
+ */
+uwlkv_offset uwlkv_shards_init(uwlkv_shards * shards, const uwlkv_nvram_interface * nvram_interfaces, uint8_t * failed)
+{
+    uwlkv_offset capacity = 0;
+
+    if (failed)
+    {
+        *failed = 0;
+    }
+
+    /* uwlkv_shard_of() divides by the number of shards */
+    if (0 == shards->number)
+    {
+        return 0;
+    }
+
+    for (uint8_t shard = 0; shard < shards->number; shard++)
+    {
+        const uwlkv_offset shard_capacity = uwlkv_store_init(&shards->stores[shard], &nvram_interfaces[shard]);
+        if (0 == shard_capacity)
+        {
+            for (uint8_t started = 0; started < shard; started++)
+            {
+                shards->stores[started].initialized = 0;
+            }
+
+            if (failed)
+            {
+                *failed = shard;
+            }
+            return 0;
+        }
+
+        if ((0 == capacity) || (shard_capacity < capacity))
+        {
+            capacity = shard_capacity;
+        }
+    }
+
+    if (failed)
+    {
+        *failed = shards->number;
+    }
+    return capacity;
+}
+
+/**
+ * @brief	Finds the shard of a key. Multiplicative hash spreads sequential keys evenly.
+ *
+ * @param 	shards	The shards.
+ * @param 	key   	The key.
+ *
+ * @returns	Shard number.
+ */
+uint8_t uwlkv_shard_of(const uwlkv_shards * shards, const uwlkv_key key)
+{
+    return (uint8_t)((((uint32_t)key * 2654435761u) >> 16) % shards->number);
+}
+
+/**
+ * @brief	Returns number of unique key values in use by all shards.
+ *
+ * @param 	shards	The shards.
+ *
+ * @returns	Number of keys.
+ */
+uint32_t uwlkv_shards_get_entries_number(uwlkv_shards * shards)
+{
+    uint32_t entries = 0;
+
+    for (uint8_t shard = 0; shard < shards->number; shard++)
+    {
+        lock(shards, shard);
+        entries += uwlkv_store_get_entries_number(&shards->stores[shard]);
+        unlock(shards, shard);
+    }
+
+    return entries;
+}
+
+/**
+ * @brief	Get value of specifiend key from its shard.
+ *
+ * @param 	   	shards	The shards.
+ * @param 	   	key   	The key.
+ * @param [out]	value 	Read value if success.
+ *
+ * @returns	UWLKV_E_SUCCESS on sucesseful read.
+ */
+uwlkv_error uwlkv_shards_get_value(uwlkv_shards * shards, uwlkv_key key, uwlkv_value * value)
+{
+    const uint8_t shard = uwlkv_shard_of(shards, key);
+
+    lock(shards, shard);
+    const uwlkv_error ret = uwlkv_store_get_value(&shards->stores[shard], key, value);
+    unlock(shards, shard);
+
+    return ret;
+}
+
+/**
+ * @brief	Set value of specified key in its shard.
+ *
+ * @param 	shards	The shards.
+ * @param 	key   	The key.
+ * @param 	value 	Value to be written.
+ *
+ * @returns	UWLKV_E_SUCCESS on sucesseful write.
+ */
+uwlkv_error uwlkv_shards_set_value(uwlkv_shards * shards, uwlkv_key key, uwlkv_value value)
+{
+    const uint8_t shard = uwlkv_shard_of(shards, key);
+
+    lock(shards, shard);
+    const uwlkv_error ret = uwlkv_store_set_value(&shards->stores[shard], key, value);
+    unlock(shards, shard);
+
+    return ret;
+}
+
+/**
+ * @brief	Deletes a key from its shard.
+ *
+ * @param 	shards	The shards.
+ * @param 	key   	The key.
+ *
+ * @returns	- UWLKV_E_SUCCESS on sucesseful write or
+ * 			- UWLKV_E_NOT_EXIST if there is no such key.
+ */
+uwlkv_error uwlkv_shards_delete_value(uwlkv_shards * shards, uwlkv_key key)
+{
+    const uint8_t shard = uwlkv_shard_of(shards, key);
+
+    lock(shards, shard);
+    const uwlkv_error ret = uwlkv_store_delete_value(&shards->stores[shard], key);
+    unlock(shards, shard);
+
+    return ret;
+}
+
+/** @brief	Passes an entry to user callback and remembers if it asked to stop. */
+static int foreach_entry(uwlkv_key key, uwlkv_value value, void * context)
+{
+    shards_foreach_context * foreach = (shards_foreach_context *)context;
+
+    foreach->stopped = (0 != foreach->callback(key, value, foreach->context));
+
+    return foreach->stopped;
+}
+
+/**
+ * @brief	Calls a function for each key of each shard. Shards are visited one by one, only the
+ * 			visited one is locked.
+ *
+ * @param 	shards  	The shards.
+ * @param 	callback	Receives key, value and context. Return non-zero to stop iteration.
+ * 						Storage must not be modified from the callback.
+ * @param 	context 	User pointer passed to callback.
+ *
+ * @returns	UWLKV_E_SUCCESS if all keys were visited or iteration was stopped by callback.
+ */
+uwlkv_error uwlkv_shards_foreach(uwlkv_shards * shards, uwlkv_foreach_callback callback, void * context)
+{
+    shards_foreach_context foreach = { callback, context, 0 };
+    uwlkv_error ret = UWLKV_E_SUCCESS;
+
+    for (uint8_t shard = 0; (shard < shards->number) && (UWLKV_E_SUCCESS == ret) && !foreach.stopped; shard++)
+    {
+        lock(shards, shard);
+        ret = uwlkv_store_foreach(&shards->stores[shard], foreach_entry, &foreach);
+        unlock(shards, shard);
+    }
+
+    return ret;
+}
@@ -0,0 +1,72 @@
+/* This module collects performance counters. It is compiled only with UWLKV_STATS, otherwise
+ * all UWLKV_STAT_* macros expand to nothing. Timestamp hook is shared with trace.c.
+ * Counters are shared by all stores and updated without synchronization, so stores used from
+ * different tasks need one common lock.
+ */
+
+#include "uwlkv.h"
+#include "stats.h"
+
+#if defined(UWLKV_STATS) || defined(UWLKV_TRACE)
+
+static uwlkv_timestamp       timestamp;
+
+/**
+ * @brief	Returns current time from user-supplied hook.
+ *
+ * @returns	Timestamp or 0 if hook is not set.
+ */
+uint32_t uwlkv_timestamp_now(void)
+{
+    return (0 == timestamp) ? 0 : timestamp();
+}
+
+/**
+ * @brief	Sets a function which is used to timestamp trace events and to measure time spent in
+ * 			long operations. Units are up to user (e.g. microseconds or timer ticks).
+ *
+ * @param 	hook	Function which returns current time, or null to stop measurements.
+ */
+void uwlkv_set_timestamp_hook(uwlkv_timestamp hook)
+{
+    timestamp = hook;
+}
+
+#endif
+
+#ifdef UWLKV_STATS
+
+uwlkv_stats                  uwlkv_statistics;
+
+/**
+ * @brief	Updates a counter which holds maximum value.
+ *
+ * @param [in,out]	counter	The counter.
+ * @param 		  	value  	New observed value.
+ */
+void uwlkv_stats_max(uint32_t * counter, const uint32_t value)
+{
+    if (value > *counter)
+    {
+        *counter = value;
+    }
+}
+
+/**
+ * @brief	Copies current counter values.
+ *
+ * @param [out]	stats	Counters.
+ */
+void uwlkv_get_stats(uwlkv_stats * stats)
+{
+    *stats = uwlkv_statistics;
+}
+
+/** @brief	Sets all counters to zero. */
+void uwlkv_reset_stats(void)
+{
+    const uwlkv_stats empty = { 0 };
+    uwlkv_statistics = empty;
+}
+
+#endif
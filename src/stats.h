@@ -0,0 +1,26 @@
+#ifndef UWLKV_STATS_H
+#define UWLKV_STATS_H
+
+#if defined(UWLKV_STATS) || defined(UWLKV_TRACE)
+uint32_t uwlkv_timestamp_now(void);
+#endif
+
+#ifdef UWLKV_STATS
+
+extern uwlkv_stats uwlkv_statistics;
+
+void uwlkv_stats_max(uint32_t * counter, uint32_t value);
+
+#define UWLKV_STAT_ADD(counter, value)  (uwlkv_statistics.counter += (uint32_t)(value))
+#define UWLKV_STAT_MAX(counter, value)  uwlkv_stats_max(&uwlkv_statistics.counter, (uint32_t)(value))
+#define UWLKV_STAT_TIMESTAMP(name)      const uint32_t name = uwlkv_timestamp_now()
+
+#else
+
+#define UWLKV_STAT_ADD(counter, value)  ((void)0)
+#define UWLKV_STAT_MAX(counter, value)  ((void)0)
+#define UWLKV_STAT_TIMESTAMP(name)      ((void)0)
+
+#endif
+
+#endif
@@ -1,72 +1,197 @@
 /* This module handles a state of two areas of NVRAM: main and reserved. Main is used for normal
  * operations and reserved is used as a defragmented copy of main when wrap-around is performed
  * to have an ability to restore data in case of power loss.
+ * With UWLKV_HOT_COLD there is a third, cold area between them. Entries which were not updated
+ * between two wrap-arounds are appended there and stay in place on the following wrap-arounds,
+ * so only hot entries are copied through reserved area. Cold area is erased only when it's full,
+ * together with main area.
+ * All state lives in uwlkv_store, which is passed to every function, so stores on different
+ * NVRAM devices don't share anything.
+ * With UWLKV_LAZY_INIT clean NVRAM may be booted without building the map. Ends of areas are
+ * found by binary search, entries are indexed later in steps, and lookups check entries which
+ * are not indexed yet from the newest one, before the map.
+ * With UWLKV_MIGRATE metadata of both areas holds a layout header: sizes of the interface which
+ * wrote it. When a new firmware boots with other sizes, live entries of the old layout are
+ * copied to the new reserved area and the rest is an ordinary wrap-around of the new layout.
+ * With UWLKV_EEPROM this module is replaced by eeprom.c.
  */
 
+#include <string.h>
 #include "uwlkv.h"
 #include "entry.h"
 #include "map.h"
 #include "storage.h"
+#include "stats.h"
+#include "trace.h"
+#include "wear.h"
 
-extern uwlkv_nvram_interface nvram_interface;
-static uwlkv_offset          next_block;
+#ifndef UWLKV_EEPROM
 
-static uwlkv_nvram_state get_nvram_state(void);
-static void load_map(void);
-static void prepare_for_first_use(void);
-static void recover_after_iterrupted_main_erase(void);
-static void recover_after_interrupted_reserve_erase(void);
-static void prepare_area(uwlkv_area area);
-static void transfer_main_to_reserve(void);
-static void transfer_reserve_to_main(void);
+static uwlkv_nvram_state get_nvram_state(uwlkv_store * store);
+static void reset_map(uwlkv_store * store);
+static void load_map(uwlkv_store * store);
+static uwlkv_offset index_area(uwlkv_store * store, uwlkv_offset start, uwlkv_offset end);
+static void index_entry(uwlkv_store * store, uwlkv_key key, uwlkv_value value, uwlkv_offset offset);
+static void prepare_for_first_use(uwlkv_store * store);
+static void recover_after_iterrupted_main_erase(uwlkv_store * store);
+static void recover_after_interrupted_reserve_erase(uwlkv_store * store);
+static void prepare_area(uwlkv_store * store, uwlkv_area area);
+static void clean_reserve(uwlkv_store * store);
+static uint8_t is_range_erased(uwlkv_store * store, uwlkv_offset start, uwlkv_offset end);
+static void transfer_main_to_reserve(uwlkv_store * store, uwlkv_offset end);
+static void transfer_reserve_to_main(uwlkv_store * store, uwlkv_offset offset, uwlkv_offset from);
+static inline uwlkv_offset get_reserve_offset(uwlkv_store * store, uwlkv_offset offset);
+#ifdef UWLKV_HOT_COLD
+static uint8_t move_cold_entries(uwlkv_store * store, uwlkv_key written);
+static void restart_map_with_cold(uwlkv_store * store);
+#endif
+#ifdef UWLKV_LAZY_INIT
+static void start_index(uwlkv_store * store);
+#endif
+#ifdef UWLKV_MIGRATE
+static uwlkv_error migrate_layout(uwlkv_store * store);
+static void store_layout(uwlkv_store * store, uwlkv_offset metadata);
+static uint8_t main_layout_writable(uwlkv_store * store);
 
-/** @brief	Calculates current state of NVRAM and starts appropirate initialization procedure. */
-void uwlkv_cold_boot(void)
+#define UWLKV_LAYOUT_STORE(store, metadata)         store_layout((store), (metadata))
+#else
+#define UWLKV_LAYOUT_STORE(store, metadata)         ((void)0)
+#endif
+
+/**
+ * @brief	Returns the end of main area
+ *
+ * @returns	Offset of the first byte after main area
+ */
+static inline uwlkv_offset get_main_end(uwlkv_store * store)
+{
+#ifdef UWLKV_HOT_COLD
+    return get_reserve_offset(store, 0) - store->nvram.cold;
+#else
+    return get_reserve_offset(store, 0);
+#endif
+}
+
+/**
+ * @brief	Checks if metadata of reserved area has a flag of main area erase.
+ *
+ * @param 	reserve_metadata	Metadata of reserved area.
+ *
+ * @returns	1 if main area erase was started.
+ */
+static inline uint8_t main_erase_started(const uint8_t * reserve_metadata)
 {
-    uwlkv_reset_map();
+#ifdef UWLKV_HOT_COLD
+    return (UWLKV_NVRAM_ERASE_STARTED      == reserve_metadata[UWLKV_O_ERASE_STARTED])
+        || (UWLKV_NVRAM_FULL_ERASE_STARTED == reserve_metadata[UWLKV_O_ERASE_STARTED]);
+#else
+    return UWLKV_NVRAM_ERASE_STARTED == reserve_metadata[UWLKV_O_ERASE_STARTED];
+#endif
+}
+
+/**
+ * @brief	Calculates current state of NVRAM and starts appropirate initialization procedure.
+ *
+ * @param 	store	The store.
+ * @param 	lazy 	Non-zero to leave indexing of clean NVRAM to uwlkv_index_step().
+ *
+ * @returns	UWLKV_E_SUCCESS or UWLKV_E_LAYOUT if NVRAM was written with a layout which can't be
+ * 			migrated, it's not touched then.
+ */
+uwlkv_error uwlkv_cold_boot(uwlkv_store * store, const uint8_t lazy)
+{
+    uwlkv_reset_map(store);
+    UWLKV_WEAR_RESET(store);
+#ifdef UWLKV_LAZY_INIT
+    store->indexing = 0;
+#endif
+#ifdef UWLKV_MIGRATE
+    if (UWLKV_E_SUCCESS != migrate_layout(store))
+    {
+        return UWLKV_E_LAYOUT;
+    }
+#endif
+
+    const uwlkv_nvram_state nvram_state = get_nvram_state(store);
+    UWLKV_STAT_ADD(boots[nvram_state], 1);
 
-    const uwlkv_nvram_state nvram_state = get_nvram_state();
     switch (nvram_state)
     {
     case UWLKV_S_CLEAN:
-        load_map();
+        UWLKV_WEAR_LOAD(store, 0);
+        UWLKV_WEAR_LOAD(store, get_reserve_offset(store, 0));
+#ifdef UWLKV_LAZY_INIT
+        if (lazy)
+        {
+            start_index(store);
+            break;
+        }
+#else
+        (void)lazy;
+#endif
+        load_map(store);
         break;
 
     case UWLKV_S_BLANK:
-        prepare_for_first_use();
+        prepare_for_first_use(store);
         break;
     
     case UWLKV_S_MAIN_ERASE_INTERRUPTED:
-        recover_after_iterrupted_main_erase();
+        UWLKV_WEAR_LOAD(store, get_reserve_offset(store, 0));
+        recover_after_iterrupted_main_erase(store);
         break;
 
     case UWLKV_S_RESERVE_ERASE_INTERRUPTED:
-        recover_after_interrupted_reserve_erase();
+        UWLKV_WEAR_LOAD(store, 0);
+        recover_after_interrupted_reserve_erase(store);
         break;
 
     default:
-        prepare_for_first_use();
+        prepare_for_first_use(store);
         break;
     }
+
+    return UWLKV_E_SUCCESS;
+}
+
+/** @brief	Resets map state. Cold area survives wrap-arounds, so it is indexed right away. */
+static void reset_map(uwlkv_store * store)
+{
+    uwlkv_reset_map(store);
+#ifdef UWLKV_HOT_COLD
+    store->next_cold_block = index_area(store, get_main_end(store), get_reserve_offset(store, 0));
+    uwlkv_reset_updates(store);
+#endif
+}
+
+/** @brief	Indexes content of main area (and cold one, which goes first) to uwlkv_entries. */
+static void load_map(uwlkv_store * store)
+{
+    reset_map(store);
+    store->next_block = index_area(store, UWLKV_METADATA_SIZE, get_main_end(store));
 }
 
 /**
- * @brief	Scans a main area and indexes its content to uwlkv_entries. It uses linear search
- * 			and stops on a first free memory block. Block considered free if all of its bytes are
+ * @brief	Scans an area and indexes its content to uwlkv_entries. It uses linear search and
+ * 			stops on a first free memory block. Block considered free if all of its bytes are
  * 			equal to UWLKV_ERASED_BYTE_VALUE.
+ *
+ * @param 	store	The store.
+ * @param 	start	Offset of the first entry.
+ * @param 	end  	End of the area.
+ *
+ * @returns	Offset of the first free block.
  */
-static void load_map(void)
+static uwlkv_offset index_area(uwlkv_store * store, const uwlkv_offset start, const uwlkv_offset end)
 {
-    uwlkv_reset_map();
-
     uwlkv_offset offset;
-    for (offset =  UWLKV_METADATA_SIZE; 
-        (offset +  UWLKV_ENTRY_SIZE) <= (nvram_interface.size - nvram_interface.reserved); 
+    for (offset =  start; 
+        (offset +  UWLKV_ENTRY_SIZE) <= end; 
          offset += UWLKV_ENTRY_SIZE)
     {
         uwlkv_key key;
         uwlkv_value value;
-        uwlkv_error ret = uwlkv_read_entry(offset, &key, &value);
+        uwlkv_error ret = uwlkv_read_entry(store, offset, &key, &value);
 
         if (UWLKV_E_NOT_EXIST == ret)
         {
@@ -75,60 +200,269 @@ static void load_map(void)
 
         if (UWLKV_E_SUCCESS == ret)
         {
-            uwlkv_update_entry(key, offset);
+            index_entry(store, key, value, offset);
         }
     }
-    next_block = offset;
+
+    return offset;
 }
 
-static void prepare_for_first_use(void)
+/**
+ * @brief	Adds an entry read from main area to the map. Tombstone removes a key it refers to.
+ *
+ * @param 	store 	The store.
+ * @param 	key   	Entry key.
+ * @param 	value 	Entry value.
+ * @param 	offset	Logical offset of an entry in bytes.
+ */
+static void index_entry(uwlkv_store * store, uwlkv_key key, uwlkv_value value, uwlkv_offset offset)
 {
-    nvram_interface.erase_main();
-    nvram_interface.erase_reserve();
+    if (UWLKV_TOMBSTONE_KEY == key)
+    {
+        uwlkv_remove_entry(store, (uwlkv_key)value, offset);
+    }
+    else
+    {
+        uwlkv_update_entry(store, key, offset);
+    }
+}
 
-    uint8_t main_metadata[UWLKV_METADATA_SIZE] = { UWLKV_NVRAM_ERASE_STARTED, UWLKV_NVRAM_ERASE_FINISHED };
-    nvram_interface.write(main_metadata, 0, UWLKV_METADATA_SIZE);
+/**
+ * @brief	Finds the first free block of an area by binary search. Entries are appended one after
+ * 			another, so all blocks after the first free one are free as well.
+ *
+ * @param 	store	The store.
+ * @param 	start	Offset of the first entry.
+ * @param 	end  	End of the area.
+ *
+ * @returns	Offset of the first free block.
+ */
+static uwlkv_offset find_area_end(uwlkv_store * store, const uwlkv_offset start, const uwlkv_offset end)
+{
+    uwlkv_offset low  = 0;
+    uwlkv_offset high = (end - start) / UWLKV_ENTRY_SIZE;
 
-    next_block = UWLKV_METADATA_SIZE;
+    while (low < high)
+    {
+        const uwlkv_offset middle = low + (high - low) / 2;
+        uwlkv_key   key;
+        uwlkv_value value;
+        if (UWLKV_E_NOT_EXIST == uwlkv_read_entry(store, start + middle * (uwlkv_offset)UWLKV_ENTRY_SIZE, &key, &value))
+        {
+            high = middle;
+        }
+        else
+        {
+            low = middle + 1;
+        }
+    }
+
+    return start + low * (uwlkv_offset)UWLKV_ENTRY_SIZE;
 }
 
-static void recover_after_iterrupted_main_erase(void)
+static void prepare_for_first_use(uwlkv_store * store)
 {
-    nvram_interface.erase_main();
-    transfer_reserve_to_main();
-    prepare_area(UWLKV_RESERVED);
+    uwlkv_nvram_erase(store, UWLKV_MAIN);
+#ifdef UWLKV_HOT_COLD
+    uwlkv_nvram_erase(store, UWLKV_COLD);
+    store->next_cold_block = get_main_end(store);
+#endif
+    uwlkv_nvram_erase(store, UWLKV_RESERVED);
+
+    UWLKV_LAYOUT_STORE(store, 0);
+    uint8_t main_metadata[UWLKV_O_ERASE_COUNTERS] = { UWLKV_NVRAM_ERASE_STARTED, UWLKV_NVRAM_ERASE_FINISHED };
+    uwlkv_nvram_write(store, main_metadata, 0, UWLKV_O_ERASE_COUNTERS);
+    UWLKV_WEAR_STORE(store, 0, 0);
+
+    store->next_block = UWLKV_METADATA_SIZE;
 }
 
-static void recover_after_interrupted_reserve_erase(void)
+/**
+ * @brief	Finds how far the copy from reserved area to erased main area got before power loss.
+ * 			Copied blocks are compared with reserved area one by one. With UWLKV_CRC a block torn
+ * 			by a power loss is detected, it stays in place and the copy goes on after it.
+ *
+ * @param 	   	store       	The store.
+ * @param [out]	reserve_next	Offset in reserved area of the first entry which isn't copied yet.
+ *
+ * @returns	Offset in main area to continue the copy from or 0 if main area has to be erased again.
+ */
+static uwlkv_offset find_copied_end(uwlkv_store * store, uwlkv_offset * reserve_next)
 {
-    nvram_interface.erase_reserve();
-    load_map();
+    const uwlkv_offset end         = find_area_end(store, UWLKV_METADATA_SIZE, get_main_end(store));
+    const uwlkv_offset reserve_end = find_area_end(store, get_reserve_offset(store, UWLKV_METADATA_SIZE),
+                                                   store->nvram.size) - get_reserve_offset(store, 0);
+    uwlkv_offset original = UWLKV_METADATA_SIZE;
+
+#ifdef UWLKV_MIGRATE
+    if (!main_layout_writable(store))
+    {
+        return 0;
+    }
+#endif
+    /* Counters go to main metadata right before its flag, a torn write can't be repeated */
+    if (!UWLKV_WEAR_WRITABLE(store, 0, UWLKV_WEAR_PENDING(UWLKV_RESERVED)))
+    {
+        return 0;
+    }
+
+    for (uwlkv_offset offset = UWLKV_METADATA_SIZE; offset < end; offset += UWLKV_ENTRY_SIZE)
+    {
+        uint8_t copied[UWLKV_ENTRY_SIZE];
+        uint8_t source[UWLKV_ENTRY_SIZE];
+        if (uwlkv_nvram_read(store, copied, offset, UWLKV_ENTRY_SIZE))
+        {
+            return 0;
+        }
+
+        if (   (original < reserve_end)
+            && (0 == uwlkv_nvram_read(store, source, get_reserve_offset(store, original), UWLKV_ENTRY_SIZE))
+            && (0 == memcmp(copied, source, UWLKV_ENTRY_SIZE)) )
+        {
+            original += UWLKV_ENTRY_SIZE;
+            continue;
+        }
+
+#ifdef UWLKV_CRC
+        uwlkv_key   key;
+        uwlkv_value value;
+        if (UWLKV_E_CORRUPTED == uwlkv_read_entry(store, offset, &key, &value))
+        {
+            continue;
+        }
+#endif
+        /* Without a checksum a torn entry can't be told from a valid one */
+        return 0;
+    }
+
+    /* Torn blocks take space, so the rest of the copy may not fit anymore */
+    if ((reserve_end - original) > (get_main_end(store) - end))
+    {
+        return 0;
+    }
+
+    /* Erase flag is left from the first erase, so an erase by an earlier recovery may have been
+     * interrupted after its first pages. The end is found by binary search, which doesn't see it */
+    if (!is_range_erased(store, end, get_main_end(store)))
+    {
+        return 0;
+    }
+
+    *reserve_next = original;
+    return end;
+}
+
+/**
+ * @brief	Completes a wrap-around, which was interrupted after defragmented entries had been
+ * 			copied to reserved area. Steps which are known to be finished are not repeated:
+ * 			- main area is erased only if the erase wasn't finished or the copy back can't go on,
+ * 			- the copy back continues after the last copied entry,
+ * 			- if the copy back was finished, only reserved area is erased.
+ *
+ * @param 	store	The store.
+ */
+static void recover_after_iterrupted_main_erase(uwlkv_store * store)
+{
+    uint8_t main_metadata[UWLKV_O_ERASE_COUNTERS];
+    uint8_t reserve_metadata[UWLKV_O_ERASE_COUNTERS];
+    uwlkv_nvram_read(store, main_metadata,    0,                         UWLKV_O_ERASE_COUNTERS);
+    uwlkv_nvram_read(store, reserve_metadata, get_reserve_offset(store, 0), UWLKV_O_ERASE_COUNTERS);
+
+    /* Main metadata is erased together with main area and gets its flag when the copy is done */
+    const uint8_t erase_finished = UWLKV_NVRAM_ERASE_FINISHED == reserve_metadata[UWLKV_O_ERASE_FINISHED];
+    const uint8_t copy_finished  = erase_finished
+                                && (UWLKV_NVRAM_ERASE_STARTED == main_metadata[UWLKV_O_ERASE_STARTED]);
+
+    if (copy_finished)
+    {
+        UWLKV_STAT_ADD(resumed_recoveries, 1);
+        load_map(store);
+    }
+    else
+    {
+        uwlkv_offset from   = UWLKV_METADATA_SIZE;
+        uwlkv_offset copied = erase_finished ? find_copied_end(store, &from) : 0;
+        if (0 == copied)
+        {
+#ifdef UWLKV_HOT_COLD
+            if (UWLKV_NVRAM_FULL_ERASE_STARTED == reserve_metadata[UWLKV_O_ERASE_STARTED])
+            {
+                uwlkv_nvram_erase(store, UWLKV_COLD);
+            }
+#endif
+            uwlkv_nvram_erase(store, UWLKV_MAIN);
+            copied = UWLKV_METADATA_SIZE;
+            from   = UWLKV_METADATA_SIZE;
+        }
+        else
+        {
+            UWLKV_STAT_ADD(resumed_recoveries, 1);
+        }
+        transfer_reserve_to_main(store, copied, from);
+    }
+
+    prepare_area(store, UWLKV_RESERVED);
+}
+
+/**
+ * @brief	Erases reserved area again after its erase was interrupted. Counters in main metadata
+ * 			can't be written again, so counters with the repeated erase go to metadata of
+ * 			reserved area and stay there until the next wrap-around.
+ *
+ * @param 	store	The store.
+ */
+static void recover_after_interrupted_reserve_erase(uwlkv_store * store)
+{
+#ifdef UWLKV_WEAR
+    /* Reserved area without flags may keep counters of an earlier recovery. Counters written
+     * together with flags are older than the ones of main area */
+    uint8_t reserve_flags[UWLKV_O_ERASE_COUNTERS];
+    if (   (0 == uwlkv_nvram_read(store, reserve_flags, get_reserve_offset(store, 0), UWLKV_O_ERASE_COUNTERS))
+        && uwlkv_is_block_erased(reserve_flags, UWLKV_O_ERASE_COUNTERS) )
+    {
+        UWLKV_WEAR_LOAD(store, get_reserve_offset(store, 0));
+    }
+#endif
+    uwlkv_nvram_erase(store, UWLKV_RESERVED);
+    UWLKV_WEAR_STORE(store, get_reserve_offset(store, 0), 0);
+    load_map(store);
 }
 
 /**
  * @brief	Returns reserve data address with given offset
  *
+ * @param 	store 	The store.
  * @param 	offset	The offset (0 means first byte of reserved area)
  *
  * @returns	Absolute offset in NVRAM
  */
-static inline uwlkv_offset get_reserve_offset(uwlkv_offset offset)
+static inline uwlkv_offset get_reserve_offset(uwlkv_store * store, uwlkv_offset offset)
 {
-    return nvram_interface.size - nvram_interface.reserved + offset;
+    return store->nvram.size - store->nvram.reserved + offset;
 }
 
-static void transfer_reserve_to_main(void)
+/**
+ * @brief	Copies entries from reserved area to erased main area one after another.
+ *
+ * @param 	store 	The store.
+ * @param 	offset	Offset in main area to copy the first entry to. Entries before it are already
+ * 					copied and are only indexed.
+ * @param 	from  	Offset in reserved area of the first entry to be copied.
+ */
+static void transfer_reserve_to_main(uwlkv_store * store, uwlkv_offset offset, uwlkv_offset from)
 {
-    const uwlkv_offset reserve_offset = get_reserve_offset(0);
+    const uwlkv_offset reserve_offset = get_reserve_offset(store, 0);
+    reset_map(store);
+    index_area(store, UWLKV_METADATA_SIZE, offset);
 
-    uwlkv_offset offset;
-    for (offset =  UWLKV_METADATA_SIZE; 
-        (offset +  UWLKV_ENTRY_SIZE) <= (nvram_interface.reserved); 
-         offset += UWLKV_ENTRY_SIZE)
+    for (;
+        ((from   + UWLKV_ENTRY_SIZE) <= store->nvram.reserved)
+     && ((offset + UWLKV_ENTRY_SIZE) <= get_main_end(store));
+         from   += UWLKV_ENTRY_SIZE, offset += UWLKV_ENTRY_SIZE)
     {
         uwlkv_key key;
         uwlkv_value value;
-        uwlkv_error ret = uwlkv_read_entry(reserve_offset + offset, &key, &value);
+        uwlkv_error ret = uwlkv_read_entry(store, reserve_offset + from, &key, &value);
 
         if (UWLKV_E_NOT_EXIST == ret)
         {
@@ -137,24 +471,54 @@ static void transfer_reserve_to_main(void)
 
         if (UWLKV_E_SUCCESS == ret)
         {
-            uwlkv_write_entry(offset, key, value);
-            uwlkv_update_entry(key, offset);
+            uwlkv_write_entry(store, offset, key, value);
+            uwlkv_update_entry(store, key, offset);
+        }
+#ifdef UWLKV_CRC
+        else if (UWLKV_E_CORRUPTED == ret)
+        {
+            /* Copied as is, so main area has no free block before its end */
+            uint8_t block[UWLKV_ENTRY_SIZE];
+            if (0 == uwlkv_nvram_read(store, block, reserve_offset + from, UWLKV_ENTRY_SIZE))
+            {
+                uwlkv_nvram_write(store, block, offset, UWLKV_ENTRY_SIZE);
+            }
         }
+#endif
     }
     
-    next_block = offset;
+#ifdef UWLKV_HOT_COLD
+    uwlkv_reset_updates(store);
+#endif
+    store->next_block = offset;
 }
 
-static void transfer_main_to_reserve(void)
+/**
+ * @brief	Copies entries to reserved area.
+ *
+ * @param 	store	The store.
+ * @param 	end  	Only entries located before this offset are copied.
+ */
+static void transfer_main_to_reserve(uwlkv_store * store, const uwlkv_offset end)
 {
-    uwlkv_offset reserve_offset = get_reserve_offset(UWLKV_METADATA_SIZE);
-    for(uwlkv_key i = 0; i < uwlkv_get_used_entries(); i++)
+    uwlkv_offset reserve_offset = get_reserve_offset(store, UWLKV_METADATA_SIZE);
+    for(uwlkv_key i = 0; i < uwlkv_get_used_entries(store); i++)
     {
-        const uwlkv_entry * entry = uwlkv_get_entry_by_id(i);
+        const uwlkv_entry * entry = uwlkv_get_entry_by_id(store, i);
+        if ((0 == entry) || (entry->offset >= end))
+        {
+            continue;
+        }
+
+        /* Entry which can't be read is dropped instead of being copied with a valid checksum */
         uwlkv_key key;
         uwlkv_value value;
-        uwlkv_read_entry(entry->offset, &key, &value);
-        uwlkv_write_entry(reserve_offset, key, value);
+        if (UWLKV_E_SUCCESS != uwlkv_read_entry(store, entry->offset, &key, &value))
+        {
+            continue;
+        }
+
+        uwlkv_write_entry(store, reserve_offset, key, value);
         reserve_offset += UWLKV_ENTRY_SIZE;
     }
 }
@@ -164,26 +528,30 @@ static void transfer_main_to_reserve(void)
  *
  * @returns	See uwlkv_nvram_state enum documentation.
  */
-static uwlkv_nvram_state get_nvram_state(void)
+static uwlkv_nvram_state get_nvram_state(uwlkv_store * store)
 {
     uint8_t main_metadata[UWLKV_MINIMAL_SIZE];
     uint8_t reserve_metadata[UWLKV_MINIMAL_SIZE];
-    nvram_interface.read(main_metadata,    0,                     UWLKV_MINIMAL_SIZE);
-    nvram_interface.read(reserve_metadata, get_reserve_offset(0), UWLKV_MINIMAL_SIZE);
+    uwlkv_nvram_read(store, main_metadata,    0,                     UWLKV_MINIMAL_SIZE);
+    uwlkv_nvram_read(store, reserve_metadata, get_reserve_offset(store, 0), UWLKV_MINIMAL_SIZE);
 
-    const uint8_t main_started     = UWLKV_NVRAM_ERASE_STARTED  == reserve_metadata[UWLKV_O_ERASE_STARTED];
+    const uint8_t main_started     = main_erase_started(reserve_metadata);
     const uint8_t reserve_started  = UWLKV_NVRAM_ERASE_STARTED  == main_metadata[UWLKV_O_ERASE_STARTED];
     const uint8_t main_finished    = UWLKV_NVRAM_ERASE_FINISHED == reserve_metadata[UWLKV_O_ERASE_FINISHED];
     const uint8_t reserve_finished = UWLKV_NVRAM_ERASE_FINISHED == main_metadata[UWLKV_O_ERASE_FINISHED];
-    const uint8_t main_clean       = uwlkv_is_block_erased(main_metadata, UWLKV_MINIMAL_SIZE);
-    const uint8_t reserve_clean    = uwlkv_is_block_erased(reserve_metadata, UWLKV_MINIMAL_SIZE);
+    /* Clean reserved area may keep erase counters, see recover_after_interrupted_reserve_erase() */
+    const uint8_t reserve_clean    = uwlkv_is_block_erased(reserve_metadata, UWLKV_O_ERASE_COUNTERS)
+                                  && uwlkv_is_block_erased(&reserve_metadata[UWLKV_O_LAYOUT],
+                                                           UWLKV_MINIMAL_SIZE - UWLKV_O_LAYOUT);
 
     if (reserve_finished && reserve_clean)
     {
         return UWLKV_S_CLEAN;
     }
 
-    if ((main_started || main_finished) && !main_clean)
+    /* Reserve flags mean that reserved area holds the only complete copy. Main area may look
+     * clean if its erase was interrupted after the first pages or before the copy back */
+    if (main_started || main_finished)
     {
         return UWLKV_S_MAIN_ERASE_INTERRUPTED;
     }
@@ -198,54 +566,813 @@ static uwlkv_nvram_state get_nvram_state(void)
 }
 
 /**
- * @brief	Erases specified area with progress indication in metadata.
+ * @brief	Erases specified area with progress indication in metadata. Erase counters are
+ * 			written before the flag, so recovery after a power loss finds them.
  *
- * @param 	area	Area to be erased (UWLKV_MAIN or UWLKV_RESERVED)
+ * @param 	store	The store.
+ * @param 	area 	Area to be erased (UWLKV_MAIN or UWLKV_RESERVED)
  */
-static void prepare_area(uwlkv_area area)
+static void prepare_area(uwlkv_store * store, uwlkv_area area)
 {
     uint8_t operation_flag = UWLKV_NVRAM_ERASE_STARTED;
-    uwlkv_offset base_address = get_reserve_offset(0);
-    uwlkv_erase  erase_function = nvram_interface.erase_main;
+    uwlkv_offset base_address = get_reserve_offset(store, 0);
 
     if (UWLKV_RESERVED == area)
     {
         base_address   = 0;
-        erase_function = nvram_interface.erase_reserve;
     }
     
-    nvram_interface.write(&operation_flag, base_address, 1);
-    erase_function();
+    UWLKV_TRACE_BEGIN(UWLKV_OP_PREPARE_AREA, area);
+    UWLKV_LAYOUT_STORE(store, base_address);
+    UWLKV_WEAR_STORE(store, base_address, UWLKV_WEAR_PENDING(area));
+    uwlkv_nvram_write(store, &operation_flag, base_address, 1);
+    uwlkv_nvram_erase(store, area);
     operation_flag = UWLKV_NVRAM_ERASE_FINISHED;
-    nvram_interface.write(&operation_flag, base_address + 1, 1);
+    uwlkv_nvram_write(store, &operation_flag, base_address + 1, 1);
+    UWLKV_TRACE_END(UWLKV_OP_PREPARE_AREA, area);
+}
+
+/**
+ * @brief	Checks that all bytes of a range are erased.
+ *
+ * @param 	store	The store.
+ * @param 	start	The first byte.
+ * @param 	end  	End of the range.
+ *
+ * @returns	1 if the range is erased, 0 if not or it can't be read.
+ */
+static uint8_t is_range_erased(uwlkv_store * store, uwlkv_offset start, const uwlkv_offset end)
+{
+    uint8_t blocks[UWLKV_SCAN_ENTRIES * UWLKV_ENTRY_SIZE];
+
+    while (start < end)
+    {
+        uwlkv_offset size = end - start;
+        if (size > sizeof(blocks))
+        {
+            size = sizeof(blocks);
+        }
+
+        if (   uwlkv_nvram_read(store, blocks, start, size)
+            || !uwlkv_is_block_erased(blocks, size) )
+        {
+            return 0;
+        }
+        start += size;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief	Erases reserved area again if an earlier erase was interrupted half-way. Area erase
+ * 			may go sector by sector, so the first sector with metadata looks clean while later
+ * 			ones still hold entries. Its metadata may also keep erase counters, which are about
+ * 			to be written there again. Main area is complete at this point, so no flags are needed.
+ *
+ * @param 	store	The store.
+ */
+static void clean_reserve(uwlkv_store * store)
+{
+    if (!is_range_erased(store, get_reserve_offset(store, 0), store->nvram.size))
+    {
+        uwlkv_nvram_erase(store, UWLKV_RESERVED);
+    }
 }
 
 /**
  * @brief	Performs a backup of all parameters to reserved area, erases main and starts writing
- * 			from beginning. All data would be defragmented as a result.
+ * 			from beginning. All data would be defragmented as a result, deleted keys and their
+ * 			tombstones are dropped.
+ *
+ * 			Every wrap-around goes through here, so it is counted and traced the same way.
+ *
+ * @param 	store  	The store.
+ * @param 	written	Key which is written (or deleted) right after the wrap-around, it stays hot.
+ * 					UWLKV_TOMBSTONE_KEY if there is none.
+ * @param 	full   	1 if cold area must be erased as well, see restart_map_with_cold().
+ */
+static void restart_map(uwlkv_store * store, const uwlkv_key written, const uint8_t full)
+{
+    UWLKV_STAT_TIMESTAMP(started);
+    UWLKV_STAT_ADD(compactions, 1);
+    UWLKV_TRACE_BEGIN(UWLKV_OP_RESTART_MAP, store->next_block);
+    clean_reserve(store);
+
+#ifdef UWLKV_HOT_COLD
+    if (full || move_cold_entries(store, written))
+    {
+        restart_map_with_cold(store);
+    }
+    else
+#else
+    (void)written;
+    (void)full;
+#endif
+    {
+        transfer_main_to_reserve(store, get_main_end(store));
+        prepare_area(store, UWLKV_MAIN);
+        transfer_reserve_to_main(store, UWLKV_METADATA_SIZE, UWLKV_METADATA_SIZE);
+        prepare_area(store, UWLKV_RESERVED);
+    }
+
+    UWLKV_TRACE_END(UWLKV_OP_RESTART_MAP, store->next_block);
+    UWLKV_STAT_TIMESTAMP(finished);
+    UWLKV_STAT_ADD(compaction_time, finished - started);
+    UWLKV_STAT_MAX(max_compaction_time, finished - started);
+}
+
+/** @brief	Performs a wrap-around right away, see uwlkv_compact(). */
+void uwlkv_compact_storage(uwlkv_store * store)
+{
+    restart_map(store, UWLKV_TOMBSTONE_KEY, 0);
+}
+
+#ifdef UWLKV_HOT_COLD
+/**
+ * @brief	Appends entries which were updated less than UWLKV_COLD_THRESHOLD times since the
+ * 			last wrap-around to cold area. Hot entries stay in main area. Any entry may be
+ * 			interrupted, because main area still contains the same values.
+ * 			The key written right after the wrap-around is hot. A deleted key in particular must
+ * 			not be appended after its tombstone in cold area, otherwise it comes back on boot.
+ *
+ * @param 	store  	The store.
+ * @param 	written	Key which is written (or deleted) after the wrap-around.
+ *
+ * @returns	0 on success, 1 if cold area is full.
  */
-static void restart_map(void)
+static uint8_t move_cold_entries(uwlkv_store * store, const uwlkv_key written)
 {
-    transfer_main_to_reserve();
-    prepare_area(UWLKV_MAIN);
-    transfer_reserve_to_main();
-    prepare_area(UWLKV_RESERVED);
+    for (uwlkv_key i = 0; i < uwlkv_get_used_entries(store); i++)
+    {
+        uwlkv_entry * entry = uwlkv_get_entry_by_id(store, i);
+        if (   (entry->offset >= get_main_end(store))
+            || (entry->updates >= UWLKV_COLD_THRESHOLD)
+            || (entry->key == written) )
+        {
+            continue;
+        }
+
+        if ((store->next_cold_block + UWLKV_ENTRY_SIZE) > get_reserve_offset(store, 0))
+        {
+            return 1;
+        }
+
+        uwlkv_key key;
+        uwlkv_value value;
+        if (UWLKV_E_SUCCESS != uwlkv_read_entry(store, entry->offset, &key, &value))
+        {
+            continue;
+        }
+
+        if (UWLKV_E_SUCCESS == uwlkv_write_entry(store, store->next_cold_block, key, value))
+        {
+            entry->offset = store->next_cold_block;
+        }
+        store->next_cold_block += UWLKV_ENTRY_SIZE;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief	Same as restart_map(), but cold area is erased together with main area and all entries
+ * 			are copied through reserved area. They become hot until the next wrap-around.
+ * 			Called only by restart_map(), which cleans reserved area and counts the wrap-around.
+ */
+static void restart_map_with_cold(uwlkv_store * store)
+{
+    transfer_main_to_reserve(store, get_reserve_offset(store, 0));
+
+    uint8_t operation_flag = UWLKV_NVRAM_FULL_ERASE_STARTED;
+    UWLKV_LAYOUT_STORE(store, get_reserve_offset(store, 0));
+    UWLKV_WEAR_STORE(store, get_reserve_offset(store, 0), UWLKV_WEAR_PENDING(UWLKV_MAIN) | UWLKV_WEAR_PENDING(UWLKV_COLD));
+    uwlkv_nvram_write(store, &operation_flag, get_reserve_offset(store, UWLKV_O_ERASE_STARTED), 1);
+    uwlkv_nvram_erase(store, UWLKV_MAIN);
+    uwlkv_nvram_erase(store, UWLKV_COLD);
+    operation_flag = UWLKV_NVRAM_ERASE_FINISHED;
+    uwlkv_nvram_write(store, &operation_flag, get_reserve_offset(store, UWLKV_O_ERASE_FINISHED), 1);
+
+    transfer_reserve_to_main(store, UWLKV_METADATA_SIZE, UWLKV_METADATA_SIZE);
+    prepare_area(store, UWLKV_RESERVED);
+}
+
+/**
+ * @brief	Searches cold area for any entry with the key.
+ *
+ * @param 	store	The store.
+ * @param 	key  	The key.
+ *
+ * @returns	1 if found.
+ */
+static uint8_t cold_area_contains(uwlkv_store * store, const uwlkv_key key)
+{
+    uint8_t blocks[UWLKV_SCAN_ENTRIES * UWLKV_ENTRY_SIZE];
+
+    for (uwlkv_offset start = get_main_end(store); start < store->next_cold_block; )
+    {
+        uwlkv_offset count = (store->next_cold_block - start) / UWLKV_ENTRY_SIZE;
+        if (count > UWLKV_SCAN_ENTRIES)
+        {
+            count = UWLKV_SCAN_ENTRIES;
+        }
+
+        if (uwlkv_read_entries(store, start, blocks, count))
+        {
+            return 1;
+        }
+
+        for (uwlkv_offset i = 0; i < count; i++)
+        {
+            uwlkv_key stored_key;
+            uwlkv_value value;
+            if (   (UWLKV_E_SUCCESS == uwlkv_decode_entry(&blocks[i * UWLKV_ENTRY_SIZE], &stored_key, &value))
+                && (key == stored_key) )
+            {
+                return 1;
+            }
+        }
+
+        start += count * (uwlkv_offset)UWLKV_ENTRY_SIZE;
+    }
+
+    return 0;
+}
+#endif
+
+/**
+ * @brief	Makes sure that cold area would not bring deleted key back after the next wrap-around.
+ * 			Must be called before a tombstone is written to main area. Cold area gets its own
+ * 			tombstone, if there is an entry with this key. If cold area is full, it is erased.
+ *
+ * @param 	store	The store.
+ * @param 	key  	Key which is about to be deleted.
+ *
+ * @returns	UWLKV_E_SUCCESS on success.
+ */
+uwlkv_error uwlkv_forget_cold_entry(uwlkv_store * store, uwlkv_key key)
+{
+#ifdef UWLKV_HOT_COLD
+    if (!cold_area_contains(store, key))
+    {
+        return UWLKV_E_SUCCESS;
+    }
+
+    if ((store->next_cold_block + UWLKV_ENTRY_SIZE) > get_reserve_offset(store, 0))
+    {
+        restart_map(store, key, 1);
+        return UWLKV_E_SUCCESS;
+    }
+
+    const uwlkv_error write = uwlkv_write_entry(store, store->next_cold_block, UWLKV_TOMBSTONE_KEY, (uwlkv_value)key);
+    store->next_cold_block += UWLKV_ENTRY_SIZE;
+
+    return write;
+#else
+    (void)store;
+    (void)key;
+
+    return UWLKV_E_SUCCESS;
+#endif
 }
 
 /**
  * @brief	Reserves memory for one data block and returns an offset to its first byte. If all
  * 			NVRAM is used, it would be erased.
  *
- * @returns	Starting position of new block.
+ * @param 	   	store 	The store.
+ * @param 	   	key   	Key to be written or deleted. It isn't moved to cold area by a wrap-around.
+ * @param [out]	offset	Starting position of new block.
+ *
+ * @returns	UWLKV_E_SUCCESS, a block is always found.
+ */
+uwlkv_error uwlkv_get_next_block(uwlkv_store * store, uwlkv_key key, uwlkv_offset * offset)
+{
+    UWLKV_TRACE_BEGIN(UWLKV_OP_GET_NEXT_BLOCK, store->next_block);
+    if ((store->next_block + UWLKV_ENTRY_SIZE) > get_main_end(store))
+    {
+        restart_map(store, key, 0);
+    }
+
+    *offset = store->next_block;
+    store->next_block += UWLKV_ENTRY_SIZE;
+    UWLKV_WEAR_WRITTEN(store);
+    UWLKV_TRACE_END(UWLKV_OP_GET_NEXT_BLOCK, store->next_block);
+
+    return UWLKV_E_SUCCESS;
+}
+
+/**
+ * @brief	Writes an entry to a block returned by uwlkv_get_next_block().
+ *
+ * @param 	store 	The store.
+ * @param 	offset	Offset of the block.
+ * @param 	key   	Entry key.
+ * @param 	value 	Entry value.
+ *
+ * @returns	UWLKV_E_SUCCESS on successeful write.
+ */
+uwlkv_error uwlkv_write_block(uwlkv_store * store, uwlkv_offset offset, uwlkv_key key, uwlkv_value value)
+{
+    return uwlkv_write_entry(store, offset, key, value);
+}
+
+#ifdef UWLKV_LAZY_INIT
+/** @brief	Finds ends of areas, so new entries can be written, and leaves the map empty. */
+static void start_index(uwlkv_store * store)
+{
+    store->next_block = find_area_end(store, UWLKV_METADATA_SIZE, get_main_end(store));
+    store->index_next = UWLKV_METADATA_SIZE;
+#ifdef UWLKV_HOT_COLD
+    /* Cold area is older than main one, so it is indexed first, the same as on eager boot */
+    store->next_cold_block = find_area_end(store, get_main_end(store), get_reserve_offset(store, 0));
+    store->index_next      = get_main_end(store);
+#endif
+    store->indexing = 1;
+}
+
+/**
+ * @brief	Checks if indexing is in cold area.
+ *
+ * @param 	store	The store.
+ *
+ * @returns	1 if cold area is not fully indexed yet.
+ */
+static inline uint8_t indexing_cold(uwlkv_store * store)
+{
+#ifdef UWLKV_HOT_COLD
+    return store->index_next >= get_main_end(store);
+#else
+    (void)store;
+
+    return 0;
+#endif
+}
+
+/**
+ * @brief	Returns the end of the area being indexed.
+ *
+ * @param 	store	The store.
+ *
+ * @returns	Offset of its first free block.
+ */
+static uwlkv_offset get_index_end(uwlkv_store * store)
+{
+#ifdef UWLKV_HOT_COLD
+    if (indexing_cold(store))
+    {
+        return store->next_cold_block;
+    }
+#endif
+    return store->next_block;
+}
+
+/**
+ * @brief	Indexes entries which were found by start_index() and are not in map yet.
+ *
+ * @param 	store  	The store.
+ * @param 	entries	Maximum number of entries to be indexed.
+ *
+ * @returns	Number of entries which are still not indexed, 0 when map is complete.
+ */
+uwlkv_offset uwlkv_index_step(uwlkv_store * store, uwlkv_offset entries)
+{
+    while (store->indexing)
+    {
+        uwlkv_offset end   = get_index_end(store);
+        uwlkv_offset count = (end - store->index_next) / UWLKV_ENTRY_SIZE;
+        if (count > entries)
+        {
+            count = entries;
+        }
+
+        const uwlkv_offset stop = store->index_next + count * (uwlkv_offset)UWLKV_ENTRY_SIZE;
+        store->index_next = index_area(store, store->index_next, stop);
+        entries -= count;
+
+        /* Free block before the end is left by a failed write. Eager boot stops there as well */
+        if (store->index_next < stop)
+        {
+            end = store->index_next;
+#ifdef UWLKV_HOT_COLD
+            if (indexing_cold(store))
+            {
+                store->next_cold_block = end;
+            }
+            else
+#endif
+            {
+                store->next_block = end;
+            }
+        }
+
+        if (store->index_next < end)
+        {
+            break;
+        }
+
+#ifdef UWLKV_HOT_COLD
+        if (indexing_cold(store))
+        {
+            uwlkv_reset_updates(store);
+            store->index_next = UWLKV_METADATA_SIZE;
+            continue;
+        }
+#endif
+        store->indexing = 0;
+    }
+
+    if (!store->indexing)
+    {
+        return 0;
+    }
+
+    uwlkv_offset left = get_index_end(store) - store->index_next;
+    if (indexing_cold(store))
+    {
+        left += store->next_block - UWLKV_METADATA_SIZE;
+    }
+
+    return left / UWLKV_ENTRY_SIZE;
+}
+
+/**
+ * @brief	Scans entries of an area from the newest one to the oldest one.
+ *
+ * @param [in] 	store  	The store.
+ * @param 	   	start  	Offset of the oldest entry to be checked.
+ * @param 	   	end    	Offset after the newest entry to be checked.
+ * @param 	   	key    	The key.
+ * @param [out]	offset 	Offset of the newest entry with provided key or of its tombstone.
+ * @param [out]	deleted	Set to 1 if the key was deleted.
+ *
+ * @returns	UWLKV_E_SUCCESS if found.
+ */
+static uwlkv_error find_in_range(uwlkv_store * store, const uwlkv_offset start, uwlkv_offset end,
+                                 const uwlkv_key key, uwlkv_offset * offset, uint8_t * deleted)
+{
+    uint8_t blocks[UWLKV_SCAN_ENTRIES * UWLKV_ENTRY_SIZE];
+
+    while (end > start)
+    {
+        uwlkv_offset count = (end - start) / UWLKV_ENTRY_SIZE;
+        if (count > UWLKV_SCAN_ENTRIES)
+        {
+            count = UWLKV_SCAN_ENTRIES;
+        }
+
+        const uwlkv_offset first = end - count * (uwlkv_offset)UWLKV_ENTRY_SIZE;
+        if (uwlkv_read_entries(store, first, blocks, count))
+        {
+            return UWLKV_E_NVRAM_ERROR;
+        }
+
+        for (uwlkv_offset i = count; i > 0; i--)
+        {
+            uwlkv_key   stored_key;
+            uwlkv_value value;
+            UWLKV_STAT_ADD(lookup_probes, 1);
+            if (UWLKV_E_SUCCESS != uwlkv_decode_entry(&blocks[(i - 1) * UWLKV_ENTRY_SIZE], &stored_key, &value))
+            {
+                continue;
+            }
+
+            *deleted = (UWLKV_TOMBSTONE_KEY == stored_key) && (key == (uwlkv_key)value);
+            if ((key == stored_key) || *deleted)
+            {
+                *offset = first + (i - 1) * (uwlkv_offset)UWLKV_ENTRY_SIZE;
+                return UWLKV_E_SUCCESS;
+            }
+        }
+
+        end = first;
+    }
+
+    return UWLKV_E_NOT_EXIST;
+}
+
+/**
+ * @brief	Looks a key up in entries which are not indexed yet. They are newer than indexed ones,
+ * 			so the map is checked only if the key is not found here.
+ *
+ * @param [in] 	store  	The store.
+ * @param 	   	key    	The key.
+ * @param [out]	offset 	Offset of the newest entry with provided key or of its tombstone.
+ * @param [out]	deleted	Set to 1 if the key was deleted.
+ *
+ * @returns	- UWLKV_E_SUCCESS if found,
+ * 			- UWLKV_E_NOT_EXIST if the map has to be checked or
+ * 			- UWLKV_E_NVRAM_ERROR.
+ */
+uwlkv_error uwlkv_find_unindexed(uwlkv_store * store, const uwlkv_key key, uwlkv_offset * offset,
+                                 uint8_t * deleted)
+{
+    if (!store->indexing)
+    {
+        return UWLKV_E_NOT_EXIST;
+    }
+
+    if (indexing_cold(store))
+    {
+        const uwlkv_error ret = find_in_range(store, UWLKV_METADATA_SIZE, store->next_block, key, offset, deleted);
+        if (UWLKV_E_NOT_EXIST != ret)
+        {
+            return ret;
+        }
+    }
+
+    return find_in_range(store, store->index_next, get_index_end(store), key, offset, deleted);
+}
+#endif
+
+#ifdef UWLKV_MIGRATE
+#define UWLKV_O_LAYOUT_SIZES        (3)            /* Offset of interface sizes in layout header */
+
+/**
+ * @brief	Serializes layout of an interface and format of entries to a layout header.
+ *
+ * @param 	   	nvram 	The interface.
+ * @param [out]	header	UWLKV_LAYOUT_SIZE bytes.
+ */
+static void encode_layout(const uwlkv_nvram_interface * nvram, uint8_t * header)
+{
+#ifdef UWLKV_HOT_COLD
+    const uwlkv_offset cold = nvram->cold;
+#else
+    const uwlkv_offset cold = 0;
+#endif
+
+    header[0] = UWLKV_LAYOUT_VERSION;
+    header[1] = (uint8_t)UWLKV_ENTRY_SIZE;
+    header[2] = (uint8_t)UWLKV_METADATA_SIZE;
+    memcpy(&header[UWLKV_O_LAYOUT_SIZES],                            &nvram->size,     sizeof(uwlkv_offset));
+    memcpy(&header[UWLKV_O_LAYOUT_SIZES +     sizeof(uwlkv_offset)], &nvram->reserved, sizeof(uwlkv_offset));
+    memcpy(&header[UWLKV_O_LAYOUT_SIZES + 2 * sizeof(uwlkv_offset)], &cold,            sizeof(uwlkv_offset));
+}
+
+/**
+ * @brief	Reads interface sizes from a layout header. Entries and metadata of other format
+ * 			can't be read, so such header isn't accepted.
+ *
+ * @param 	   	header	UWLKV_LAYOUT_SIZE bytes.
+ * @param [out]	nvram 	The interface, only its sizes are changed.
+ *
+ * @returns	1 if the header was written by this version of the library.
+ */
+static uint8_t decode_layout(const uint8_t * header, uwlkv_nvram_interface * nvram)
+{
+    uint8_t expected[UWLKV_LAYOUT_SIZE];
+    encode_layout(nvram, expected);
+    if (0 != memcmp(header, expected, UWLKV_O_LAYOUT_SIZES))
+    {
+        return 0;
+    }
+
+    memcpy(&nvram->size,     &header[UWLKV_O_LAYOUT_SIZES],                            sizeof(uwlkv_offset));
+    memcpy(&nvram->reserved, &header[UWLKV_O_LAYOUT_SIZES +     sizeof(uwlkv_offset)], sizeof(uwlkv_offset));
+#ifdef UWLKV_HOT_COLD
+    memcpy(&nvram->cold,     &header[UWLKV_O_LAYOUT_SIZES + 2 * sizeof(uwlkv_offset)], sizeof(uwlkv_offset));
+#endif
+
+    return 1;
+}
+
+/**
+ * @brief	Writes layout of the store interface to metadata of an area. It goes before the erase
+ * 			flag together with erase counters, so an area with a flag has a complete header.
+ *
+ * @param 	store   	The store.
+ * @param 	metadata	Offset of area metadata.
+ */
+static void store_layout(uwlkv_store * store, const uwlkv_offset metadata)
+{
+    uint8_t header[UWLKV_LAYOUT_SIZE];
+    encode_layout(&store->nvram, header);
+    uwlkv_nvram_write(store, header, metadata + UWLKV_O_LAYOUT, UWLKV_LAYOUT_SIZE);
+}
+
+/**
+ * @brief	Checks that layout header of erased main area is either blank or complete. It's
+ * 			written after the copy back, and a header torn by a power loss can't be written again.
+ *
+ * @param 	store	The store.
+ *
+ * @returns	1 if the header may be written.
+ */
+static uint8_t main_layout_writable(uwlkv_store * store)
+{
+    uint8_t header[UWLKV_LAYOUT_SIZE];
+    uint8_t stored[UWLKV_LAYOUT_SIZE];
+    encode_layout(&store->nvram, header);
+
+    return (0 == uwlkv_nvram_read(store, stored, UWLKV_O_LAYOUT, UWLKV_LAYOUT_SIZE))
+        && (uwlkv_is_block_erased(stored, UWLKV_LAYOUT_SIZE) || (0 == memcmp(stored, header, UWLKV_LAYOUT_SIZE)));
+}
+
+/**
+ * @brief	Indexes live entries of NVRAM with the layout of store interface. Nothing is written.
+ * 			They are in main and cold areas, unless a wrap-around was interrupted before the
+ * 			copy back, then reserved area holds the only complete copy of main one.
+ *
+ * @param 	store	The store.
+ *
+ * @returns	End of the last area with live entries, including its first free block. Anything
+ * 			after it may be overwritten and the same entries are found by a scan again.
+ */
+static uwlkv_offset index_live_entries(uwlkv_store * store)
+{
+    uint8_t main_metadata[UWLKV_O_ERASE_COUNTERS];
+    uint8_t reserve_metadata[UWLKV_O_ERASE_COUNTERS];
+    uwlkv_nvram_read(store, main_metadata,    0,                            UWLKV_O_ERASE_COUNTERS);
+    uwlkv_nvram_read(store, reserve_metadata, get_reserve_offset(store, 0), UWLKV_O_ERASE_COUNTERS);
+
+    const uint8_t copy_finished = (UWLKV_NVRAM_ERASE_FINISHED == reserve_metadata[UWLKV_O_ERASE_FINISHED])
+                               && (UWLKV_NVRAM_ERASE_STARTED  == main_metadata[UWLKV_O_ERASE_STARTED]);
+    uwlkv_offset end;
+    uwlkv_offset area_end;
+
+    if ((UWLKV_S_MAIN_ERASE_INTERRUPTED == get_nvram_state(store)) && !copy_finished)
+    {
+#ifdef UWLKV_HOT_COLD
+        /* Full erase copies cold entries to reserved area as well */
+        if (UWLKV_NVRAM_FULL_ERASE_STARTED == reserve_metadata[UWLKV_O_ERASE_STARTED])
+        {
+            uwlkv_reset_map(store);
+        }
+        else
+#endif
+        {
+            reset_map(store);
+        }
+        area_end = store->nvram.size;
+        end      = index_area(store, get_reserve_offset(store, UWLKV_METADATA_SIZE), area_end);
+    }
+    else
+    {
+        load_map(store);
+        area_end = get_main_end(store);
+        end      = store->next_block;
+#ifdef UWLKV_HOT_COLD
+        /* A scan of cold area stops on its first block, even if it's empty */
+        if (store->nvram.cold)
+        {
+            area_end = get_reserve_offset(store, 0);
+            end      = store->next_cold_block;
+        }
+#endif
+    }
+
+    return ((area_end - end) > UWLKV_ENTRY_SIZE) ? (end + UWLKV_ENTRY_SIZE) : area_end;
+}
+
+/**
+ * @brief	Checks that sizes of an old layout describe areas, which NVRAM of store interface has.
+ *
+ * @param 	old    	Interface with the old layout.
+ * @param 	current	Interface of the store.
+ *
+ * @returns	1 if entries of the old layout may be read.
  */
-uwlkv_offset uwlkv_get_next_block(void)
+static uint8_t layout_fits(const uwlkv_nvram_interface * old, const uwlkv_nvram_interface * current)
 {
-    if ((next_block + UWLKV_ENTRY_SIZE) > (nvram_interface.size - nvram_interface.reserved))
+#ifdef UWLKV_HOT_COLD
+    const uwlkv_offset not_main = old->reserved + old->cold;
+#else
+    const uwlkv_offset not_main = old->reserved;
+#endif
+
+    return (old->size <= current->size)
+        && (old->reserved >= UWLKV_MINIMAL_SIZE)
+        && (not_main < old->size)
+        && ((old->size - not_main) >= UWLKV_MINIMAL_SIZE);
+}
+
+/**
+ * @brief	Finds reserved area of another layout, which has a flag of main area erase. Blank main
+ * 			and reserved areas of store interface are either blank NVRAM or a wrap-around of the
+ * 			old layout, interrupted after its main area erase had started. The old reserved area
+ * 			holds the only complete copy of entries then. It may be anywhere, so NVRAM is read
+ * 			once in chunks and each byte with the flag value is checked for a layout header,
+ * 			which puts reserved area right there.
+ *
+ * @param 	   	store 	The store.
+ * @param [out]	header	Layout header of the old reserved area, UWLKV_LAYOUT_SIZE bytes.
+ *
+ * @returns	1 if reserved area of another layout is found.
+ */
+static uint8_t find_old_reserve(uwlkv_store * store, uint8_t * header)
+{
+    uint8_t blocks[UWLKV_SCAN_ENTRIES * UWLKV_ENTRY_SIZE];
+    const uwlkv_offset end = store->nvram.size - UWLKV_METADATA_SIZE;
+
+    for (uwlkv_offset start = UWLKV_MINIMAL_SIZE; start < end; )
     {
-        restart_map();
+        uwlkv_offset size = end - start;
+        if (size > sizeof(blocks))
+        {
+            size = sizeof(blocks);
+        }
+
+        if (uwlkv_nvram_read(store, blocks, start, size))
+        {
+            return 0;
+        }
+
+        for (uwlkv_offset i = 0; i < size; i++)
+        {
+            uwlkv_nvram_interface old = store->nvram;
+            uint8_t metadata[UWLKV_METADATA_SIZE];
+            if (   main_erase_started(&blocks[i])
+                && (0 == uwlkv_nvram_read(store, metadata, start + i, UWLKV_METADATA_SIZE))
+                && decode_layout(&metadata[UWLKV_O_LAYOUT], &old)
+                && layout_fits(&old, &store->nvram)
+                && ((old.size - old.reserved) == (start + i)) )
+            {
+                memcpy(header, &metadata[UWLKV_O_LAYOUT], UWLKV_LAYOUT_SIZE);
+                return 1;
+            }
+        }
+
+        start += size;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief	Moves entries written with another layout to the layout of store interface. Old
+ * 			layout is read from main area header, its live entries are indexed and a full
+ * 			wrap-around of the new layout copies them to the new reserved area and back, so
+ * 			each entry is written twice. Main area header can't be rewritten without an erase,
+ * 			so there is no shorter way. The flag of reserved area, written after the first
+ * 			copy, commits the migration: from then on NVRAM is in the middle of an ordinary
+ * 			wrap-around of the new layout and a power loss is recovered as such. Before it, old
+ * 			areas are intact and the migration starts over.
+ * 			The new reserved area must not overlap old live entries, so main area may grow and
+ * 			reserved one may move towards the end of NVRAM, which may grow as well.
+ * 			Main area without header is blank or erased by a wrap-around. The old layout is read
+ * 			from its reserved area then, see find_old_reserve(), and live entries are indexed
+ * 			there. The interrupted wrap-around isn't finished: erase functions of the interface
+ * 			erase areas of the new layout only.
+ *
+ * @param 	store	The store.
+ *
+ * @returns	UWLKV_E_SUCCESS if NVRAM has the layout of the interface now or
+ * 			UWLKV_E_LAYOUT if it can't be migrated, NVRAM is not changed then.
+ */
+static uwlkv_error migrate_layout(uwlkv_store * store)
+{
+    uint8_t header[UWLKV_LAYOUT_SIZE];
+    uint8_t main_metadata[UWLKV_METADATA_SIZE];
+    uint8_t reserve_metadata[UWLKV_METADATA_SIZE];
+    encode_layout(&store->nvram, header);
+    uwlkv_nvram_read(store, main_metadata,    0,                            UWLKV_METADATA_SIZE);
+    uwlkv_nvram_read(store, reserve_metadata, get_reserve_offset(store, 0), UWLKV_METADATA_SIZE);
+
+    const uint8_t main_flagged = (UWLKV_NVRAM_ERASE_STARTED  == main_metadata[UWLKV_O_ERASE_STARTED])
+                              || (UWLKV_NVRAM_ERASE_FINISHED == main_metadata[UWLKV_O_ERASE_FINISHED]);
+    const uint8_t committed    = main_erase_started(reserve_metadata)
+                              && (0 == memcmp(&reserve_metadata[UWLKV_O_LAYOUT], header, UWLKV_LAYOUT_SIZE));
+    uint8_t * old_header = &main_metadata[UWLKV_O_LAYOUT];
+
+    /* Other states of main area without flags are recovered by get_nvram_state() */
+    if (   !main_flagged
+        && (   (UWLKV_S_BLANK != get_nvram_state(store))
+            || !find_old_reserve(store, old_header)) )
+    {
+        return UWLKV_E_SUCCESS;
     }
 
-    next_block += UWLKV_ENTRY_SIZE;
+    if (committed || (0 == memcmp(old_header, header, UWLKV_LAYOUT_SIZE)))
+    {
+        return UWLKV_E_SUCCESS;
+    }
 
-    return next_block - (uwlkv_offset)UWLKV_ENTRY_SIZE;
+    const uwlkv_nvram_interface current = store->nvram;
+    if (   !decode_layout(old_header, &store->nvram)
+        || !layout_fits(&store->nvram, &current) )
+    {
+        store->nvram = current;
+        return UWLKV_E_LAYOUT;
+    }
+
+    UWLKV_WEAR_LOAD(store, 0);
+    UWLKV_WEAR_LOAD(store, get_reserve_offset(store, 0));
+    const uwlkv_offset live_end = index_live_entries(store);
+    store->nvram = current;
+    if (live_end > get_reserve_offset(store, 0))
+    {
+        uwlkv_reset_map(store);
+        return UWLKV_E_LAYOUT;
+    }
+
+    UWLKV_STAT_ADD(migrations, 1);
+    uwlkv_nvram_erase(store, UWLKV_RESERVED);
+    /* Cold area of the new layout may hold anything, so it's erased and all entries become hot */
+    restart_map(store, UWLKV_TOMBSTONE_KEY, 1);
+
+    return UWLKV_E_SUCCESS;
 }
+#endif
+
+#endif
@@ -1,7 +1,22 @@
 #ifndef UWLKV_STORAGE_H
 #define UWLKV_STORAGE_H
 
-void uwlkv_cold_boot(void);
-uwlkv_offset uwlkv_get_next_block(void);
+uwlkv_error uwlkv_cold_boot(uwlkv_store * store, uint8_t lazy);
+uwlkv_error uwlkv_get_next_block(uwlkv_store * store, uwlkv_key key, uwlkv_offset * offset);
+uwlkv_error uwlkv_write_block(uwlkv_store * store, uwlkv_offset offset, uwlkv_key key, uwlkv_value value);
+uwlkv_error uwlkv_forget_cold_entry(uwlkv_store * store, uwlkv_key key);
+void uwlkv_compact_storage(uwlkv_store * store);
+#ifdef UWLKV_EEPROM
+uwlkv_offset uwlkv_ring_slots(uwlkv_offset size);
+#endif
+
+#ifdef UWLKV_LAZY_INIT
+uwlkv_offset uwlkv_index_step(uwlkv_store * store, uwlkv_offset entries);
+uwlkv_error uwlkv_find_unindexed(uwlkv_store * store, uwlkv_key key, uwlkv_offset * offset, uint8_t * deleted);
+
+#define UWLKV_FINISH_INDEX(store)   ((void)uwlkv_index_step((store), (uwlkv_offset)-1))
+#else
+#define UWLKV_FINISH_INDEX(store)   ((void)0)
+#endif
 
 #endif
@@ -0,0 +1,107 @@
+/* This module records begin and end events of library operations to a ring buffer. It is
+ * compiled only with UWLKV_TRACE, otherwise UWLKV_TRACE_* macros expand to nothing.
+ * The library is the only writer. A reader (e.g. a debug task or an interrupt) may copy events
+ * at any moment without locks: events overwritten during the copy are discarded. Memory
+ * barriers keep contents of an event and the counter of written events in order.
+ * The buffer is shared by all stores, so stores used from different tasks need one common lock.
+ */
+
+#include "uwlkv.h"
+#include "stats.h"
+#include "trace.h"
+
+#ifdef UWLKV_TRACE
+
+/* Barriers between event contents and the counter which publishes them. A reader may run on
+ * another core, so they order memory accesses, not only the code generated by the compiler.
+ * Define both for a compiler which has neither GCC builtins nor C11 atomics. */
+#ifndef UWLKV_TRACE_RELEASE
+#if defined(__GNUC__)
+#define UWLKV_TRACE_RELEASE()   __atomic_thread_fence(__ATOMIC_RELEASE)
+#define UWLKV_TRACE_ACQUIRE()   __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#elif defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+#define UWLKV_TRACE_RELEASE()   atomic_thread_fence(memory_order_release)
+#define UWLKV_TRACE_ACQUIRE()   atomic_thread_fence(memory_order_acquire)
+#else
+#error "Define UWLKV_TRACE_RELEASE() and UWLKV_TRACE_ACQUIRE() memory barriers for this compiler"
+#endif
+#endif
+
+static uwlkv_trace_event     trace_events[UWLKV_TRACE_SIZE];
+static volatile uint32_t     trace_written;         /* Number of events ever written */
+
+/**
+ * @brief	Records an event, overwriting the oldest one if buffer is full.
+ *
+ * @param 	operation	Traced operation.
+ * @param 	begin    	1 when operation begins, 0 when it ends.
+ * @param 	data     	Key, NVRAM offset or area, depending on operation.
+ */
+void uwlkv_trace(const uwlkv_trace_operation operation, const uint8_t begin, const uint32_t data)
+{
+    const uint32_t position = trace_written;
+    uwlkv_trace_event * event = &trace_events[position % UWLKV_TRACE_SIZE];
+
+    /* Counter of the previous event tells a reader that this slot is being overwritten */
+    UWLKV_TRACE_RELEASE();
+    event->timestamp = uwlkv_timestamp_now();
+    event->data      = data;
+    event->operation = (uint8_t)operation;
+    event->begin     = begin;
+
+    /* Contents are complete before the event is published */
+    UWLKV_TRACE_RELEASE();
+    trace_written = position + 1;
+}
+
+/**
+ * @brief	Copies recorded events in order of their appearance. Events are numbered from the
+ * 			first one recorded after startup. If requested events were already overwritten, copy
+ * 			starts from the oldest available one. The slot of the oldest event may be overwritten
+ * 			at any moment, so at most UWLKV_TRACE_SIZE - 1 latest events are available.
+ *
+ * @param [out]   	events  	Buffer for events.
+ * @param 		  	size    	Capacity of the buffer in events.
+ * @param [in,out]	position	Number of the first event to copy. Would be set to the number
+ * 								of the next event to copy on the following call.
+ *
+ * @returns	Number of copied events.
+ */
+uint32_t uwlkv_get_trace(uwlkv_trace_event * events, const uint32_t size, uint32_t * position)
+{
+    const uint32_t written = trace_written;
+    UWLKV_TRACE_ACQUIRE();
+    if ((written - *position) >= UWLKV_TRACE_SIZE)
+    {
+        *position = written - UWLKV_TRACE_SIZE + 1;
+    }
+
+    const uint32_t first = *position;
+    uint32_t copied = 0;
+    while ((*position != written) && (copied < size))
+    {
+        events[copied] = trace_events[*position % UWLKV_TRACE_SIZE];
+        copied    += 1;
+        *position += 1;
+    }
+
+    /* Writer could overwrite the oldest events while they were copied. The slot of the event
+     * being written right now is not valid too. Events are copied before the counter is read. */
+    UWLKV_TRACE_ACQUIRE();
+    const uint32_t valid_from = trace_written - UWLKV_TRACE_SIZE + 1;
+    uint32_t lost = 0;
+    while ((lost < copied) && ((int32_t)(first + lost - valid_from) < 0))
+    {
+        lost += 1;
+    }
+
+    for (uint32_t i = lost; i < copied; i++)
+    {
+        events[i - lost] = events[i];
+    }
+
+    return copied - lost;
+}
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef UWLKV_TRACE_H
+#define UWLKV_TRACE_H
+
+#ifdef UWLKV_TRACE
+
+void uwlkv_trace(uwlkv_trace_operation operation, uint8_t begin, uint32_t data);
+
+#define UWLKV_TRACE_BEGIN(operation, data)  uwlkv_trace((operation), 1, (uint32_t)(data))
+#define UWLKV_TRACE_END(operation, data)    uwlkv_trace((operation), 0, (uint32_t)(data))
+
+#else
+
+#define UWLKV_TRACE_BEGIN(operation, data)  ((void)0)
+#define UWLKV_TRACE_END(operation, data)    ((void)0)
+
+#endif
+
+#endif
@@ -2,26 +2,75 @@
 #include "entry.h"
 #include "map.h"
 #include "storage.h"
+#include "trace.h"
 
-uwlkv_nvram_interface nvram_interface;
-uint8_t uwlkv_initialized = 0;
+/* Tombstone stores deleted key in place of a value */
+typedef char uwlkv_tombstone_fits[(sizeof(uwlkv_value) >= sizeof(uwlkv_key)) ? 1 : -1];
 
+#ifndef UWLKV_EEPROM
 /**
- * @brief	Reads NVRAM content and builds its map
+ * @brief	Calculates how many entries fit into an area after its metadata.
+ *
+ * @param 	size	Area size in bytes.
+ *
+ * @returns	Number of entries.
+ */
+static uwlkv_offset area_capacity(const uwlkv_offset size)
+{
+    return (size > UWLKV_METADATA_SIZE) ? ((size - UWLKV_METADATA_SIZE) / UWLKV_ENTRY_SIZE) : 0;
+}
+#endif
+
+/**
+ * @brief	Checks that a key can be stored.
+ *
+ * @param 	key	The key.
+ *
+ * @returns	- UWLKV_E_SUCCESS,
+ * 			- UWLKV_E_RESERVED_KEY for UWLKV_TOMBSTONE_KEY or
+ * 			- UWLKV_E_UNKNOWN_KEY if the key is not in UWLKV_KEYS.
+ */
+static uwlkv_error check_key(const uwlkv_key key)
+{
+    if (UWLKV_TOMBSTONE_KEY == key)
+    {
+        return UWLKV_E_RESERVED_KEY;
+    }
+
+#ifdef UWLKV_KEYS
+    if (UWLKV_MAX_ENTRIES == uwlkv_key_slot(key))
+    {
+        return UWLKV_E_UNKNOWN_KEY;
+    }
+#endif
+
+    return UWLKV_E_SUCCESS;
+}
+
+/**
+ * @brief	Checks NVRAM sizes and calculates its capacity.
  *
  * @param [in]	interface	NVRAM access insterface.
  *
- * @returns	- NVRAM capacity in entries. This value, divided by UWLKV_MAX_ENTRIES gives you an
- * 			expected leveling factor or write cycles multiplier.
- * 			- 0 if NVRAM size is too small to fit all entries.
+ * @returns	Capacity in entries or 0 if NVRAM is too small.
  */
-uwlkv_offset uwlkv_init(const uwlkv_nvram_interface * interface)
+static uwlkv_offset get_capacity(const uwlkv_nvram_interface * interface)
 {
-    const uwlkv_offset main_size        = interface->size - interface->reserved;
-    const uwlkv_offset reserve_capacity = interface->reserved / UWLKV_ENTRY_SIZE;
-    const uwlkv_offset main_capacity    = main_size / UWLKV_ENTRY_SIZE;
+#ifdef UWLKV_EEPROM
+    const uwlkv_offset slots = uwlkv_ring_slots(interface->size);
+
+    return (slots >= 2) ? (slots * (uwlkv_offset)UWLKV_MAX_ENTRIES) : 0;
+#else
+#ifdef UWLKV_HOT_COLD
+    const uwlkv_offset not_main         = interface->reserved + interface->cold;
+#else
+    const uwlkv_offset not_main         = interface->reserved;
+#endif
+    const uwlkv_offset main_size        = interface->size - not_main;
+    const uwlkv_offset reserve_capacity = area_capacity(interface->reserved);
+    const uwlkv_offset main_capacity    = area_capacity(main_size);
 
-    const uint8_t reserve_size_wrong   = interface->reserved >= interface->size;
+    const uint8_t reserve_size_wrong   = not_main >= interface->size;
     const uint8_t main_smaller_reserve = main_capacity < reserve_capacity;
 
     if (    (reserve_size_wrong)
@@ -32,87 +81,337 @@ uwlkv_offset uwlkv_init(const uwlkv_nvram_interface * interface)
         return 0;
     }
 
-    nvram_interface = *interface;
+    return main_capacity;
+#endif
+}
 
-    uwlkv_cold_boot();
+/** @brief	Implements uwlkv_store_init() and uwlkv_store_init_lazy() */
+static uwlkv_offset init(uwlkv_store * store, const uwlkv_nvram_interface * interface, const uint8_t lazy)
+{
+    const uwlkv_offset capacity = get_capacity(interface);
+    if (0 == capacity)
+    {
+        store->initialized = 0;
+        return 0;
+    }
 
-    uwlkv_initialized = 1;
+    store->nvram     = *interface;
+    store->key_limit = UWLKV_MAX_ENTRIES;
 
-    return main_capacity;
+    if (UWLKV_E_SUCCESS != uwlkv_cold_boot(store, lazy))
+    {
+        store->initialized = 0;
+        return 0;
+    }
+
+    store->initialized = 1;
+
+    return capacity;
+}
+
+/**
+ * @brief	Reads NVRAM content and builds map of a store
+ *
+ * @param [out]	store    	The store, any content is overwritten.
+ * @param [in] 	interface	NVRAM access insterface.
+ *
+ * @returns	- NVRAM capacity in entries. This value, divided by UWLKV_MAX_ENTRIES gives you an
+ * 			expected leveling factor or write cycles multiplier.
+ * 			- 0 if NVRAM size is too small to fit all entries or, with UWLKV_MIGRATE, NVRAM
+ * 			was written with a layout which can't be migrated. NVRAM is left as is then.
+ */
+uwlkv_offset uwlkv_store_init(uwlkv_store * store, const uwlkv_nvram_interface * interface)
+{
+    return init(store, interface, 0);
+}
+
+#ifdef UWLKV_LAZY_INIT
+/**
+ * @brief	Same as uwlkv_store_init(), but clean NVRAM is not indexed: only ends of areas are
+ * 			found, with a logarithmic number of reads. Values can be read right away, the map
+ * 			is built by uwlkv_store_init_step() or by the first call which needs all of it.
+ * 			Recovery after power loss is still done in full.
+ *
+ * @param [out]	store    	The store, any content is overwritten.
+ * @param [in] 	interface	NVRAM access insterface.
+ *
+ * @returns	Same as uwlkv_store_init().
+ */
+uwlkv_offset uwlkv_store_init_lazy(uwlkv_store * store, const uwlkv_nvram_interface * interface)
+{
+    return init(store, interface, 1);
+}
+
+/**
+ * @brief	Adds some entries to the map after uwlkv_store_init_lazy(). Call it from an idle
+ * 			loop or a low priority task, so the map is ready before the first write.
+ *
+ * @param 	store  	The store.
+ * @param 	entries	Maximum number of entries to be read.
+ *
+ * @returns	Number of entries which are still not indexed, 0 when map is complete.
+ */
+uwlkv_offset uwlkv_store_init_step(uwlkv_store * store, uwlkv_offset entries)
+{
+    return uwlkv_index_step(store, entries);
+}
+#endif
+
+/** @brief	Implements uwlkv_store_get_value() */
+static uwlkv_error get_value(uwlkv_store * store, uwlkv_key key, uwlkv_value * value)
+{
+    if (0 == store->initialized)
+    {
+        return UWLKV_E_NOT_STARTED;
+    }
+
+    const uwlkv_error key_error = check_key(key);
+    if (UWLKV_E_SUCCESS != key_error)
+    {
+        return key_error;
+    }
+
+#ifdef UWLKV_LAZY_INIT
+    uwlkv_offset offset;
+    uint8_t      deleted;
+    const uwlkv_error unindexed = uwlkv_find_unindexed(store, key, &offset, &deleted);
+    if (UWLKV_E_SUCCESS == unindexed)
+    {
+        return deleted ? UWLKV_E_NOT_EXIST : uwlkv_read_entry(store, offset, &key, value);
+    }
+    if (UWLKV_E_NOT_EXIST != unindexed)
+    {
+        return unindexed;
+    }
+#endif
+
+    uwlkv_entry * entry;
+    if (uwlkv_get_entry(store, key, &entry))
+    {
+        return UWLKV_E_NOT_EXIST;
+    }
+
+    return uwlkv_read_entry(store, entry->offset, &key, value);
 }
 
 /**
  * @brief	Get value of specifiend key
  *
+ * @param [in] 	store	The store.
  * @param 	   	key  	The key.
  * @param [out]	value	Read value if success.
  *
  * @returns	UWLKV_E_SUCCESS on sucesseful read.
  */
-uwlkv_error uwlkv_get_value(uwlkv_key key, uwlkv_value * value)
+uwlkv_error uwlkv_store_get_value(uwlkv_store * store, uwlkv_key key, uwlkv_value * value)
+{
+    UWLKV_TRACE_BEGIN(UWLKV_OP_GET_VALUE, key);
+    const uwlkv_error ret = get_value(store, key, value);
+    UWLKV_TRACE_END(UWLKV_OP_GET_VALUE, key);
+
+    return ret;
+}
+
+/** @brief	Implements uwlkv_store_set_value() */
+static uwlkv_error set_value(uwlkv_store * store, uwlkv_key key, uwlkv_value value)
 {
-    if (0 == uwlkv_initialized)
+    if (0 == store->initialized)
     {
         return UWLKV_E_NOT_STARTED;
     }
 
-    uwlkv_entry * entry;
-    if (uwlkv_get_entry(key, &entry))
+    const uwlkv_error key_error = check_key(key);
+    if (UWLKV_E_SUCCESS != key_error)
     {
-        return UWLKV_E_NOT_EXIST;
+        return key_error;
+    }
+
+    UWLKV_FINISH_INDEX(store);
+    uwlkv_entry *entry;
+    if     (UWLKV_E_NOT_EXIST == uwlkv_get_entry(store, key, &entry)
+        && (0 == uwlkv_store_get_free_entries(store))) 
+    {
+        return UWLKV_E_NO_SPACE;
+    }
+
+    uwlkv_offset offset;
+    uwlkv_error write = uwlkv_get_next_block(store, key, &offset);
+    if (UWLKV_E_SUCCESS != write)
+    {
+        return write;
+    }
+
+    write = uwlkv_write_block(store, offset, key, value);
+    if (UWLKV_E_SUCCESS == write)
+    {
+        uwlkv_update_entry(store, key, offset);
     }
 
-    return uwlkv_read_entry(entry->offset, &key, value);
+    return write;
 }
 
 /**
  * @brief	Set value of specified key.
  *
+ * @param 	store	The store.
  * @param 	key  	The key.
  * @param 	value	Value to be written.
  *
  * @returns	UWLKV_E_SUCCESS on sucesseful read.
  */
-uwlkv_error uwlkv_set_value(uwlkv_key key, uwlkv_value value)
+uwlkv_error uwlkv_store_set_value(uwlkv_store * store, uwlkv_key key, uwlkv_value value)
+{
+    UWLKV_TRACE_BEGIN(UWLKV_OP_SET_VALUE, key);
+    const uwlkv_error ret = set_value(store, key, value);
+    UWLKV_TRACE_END(UWLKV_OP_SET_VALUE, key);
+
+    return ret;
+}
+
+/** @brief	Implements uwlkv_store_delete_value() */
+static uwlkv_error delete_value(uwlkv_store * store, uwlkv_key key)
 {
-    if (0 == uwlkv_initialized)
+    if (0 == store->initialized)
     {
         return UWLKV_E_NOT_STARTED;
     }
 
-    uwlkv_offset offset = uwlkv_get_next_block();
+    const uwlkv_error key_error = check_key(key);
+    if (UWLKV_E_SUCCESS != key_error)
+    {
+        return key_error;
+    }
+
+    UWLKV_FINISH_INDEX(store);
     uwlkv_entry *entry;
-    if     (UWLKV_E_NOT_EXIST == uwlkv_get_entry(key, &entry)
-        && (0 == uwlkv_map_free_entries())) 
+    if (uwlkv_get_entry(store, key, &entry))
     {
-        return UWLKV_E_NO_SPACE;
+        return UWLKV_E_NOT_EXIST;
     }
 
-    uwlkv_error write = uwlkv_write_entry(offset, key, value);
+    uwlkv_error write = uwlkv_forget_cold_entry(store, key);
+    if (UWLKV_E_SUCCESS != write)
+    {
+        return write;
+    }
+
+    uwlkv_offset offset;
+    write = uwlkv_get_next_block(store, key, &offset);
+    if (UWLKV_E_SUCCESS != write)
+    {
+        return write;
+    }
+
+    write = uwlkv_write_block(store, offset, UWLKV_TOMBSTONE_KEY, (uwlkv_value)key);
     if (UWLKV_E_SUCCESS == write)
     {
-        uwlkv_update_entry(key, offset);
+        uwlkv_remove_entry(store, key, offset);
     }
 
     return write;
 }
 
+/**
+ * @brief	Deletes a key. A tombstone entry is written, so the key is freed and the next
+ * 			wrap-around drops it from NVRAM.
+ *
+ * @param 	store	The store.
+ * @param 	key  	The key.
+ *
+ * @returns	- UWLKV_E_SUCCESS on sucesseful write or
+ * 			- UWLKV_E_NOT_EXIST if there is no such key.
+ */
+uwlkv_error uwlkv_store_delete_value(uwlkv_store * store, uwlkv_key key)
+{
+    UWLKV_TRACE_BEGIN(UWLKV_OP_DELETE_VALUE, key);
+    const uwlkv_error ret = delete_value(store, key);
+    UWLKV_TRACE_END(UWLKV_OP_DELETE_VALUE, key);
+
+    return ret;
+}
+
+/**
+ * @brief	Performs a wrap-around now instead of on a write to full main area: live entries are
+ * 			defragmented and deleted keys are dropped. Call it at a convenient moment, so
+ * 			following writes don't pay for it, or to compact an NVRAM image.
+ *
+ * @param 	store	The store.
+ *
+ * @returns	UWLKV_E_SUCCESS or UWLKV_E_NOT_STARTED.
+ */
+uwlkv_error uwlkv_store_compact(uwlkv_store * store)
+{
+    if (0 == store->initialized)
+    {
+        return UWLKV_E_NOT_STARTED;
+    }
+
+    UWLKV_FINISH_INDEX(store);
+    uwlkv_compact_storage(store);
+
+    return UWLKV_E_SUCCESS;
+}
+
+/**
+ * @brief	Calls a function for each stored key. RAM map visits keys in order of their location in
+ * 			NVRAM and reads neighbouring entries at once, RAM-less mode visits them in order of keys.
+ *
+ * @param 	store   	The store.
+ * @param 	callback	Receives key, value and context. Return non-zero to stop iteration.
+ * 						Storage must not be modified from the callback.
+ * @param 	context 	User pointer passed to callback.
+ *
+ * @returns	UWLKV_E_SUCCESS if all keys were visited or iteration was stopped by callback.
+ */
+uwlkv_error uwlkv_store_foreach(uwlkv_store * store, uwlkv_foreach_callback callback, void * context)
+{
+    if (0 == store->initialized)
+    {
+        return UWLKV_E_NOT_STARTED;
+    }
+
+    UWLKV_FINISH_INDEX(store);
+    return uwlkv_map_foreach(store, callback, context);
+}
+
 /**
  * @brief	Returns number of unique key values in use.
  *
+ * @param 	store	The store.
+ *
  * @returns	Number of keys.
  */
-uwlkv_key uwlkv_get_entries_number(void)
+uwlkv_key uwlkv_store_get_entries_number(uwlkv_store * store)
 {
-    return uwlkv_get_used_entries();
+    UWLKV_FINISH_INDEX(store);
+    return uwlkv_get_used_entries(store);
 }
 
 /**
  * @brief	Returns number of free unique key values.
  *
+ * @param 	store	The store.
+ *
  * @returns	Number of keys.
  */
-uwlkv_key uwlkv_get_free_entries(void)
+uwlkv_key uwlkv_store_get_free_entries(uwlkv_store * store)
+{
+    UWLKV_FINISH_INDEX(store);
+    const uwlkv_key used = uwlkv_get_used_entries(store);
+
+    return (store->key_limit > used) ? (uwlkv_key)(store->key_limit - used) : 0;
+}
+
+/**
+ * @brief	Limits number of keys of a store below UWLKV_MAX_ENTRIES, e.g. for stores of
+ * 			different sizes in one program. It's checked together with free space of the map,
+ * 			so a write doesn't cost anything more. Keys which are already stored are kept, new
+ * 			ones are refused with UWLKV_E_NO_SPACE. uwlkv_store_init() resets the limit.
+ *
+ * @param 	store	The store.
+ * @param 	limit	Maximum number of keys.
+ */
+void uwlkv_store_set_key_limit(uwlkv_store * store, const uwlkv_key limit)
 {
-    return uwlkv_map_free_entries();
+    store->key_limit = (limit < UWLKV_MAX_ENTRIES) ? limit : (uwlkv_key)UWLKV_MAX_ENTRIES;
 }
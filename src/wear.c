@@ -0,0 +1,170 @@
+/* This module keeps erase counters of NVRAM areas. It is compiled only with UWLKV_WEAR,
+ * otherwise all UWLKV_WEAR_* macros expand to nothing.
+ * Counters of all areas are stored in metadata of each area after the erase flags. An area
+ * can't keep its own counter, because it is lost on erase, so counters are written to the
+ * other area right before the erase and already include it. On boot, the largest value found
+ * in both areas is used. An erase of reserved area repeated by recovery after a power loss
+ * is kept in its own metadata until the next wrap-around.
+ */
+
+#include <string.h>
+#include "uwlkv.h"
+#include "entry.h"
+#include "map.h"
+#include "storage.h"
+#include "wear.h"
+
+#ifdef UWLKV_WEAR
+
+/** @brief	Forgets all counters of a store. */
+void uwlkv_wear_reset(uwlkv_store * store)
+{
+    memset(store->erases, 0, sizeof(store->erases));
+    store->writes = 0;
+}
+
+/**
+ * @brief	Counts an erase of an area.
+ *
+ * @param 	store	The store.
+ * @param 	area 	Erased area.
+ */
+void uwlkv_wear_erased(uwlkv_store * store, const uwlkv_area area)
+{
+    if (area < UWLKV_WEAR_AREAS)
+    {
+        store->erases[area] += 1;
+    }
+}
+
+/** @brief	Counts a block given to a new entry. */
+void uwlkv_wear_written(uwlkv_store * store)
+{
+    store->writes += 1;
+}
+
+/**
+ * @brief	Reads counters from metadata of an area, keeping the largest values. Counters which
+ * 			were not written (erased) are ignored.
+ *
+ * @param 	store   	The store.
+ * @param 	metadata	Offset of area metadata.
+ */
+void uwlkv_wear_load(uwlkv_store * store, const uwlkv_offset metadata)
+{
+    uint32_t stored[UWLKV_WEAR_AREAS];
+    if (uwlkv_nvram_read(store, (uint8_t *)stored, metadata + UWLKV_O_ERASE_COUNTERS, sizeof(stored)))
+    {
+        return;
+    }
+
+    for (uint8_t i = 0; i < UWLKV_WEAR_AREAS; i++)
+    {
+        if ((UINT32_MAX != stored[i]) && (stored[i] > store->erases[i]))
+        {
+            store->erases[i] = stored[i];
+        }
+    }
+}
+
+/** @brief	Fills counters as they are written to metadata, see uwlkv_wear_store(). */
+static void encode_counters(uwlkv_store * store, const uint8_t pending, uint32_t * counters)
+{
+    for (uint8_t i = 0; i < UWLKV_WEAR_AREAS; i++)
+    {
+        counters[i] = store->erases[i] + ((pending >> i) & 1u);
+    }
+}
+
+/**
+ * @brief	Writes counters to metadata of an area.
+ *
+ * @param 	store   	The store.
+ * @param 	metadata	Offset of area metadata.
+ * @param 	pending 	Areas which are about to be erased, by UWLKV_WEAR_PENDING() mask.
+ * 						Their counters are written incremented.
+ */
+void uwlkv_wear_store(uwlkv_store * store, const uwlkv_offset metadata, const uint8_t pending)
+{
+    uint32_t counters[UWLKV_WEAR_AREAS];
+    encode_counters(store, pending, counters);
+
+    uwlkv_nvram_write(store, (uint8_t *)counters, metadata + UWLKV_O_ERASE_COUNTERS, sizeof(counters));
+}
+
+/**
+ * @brief	Checks that counters in metadata of an area are either blank or the same as
+ * 			uwlkv_wear_store() would write. Counters torn by a power loss can't be written again.
+ *
+ * @param 	store   	The store.
+ * @param 	metadata	Offset of area metadata.
+ * @param 	pending 	Areas which are about to be erased, by UWLKV_WEAR_PENDING() mask.
+ *
+ * @returns	1 if the counters may be written.
+ */
+uint8_t uwlkv_wear_writable(uwlkv_store * store, const uwlkv_offset metadata, const uint8_t pending)
+{
+    uint32_t counters[UWLKV_WEAR_AREAS];
+    uint32_t stored[UWLKV_WEAR_AREAS];
+    encode_counters(store, pending, counters);
+
+    return (0 == uwlkv_nvram_read(store, (uint8_t *)stored, metadata + UWLKV_O_ERASE_COUNTERS, sizeof(stored)))
+        && (uwlkv_is_block_erased((uint8_t *)stored, sizeof(stored)) || (0 == memcmp(stored, counters, sizeof(stored))));
+}
+
+/**
+ * @brief	Reports erase counters and projects remaining lifetime against UWLKV_ENDURANCE.
+ *
+ * @param [in] 	store	The store.
+ * @param [out]	wear 	Counters and projection.
+ */
+void uwlkv_store_get_wear(uwlkv_store * store, uwlkv_wear * wear)
+{
+    uint32_t worn = 0;
+    for (uint8_t i = 0; i < UWLKV_WEAR_AREAS; i++)
+    {
+        wear->erases[i] = store->erases[i];
+        if (store->erases[i] > worn)
+        {
+            worn = store->erases[i];
+        }
+    }
+
+#ifdef UWLKV_HOT_COLD
+    const uwlkv_offset main_size = store->nvram.size - store->nvram.reserved - store->nvram.cold;
+#else
+    const uwlkv_offset main_size = store->nvram.size - store->nvram.reserved;
+#endif
+    const uwlkv_offset main_capacity = (main_size - UWLKV_METADATA_SIZE) / UWLKV_ENTRY_SIZE;
+    UWLKV_FINISH_INDEX(store);
+    const uwlkv_offset used_entries  = uwlkv_get_used_entries(store);
+
+    wear->writes           = store->writes;
+    wear->writes_per_erase = (main_capacity > used_entries) ? (main_capacity - used_entries) : 0;
+    wear->remaining_erases = (UWLKV_ENDURANCE > worn) ? (UWLKV_ENDURANCE - worn) : 0;
+
+    const uint64_t remaining_writes = (uint64_t)wear->remaining_erases * wear->writes_per_erase;
+    wear->remaining_writes = (remaining_writes > UINT32_MAX) ? UINT32_MAX : (uint32_t)remaining_writes;
+}
+
+/**
+ * @brief	Projects time left until UWLKV_ENDURANCE is reached with write rate observed since boot.
+ *
+ * @param 	wear  	Result of uwlkv_get_wear().
+ * @param 	uptime	Time since uwlkv_init() in any units.
+ *
+ * @returns	Time left in the same units, UINT32_MAX if nothing was written yet.
+ */
+uint32_t uwlkv_wear_time_left(const uwlkv_wear * wear, const uint32_t uptime)
+{
+    if (0 == wear->writes)
+    {
+        return UINT32_MAX;
+    }
+
+    const uint64_t time_left = (uint64_t)wear->remaining_writes * uptime / wear->writes;
+
+    return (time_left > UINT32_MAX) ? UINT32_MAX : (uint32_t)time_left;
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef UWLKV_WEAR_H
+#define UWLKV_WEAR_H
+
+#ifdef UWLKV_WEAR
+
+void uwlkv_wear_reset(uwlkv_store * store);
+void uwlkv_wear_erased(uwlkv_store * store, uwlkv_area area);
+void uwlkv_wear_written(uwlkv_store * store);
+void uwlkv_wear_load(uwlkv_store * store, uwlkv_offset metadata);
+void uwlkv_wear_store(uwlkv_store * store, uwlkv_offset metadata, uint8_t pending);
+uint8_t uwlkv_wear_writable(uwlkv_store * store, uwlkv_offset metadata, uint8_t pending);
+
+#define UWLKV_WEAR_PENDING(area)                      ((uint8_t)(1u << (area)))
+
+#define UWLKV_WEAR_RESET(store)                       uwlkv_wear_reset(store)
+#define UWLKV_WEAR_ERASED(store, area)                uwlkv_wear_erased((store), (area))
+#define UWLKV_WEAR_WRITTEN(store)                     uwlkv_wear_written(store)
+#define UWLKV_WEAR_LOAD(store, metadata)              uwlkv_wear_load((store), (metadata))
+#define UWLKV_WEAR_STORE(store, metadata, pending)    uwlkv_wear_store((store), (metadata), (pending))
+#define UWLKV_WEAR_WRITABLE(store, metadata, pending) uwlkv_wear_writable((store), (metadata), (pending))
+
+#else
+
+#define UWLKV_WEAR_RESET(store)                       ((void)0)
+#define UWLKV_WEAR_ERASED(store, area)                ((void)0)
+#define UWLKV_WEAR_WRITTEN(store)                     ((void)0)
+#define UWLKV_WEAR_LOAD(store, metadata)              ((void)0)
+#define UWLKV_WEAR_STORE(store, metadata, pending)    ((void)0)
+#define UWLKV_WEAR_WRITABLE(store, metadata, pending) (1)
+
+#endif
+
+#endif
@@ -0,0 +1,195 @@
+/* Microbenchmarks of core operations on emulated flash with zero access time, so results show
+ * CPU time of the library only. Each benchmark runs for every combination of NVRAM size (KiB)
+ * and number of stored keys, the executable is built once per configuration (UWLKV_MAX_ENTRIES
+ * values, UWLKV_CRC).
+ * Run with --benchmark_format=json or --benchmark_out=<file> to get machine-readable results.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "flash.h"
+#include "uwlkv.h"
+
+static const uwlkv_offset KIB           = 1024;
+static const size_t       SEQUENCE_SIZE = 4096;   /* Power of 2 */
+
+static uwlkv_nvram_interface nvram;
+static uwlkv_offset          capacity;
+static uwlkv_offset          keys;
+
+/** @brief	Returns the smallest reserved area, in whole KiB, which fits all keys. */
+static uwlkv_offset reserved_size(void)
+{
+    const uwlkv_offset bytes = (UWLKV_MAX_ENTRIES + 1) * UWLKV_ENTRY_SIZE + UWLKV_METADATA_SIZE;
+
+    return (bytes + KIB - 1) / KIB * KIB;
+}
+
+/**
+ * @brief	Initializes blank NVRAM of state.range(0) KiB and stores state.range(1) keys.
+ *
+ * @param [in]	state	Benchmark state.
+ *
+ * @returns	False if NVRAM can't fit UWLKV_MAX_ENTRIES, benchmark is skipped then.
+ */
+static bool prepare(benchmark::State & state)
+{
+    const uwlkv_offset size = (uwlkv_offset)state.range(0) * KIB;
+
+    flash_free();
+    if (flash_init(size, reserved_size(), 0, flash_find_part("instant"), 1))
+    {
+        state.SkipWithError("Out of memory");
+        return false;
+    }
+
+    flash_interface(&nvram);
+    capacity = uwlkv_init(&nvram);
+    if (0 == capacity)
+    {
+        state.SkipWithError("NVRAM is too small for UWLKV_MAX_ENTRIES");
+        return false;
+    }
+
+    keys = (uwlkv_offset)state.range(1);
+    for (uwlkv_offset key = 0; key < keys; key++)
+    {
+        uwlkv_set_value((uwlkv_key)key, (uwlkv_value)key);
+    }
+
+    state.counters["max_entries"] = UWLKV_MAX_ENTRIES;
+
+    return true;
+}
+
+/** @brief	Updates keys until main area is full, so the next write causes a wrap-around. */
+static void fill_main_area(void)
+{
+    for (uwlkv_offset written = keys; written < capacity; written++)
+    {
+        uwlkv_set_value((uwlkv_key)(written % keys), (uwlkv_value)written);
+    }
+}
+
+/** @brief	Returns stored keys in a pseudo-random order, so lookups don't favour any position. */
+static std::vector<uwlkv_key> key_sequence(void)
+{
+    std::vector<uwlkv_key> sequence(SEQUENCE_SIZE);
+    uint32_t random = 1;
+
+    for (size_t i = 0; i < SEQUENCE_SIZE; i++)
+    {
+        random      = random * 1103515245u + 12345u;
+        sequence[i] = (uwlkv_key)((random >> 16) % keys);
+    }
+
+    return sequence;
+}
+
+static void get_value(benchmark::State & state)
+{
+    if (!prepare(state))
+    {
+        return;
+    }
+
+    const std::vector<uwlkv_key> sequence = key_sequence();
+    size_t      i = 0;
+    uwlkv_value value;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(uwlkv_get_value(sequence[i++ & (SEQUENCE_SIZE - 1)], &value));
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+/* Amortized: includes wrap-arounds, which happen once per (capacity - keys) writes */
+static void set_value(benchmark::State & state)
+{
+    if (!prepare(state))
+    {
+        return;
+    }
+
+    const std::vector<uwlkv_key> sequence = key_sequence();
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(uwlkv_set_value(sequence[i & (SEQUENCE_SIZE - 1)], (uwlkv_value)i));
+        i++;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.counters["compactions"] = flash_get_traffic()->erases[UWLKV_MAIN];
+}
+
+/* The worst case of a clean boot: the whole main area has to be scanned */
+static void cold_boot(benchmark::State & state)
+{
+    if (!prepare(state))
+    {
+        return;
+    }
+
+    fill_main_area();
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(uwlkv_init(&nvram));
+    }
+}
+
+/* A write to full main area, which forces restart_map(). NVRAM image with full main area is
+ * restored and loaded before each iteration, outside of measured time */
+static void compaction(benchmark::State & state)
+{
+    if (!prepare(state))
+    {
+        return;
+    }
+
+    fill_main_area();
+    const size_t size = nvram.size;
+    std::vector<uint8_t> image(flash_memory(), flash_memory() + size);
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        memcpy(flash_memory(), image.data(), size);
+        uwlkv_init(&nvram);
+        state.ResumeTiming();
+
+        benchmark::DoNotOptimize(uwlkv_set_value(0, 0));
+    }
+}
+
+#ifdef UWLKV_CRC
+/* Checksum of an entry and of a larger buffer, where slice-by-8 steps dominate */
+static void crc32(benchmark::State & state)
+{
+    const std::vector<uint8_t> data((size_t)state.range(0), 0x5A);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(uwlkv_crc32(data.data(), (uint32_t)data.size()));
+    }
+
+    state.SetBytesProcessed((int64_t)(state.iterations() * data.size()));
+}
+BENCHMARK(crc32)->Arg(UWLKV_ENTRY_SIZE - UWLKV_CRC_SIZE)->Arg(256)->ArgName("bytes");
+#endif
+
+#define UWLKV_BENCHMARK(function)                                           \
+    BENCHMARK(function)                                                     \
+        ->ArgsProduct({ { 16, 64, 512 }, { 1, 16, UWLKV_MAX_ENTRIES } })    \
+        ->ArgNames({ "kib", "keys" })
+
+UWLKV_BENCHMARK(get_value);
+UWLKV_BENCHMARK(set_value);
+UWLKV_BENCHMARK(cold_boot);
+/* Setup of each iteration is much longer than measured part, so limit the number of them */
+UWLKV_BENCHMARK(compaction)->Iterations(200);
+
+BENCHMARK_MAIN();
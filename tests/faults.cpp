@@ -0,0 +1,226 @@
+/* Fault injection: power is cut at every NVRAM write and erase of a wrap-around in turn, and
+ * then once more at every write and erase of the recovery which follows. Each point is cut
+ * twice: before the operation reaches NVRAM and in the middle of it. After each cut the
+ * library boots again, all values are checked and the library is used further. For every cut
+ * point of the wrap-around the cost of recovery is reported: interface calls and host time.
+ * With UWLKV_EEPROM there is no wrap-around, the only cut points are the two writes of a slot.
+ * With UWLKV_WEAR erase counters must not go back after recovery either.
+ * Exit code is the number of lost or wrong values.
+ */
+
+#include <chrono>
+#include <map>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "nvram_mock.h"
+#include "uwlkv.h"
+
+static const uwlkv_key   PENDING_KEY   = 10;
+static const uwlkv_value PENDING_VALUE = 10000;
+
+static std::map<uwlkv_key, uwlkv_value> expected;
+static bool torn;
+#ifdef UWLKV_WEAR
+static uwlkv_wear worn;
+#endif
+
+static uwlkv_offset boot(void)
+{
+    uwlkv_nvram_interface interface;
+    interface.read          = &mock_flash_read;
+    interface.write         = &mock_flash_write;
+    interface.erase_main    = &mock_flash_erase_main;
+    interface.erase_reserve = &mock_flash_erase_reserve;
+    interface.size          = FLASH_REGION_SIZE;
+    interface.reserved      = FLASH_RESERVE_SIZE;
+#ifdef UWLKV_HOT_COLD
+    interface.erase_cold    = &mock_flash_erase_cold;
+    interface.cold          = FLASH_COLD_SIZE;
+#endif
+
+    return uwlkv_init(&interface);
+}
+
+/** @brief	Fills main area, so the next write starts a wrap-around. */
+static void prepare(void)
+{
+    mock_nvram_init();
+    const uwlkv_offset capacity = boot();
+#ifdef UWLKV_WEAR
+    /* Counters start above zero, so their reset by recovery shows up */
+    uwlkv_compact();
+#endif
+
+    expected.clear();
+    for (uwlkv_offset i = 0; i < capacity; i++)
+    {
+        const uwlkv_key key = (uwlkv_key)(i % UWLKV_MAX_ENTRIES);
+        uwlkv_set_value(key, (uwlkv_value)i);
+        expected[key] = (uwlkv_value)i;
+    }
+}
+
+/**
+ * @brief	Checks if a value of the interrupted write is fine. It may be either lost or done.
+ * 			Without UWLKV_CRC a torn entry can't be detected and its value is undefined.
+ */
+static bool pending_value_accepted(const uwlkv_value value)
+{
+#ifndef UWLKV_CRC
+    if (torn)
+    {
+        return true;
+    }
+#endif
+    return PENDING_VALUE == value;
+}
+
+/**
+ * @brief	Compares stored values to expected ones. The value of the interrupted write is
+ * 			expected from now on, if it's accepted.
+ *
+ * @returns	Number of lost or wrong values.
+ */
+static uint32_t verify(void)
+{
+    uint32_t errors = 0;
+    for (auto const& entry : expected)
+    {
+        uwlkv_value value;
+        const uwlkv_error ret = uwlkv_get_value(entry.first, &value);
+        if ((PENDING_KEY == entry.first) && (UWLKV_E_SUCCESS == ret) && pending_value_accepted(value))
+        {
+            expected[PENDING_KEY] = value;
+            continue;
+        }
+        if ((UWLKV_E_SUCCESS != ret) || (entry.second != value))
+        {
+            errors += 1;
+        }
+    }
+
+    return errors;
+}
+
+/**
+ * @brief	Compares erase counters to ones read before the cut. Recovery may only add erases.
+ *
+ * @returns	Number of counters which went back.
+ */
+static uint32_t verify_wear(void)
+{
+    uint32_t errors = 0;
+#ifdef UWLKV_WEAR
+    uwlkv_wear wear;
+    uwlkv_get_wear(&wear);
+    for (uint8_t i = 0; i < UWLKV_WEAR_AREAS; i++)
+    {
+        if (wear.erases[i] < worn.erases[i])
+        {
+            errors += 1;
+        }
+    }
+#endif
+
+    return errors;
+}
+
+/**
+ * @brief	Checks that the library keeps working after recovery: a value is updated until the
+ * 			next wrap-around and all values (and erase counters) survive a reboot.
+ *
+ * @returns	Number of lost or wrong values.
+ */
+static uint32_t use_after_recovery(const uwlkv_offset capacity)
+{
+    for (uwlkv_offset i = 0; i <= capacity; i++)
+    {
+        if (UWLKV_E_SUCCESS == uwlkv_set_value(0, (uwlkv_value)i))
+        {
+            expected[0] = (uwlkv_value)i;
+        }
+    }
+
+    boot();
+    return verify() + verify_wear();
+}
+
+/** @brief	Starts a wrap-around, which loses power at the given NVRAM operation. */
+static bool interrupt_wrap(const uint32_t operation)
+{
+    prepare();
+#ifdef UWLKV_WEAR
+    uwlkv_get_wear(&worn);
+#endif
+    mock_nvram_cut_power(operation, torn);
+    uwlkv_set_value(PENDING_KEY, PENDING_VALUE);
+
+    return !mock_nvram_powered();
+}
+
+int main(void)
+{
+    uint32_t errors = 0;
+    uint32_t checks = 0;
+
+    printf("%-4s %-5s %-20s %6s %6s %6s %6s %6s %10s\n",
+           "cut", "mode", "operation", "reads", "writes", "main", "resrv", "cold", "time_us");
+
+    for (int mode = 0; mode < 2; mode++)
+    {
+        torn = (1 == mode);
+        for (uint32_t cut = 1; interrupt_wrap(cut); cut++)
+        {
+            /* Recovery cost: interface calls and host time of a boot after the cut */
+            mock_nvram_cut_power(0, torn);
+            mock_flash_reset_reads();
+            const mock_nvram_traffic before  = mock_nvram_get_traffic();
+            const auto               started = std::chrono::steady_clock::now();
+            const uwlkv_offset       capacity = boot();
+            const auto               elapsed = std::chrono::steady_clock::now() - started;
+            const mock_nvram_traffic after   = mock_nvram_get_traffic();
+
+            const uint32_t failed = verify() + verify_wear() + use_after_recovery(capacity);
+            errors += failed;
+            checks += 1;
+
+            printf("%-4u %-5s %-20s %6u %6u %6u %6u %6u %10.1f%s\n", (unsigned)cut,
+                   torn ? "torn" : "lost", mock_nvram_cut_operation(),
+                   (unsigned)after.reads, (unsigned)(after.writes - before.writes),
+                   (unsigned)(after.erases[MAIN_AREA]     - before.erases[MAIN_AREA]),
+                   (unsigned)(after.erases[RESERVED_AREA] - before.erases[RESERVED_AREA]),
+                   (unsigned)(after.erases[COLD_AREA]     - before.erases[COLD_AREA]),
+                   std::chrono::duration<double, std::micro>(elapsed).count(),
+                   failed ? "  FAILED" : "");
+
+            /* Repeated brown-out: the recovery itself is cut at each of its operations */
+            for (uint32_t recovery_cut = 1; ; recovery_cut++)
+            {
+                interrupt_wrap(cut);
+                mock_nvram_cut_power(recovery_cut, torn);
+                boot();
+                if (mock_nvram_powered())
+                {
+                    break;
+                }
+
+                mock_nvram_cut_power(0, torn);
+                const uwlkv_offset recovered = boot();
+                const uint32_t     failed    = verify() + verify_wear() + use_after_recovery(recovered);
+                errors += failed;
+                checks += 1;
+
+                if (failed)
+                {
+                    printf("%-4u %-5s %-20s FAILED at recovery cut %u\n", (unsigned)cut,
+                           torn ? "torn" : "lost", mock_nvram_cut_operation(), (unsigned)recovery_cut);
+                }
+            }
+        }
+    }
+
+    printf("checks %u, errors %u\n", (unsigned)checks, (unsigned)errors);
+
+    return (int)errors;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+/* Key registry of tests built with UWLKV_KEYS_FILE. Tests use keys from 0 to UWLKV_MAX_ENTRIES - 1 */
+#define UWLKV_KEYS(X)           \
+    X(BRIGHTNESS,     0)        \
+    X(VOLUME,         1)        \
+    X(CHANNEL,        2)        \
+    X(PARAMETER_3,    3)        \
+    X(PARAMETER_4,    4)        \
+    X(PARAMETER_5,    5)        \
+    X(PARAMETER_6,    6)        \
+    X(PARAMETER_7,    7)        \
+    X(PARAMETER_8,    8)        \
+    X(PARAMETER_9,    9)        \
+    X(PARAMETER_10,   10)       \
+    X(PARAMETER_11,   11)       \
+    X(PARAMETER_12,   12)       \
+    X(PARAMETER_13,   13)       \
+    X(PARAMETER_14,   14)       \
+    X(PARAMETER_15,   15)       \
+    X(PARAMETER_16,   16)       \
+    X(PARAMETER_17,   17)       \
+    X(PARAMETER_18,   18)       \
+    X(BOOT_COUNT,     19)
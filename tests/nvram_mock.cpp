@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <malloc.h>
@@ -6,15 +7,27 @@
 #include "nvram_mock.h"
 
 static uint8_t flash_memory[FLASH_REGION_SIZE];
-static mock_nvram_erase main_erase_status, reserve_erase_status;
+static mock_nvram_erase main_erase_status, reserve_erase_status, cold_erase_status;
 static bool write_enabled = true;
+static uint32_t reads_number;
+static uint32_t writes_number;
+static uint32_t erases_number[3];
+static uint32_t operations_to_cut;
+static bool cut_tears = true;
+static bool powered = true;
+static char cut_operation[32];
 
 void mock_nvram_init(void)
 {
 	memset(flash_memory, 0xFF, FLASH_REGION_SIZE); 
+	memset(erases_number, 0, sizeof(erases_number));
+	writes_number = 0;
+	mock_nvram_cut_power(0, false);
+	cut_operation[0] = '\0';
 
 	main_erase_status = ERASE_ENABLED;
 	reserve_erase_status = ERASE_ENABLED;
+	cold_erase_status = ERASE_ENABLED;
 }
 
 int mock_flash_read(uint8_t * data, uint32_t start, uint32_t length)
@@ -25,9 +38,78 @@ int mock_flash_read(uint8_t * data, uint32_t start, uint32_t length)
 	}
 
 	memcpy(data, flash_memory + start, length);
+	reads_number += 1;
 	return 0;
 }
 
+// Number of `mock_flash_read()` calls since the last reset
+uint32_t mock_flash_get_reads(void)
+{
+	return reads_number;
+}
+
+void mock_flash_reset_reads(void)
+{
+	reads_number = 0;
+}
+
+// Number of erase calls of given area since `mock_nvram_init()`
+uint32_t mock_flash_get_erases(mock_nvram_area area)
+{
+	return erases_number[area];
+}
+
+// Interface calls since `mock_nvram_init()`, reads since the last reset
+mock_nvram_traffic mock_nvram_get_traffic(void)
+{
+	mock_nvram_traffic traffic;
+	traffic.reads  = reads_number;
+	traffic.writes = writes_number;
+	memcpy(traffic.erases, erases_number, sizeof(traffic.erases));
+
+	return traffic;
+}
+
+// Power is lost at the given write or erase call, counting from now. If `torn`, the write is
+// done for the first half of data and the erase for the first half of an area, otherwise the
+// call doesn't reach NVRAM at all. All later writes and erases are lost until power is restored
+// by `mock_nvram_cut_power(0, ...)`, which keeps the description of the last cut.
+void mock_nvram_cut_power(uint32_t operation, bool torn)
+{
+	operations_to_cut = operation;
+	cut_tears = torn;
+	powered = true;
+}
+
+bool mock_nvram_powered(void)
+{
+	return powered;
+}
+
+// Description of the operation interrupted by power loss
+const char * mock_nvram_cut_operation(void)
+{
+	return cut_operation;
+}
+
+// Counts a write or erase call. Returns the number of bytes which reach NVRAM
+static uint32_t supply_power(uint32_t length, const char * operation, uint32_t start)
+{
+	if (!powered)
+	{
+		return 0;
+	}
+
+	if (operations_to_cut && (0 == --operations_to_cut))
+	{
+		powered = false;
+		snprintf(cut_operation, sizeof(cut_operation), "%s %u", operation, (unsigned)start);
+		return cut_tears ? length / 2 : 0;
+	}
+
+	return length;
+}
+
 int mock_flash_write(uint8_t * data, uint32_t start, uint32_t length)
 {
 	if (!write_enabled) {
@@ -39,10 +121,11 @@ int mock_flash_write(uint8_t * data, uint32_t start, uint32_t length)
 		return 1;
 	}
 
+#ifndef UWLKV_EEPROM
 	/* Real flash memory should be erased before writing. To simulate this,
 	 * we temporarily read a requested block and check that it filled with 0xFF */
 	uint8_t * tmp_data = (uint8_t *)alloca(length);
-	mock_flash_read(tmp_data, start, length);
+	memcpy(tmp_data, flash_memory + start, length);
 	for (uint32_t i = 0; i < length; i++)
 	{
 		if (tmp_data[i] != 0xFF) 
@@ -50,9 +133,12 @@ int mock_flash_write(uint8_t * data, uint32_t start, uint32_t length)
 			return 2;
 		}
 	}
+#endif
 
-	memcpy(flash_memory + start, data, length);
-	return 0;
+	writes_number += 1;
+	const uint32_t written = supply_power(length, "write", start);
+	memcpy(flash_memory + start, data, written);
+	return (written == length) ? 0 : 3;
 }
 
 // Prohibits write operations by `mock_flash_write()`. It will always return an error.
@@ -68,23 +154,41 @@ void mock_nvram_enable_write(void)
 
 int mock_flash_erase_main(void)
 {
+	erases_number[MAIN_AREA] += 1;
+	const uint32_t erased = supply_power(FLASH_MAIN_SIZE, "erase main", 0);
 	if (ERASE_ENABLED == main_erase_status)
 	{
-		memset(flash_memory, 0xFF, FLASH_REGION_SIZE - FLASH_RESERVE_SIZE); 
+		memset(flash_memory, 0xFF, erased); 
 	}
 
-	return 0;
+	return (erased == FLASH_MAIN_SIZE) ? 0 : 3;
 }
 
+#ifdef UWLKV_HOT_COLD
+int mock_flash_erase_cold(void)
+{
+	erases_number[COLD_AREA] += 1;
+	const uint32_t erased = supply_power(FLASH_COLD_SIZE, "erase cold", FLASH_MAIN_SIZE);
+	if (ERASE_ENABLED == cold_erase_status)
+	{
+		memset(flash_memory + FLASH_MAIN_SIZE, 0xFF, erased); 
+	}
+
+	return (erased == FLASH_COLD_SIZE) ? 0 : 3;
+}
+#endif
+
 int mock_flash_erase_reserve(void)
 {
+	erases_number[RESERVED_AREA] += 1;
+	const uint32_t erased = supply_power(FLASH_RESERVE_SIZE, "erase reserved", FLASH_REGION_SIZE - FLASH_RESERVE_SIZE);
 	if (ERASE_ENABLED == reserve_erase_status)
 	{
 		memset(flash_memory + (FLASH_REGION_SIZE - FLASH_RESERVE_SIZE), 
-			0xFF, FLASH_RESERVE_SIZE); 
+			0xFF, erased); 
 	}
 
-	return 0;
+	return (erased == FLASH_RESERVE_SIZE) ? 0 : 3;
 }
 
 void mock_flash_set(mock_nvram_area area, uint32_t offset, uint8_t value)
@@ -93,6 +197,10 @@ void mock_flash_set(mock_nvram_area area, uint32_t offset, uint8_t value)
 	{
 		offset += FLASH_REGION_SIZE - FLASH_RESERVE_SIZE;
 	}
+	else if (COLD_AREA == area)
+	{
+		offset += FLASH_MAIN_SIZE;
+	}
 
 	flash_memory[offset] = value;
 }
@@ -105,7 +213,12 @@ void mock_flash_fill_with_random(mock_nvram_area area)
 	if (MAIN_AREA == area)
 	{
 		offset = 0;
-		end = FLASH_REGION_SIZE - FLASH_RESERVE_SIZE;
+		end = FLASH_MAIN_SIZE;
+	}
+	else if (COLD_AREA == area)
+	{
+		offset = FLASH_MAIN_SIZE;
+		end = FLASH_MAIN_SIZE + FLASH_COLD_SIZE;
 	}
 	else
 	{
@@ -125,6 +238,10 @@ void mock_flash_set_erase(mock_nvram_area area, mock_nvram_erase state)
 	{
 		main_erase_status = state;
 	}
+	else if (COLD_AREA == area)
+	{
+		cold_erase_status = state;
+	}
 	else
 	{
 		reserve_erase_status = state;
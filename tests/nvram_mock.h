@@ -1,12 +1,22 @@
 #pragma once
 
-#define FLASH_REGION_SIZE     (512)
+#if defined(UWLKV_HOT_COLD) && defined(UWLKV_CRC)
+/* Checksummed entries are larger, cold area still has to fit all keys */
+#define FLASH_COLD_SIZE       (192)
+#elif defined(UWLKV_HOT_COLD)
+#define FLASH_COLD_SIZE       (128)
+#else
+#define FLASH_COLD_SIZE       (0)
+#endif
+#define FLASH_REGION_SIZE     (512 + FLASH_COLD_SIZE)
 #define FLASH_RESERVE_SIZE    (256)
+#define FLASH_MAIN_SIZE       (FLASH_REGION_SIZE - FLASH_RESERVE_SIZE - FLASH_COLD_SIZE)
 
 typedef enum
 {
     MAIN_AREA,
-    RESERVED_AREA
+    RESERVED_AREA,
+    COLD_AREA
 } mock_nvram_area;
 
 typedef enum
@@ -15,15 +25,32 @@ typedef enum
     ERASE_ENABLED
 } mock_nvram_erase;
 
+typedef struct
+{
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t erases[3];             /* By mock_nvram_area */
+} mock_nvram_traffic;
+
 void mock_nvram_init(void);
 
 int mock_flash_read(uint8_t * data, uint32_t start, uint32_t length);
 int mock_flash_write(uint8_t * data, uint32_t start, uint32_t length);
+uint32_t mock_flash_get_reads(void);
+void mock_flash_reset_reads(void);
 void mock_nvram_disable_write(void); 
 void mock_nvram_enable_write(void);
 int mock_flash_erase_main(void);
 int mock_flash_erase_reserve(void);
+#ifdef UWLKV_HOT_COLD
+int mock_flash_erase_cold(void);
+#endif
 
 void mock_flash_set(mock_nvram_area area, uint32_t offset, uint8_t value);
 void mock_flash_fill_with_random(mock_nvram_area area);
 void mock_flash_set_erase(mock_nvram_area area, mock_nvram_erase state);
+uint32_t mock_flash_get_erases(mock_nvram_area area);
+mock_nvram_traffic mock_nvram_get_traffic(void);
+void mock_nvram_cut_power(uint32_t operation, bool torn);
+bool mock_nvram_powered(void);
+const char * mock_nvram_cut_operation(void);
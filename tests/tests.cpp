@@ -5,6 +5,7 @@
 
 #include "nvram_mock.h"
 #include "uwlkv.h"
+#include "uwlkv.hpp"
 
 inline std::ostream &operator<<(std::ostream &os, uwlkv_error e)
 {
@@ -22,6 +23,14 @@ inline std::ostream &operator<<(std::ostream &os, uwlkv_error e)
         return os << "No free space in map for new entry";
     case UWLKV_E_WRONG_OFFSET:
         return os << "Provided offset is out of NVRAM bounds";
+    case UWLKV_E_RESERVED_KEY:
+        return os << "Key is reserved by library";
+    case UWLKV_E_UNKNOWN_KEY:
+        return os << "Key is not listed in UWLKV_KEYS";
+    case UWLKV_E_CORRUPTED:
+        return os << "Entry checksum doesn't match its content";
+    case UWLKV_E_LAYOUT:
+        return os << "NVRAM layout can't be migrated";
     default:
         return os << "uwlkv_error(" << e << ")";
     }
@@ -30,7 +39,7 @@ inline std::ostream &operator<<(std::ostream &os, uwlkv_error e)
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/generators/catch_generators.hpp>
 
-uwlkv_offset init_uwlkv(uwlkv_offset size, uwlkv_offset reserved)
+uwlkv_nvram_interface mock_interface(uwlkv_offset size, uwlkv_offset reserved)
 {
     uwlkv_nvram_interface interface;
     interface.read          = &mock_flash_read;
@@ -42,6 +51,10 @@ uwlkv_offset init_uwlkv(uwlkv_offset size, uwlkv_offset reserved)
      * only for test purposes */
     interface.size 	        = FLASH_REGION_SIZE;
     interface.reserved      = FLASH_RESERVE_SIZE;
+#ifdef UWLKV_HOT_COLD
+    interface.erase_cold    = &mock_flash_erase_cold;
+    interface.cold          = FLASH_COLD_SIZE;
+#endif
 
     if (size)
     {
@@ -55,9 +68,27 @@ uwlkv_offset init_uwlkv(uwlkv_offset size, uwlkv_offset reserved)
                             ? reserved :  FLASH_RESERVE_SIZE;
     }
     
+    return interface;
+}
+
+uwlkv_offset init_uwlkv(uwlkv_offset size, uwlkv_offset reserved)
+{
+    const auto interface = mock_interface(size, reserved);
+
     return uwlkv_init(&interface);
 }
 
+/* Serializes an entry the same way as the library, for tests which write NVRAM directly */
+void encode_entry(uint8_t * block, uwlkv_key key, uwlkv_value value)
+{
+    memcpy(block, &key, sizeof(key));
+    memcpy(block + sizeof(key), &value, sizeof(value));
+#ifdef UWLKV_CRC
+    const auto crc = (uwlkv_crc)uwlkv_crc32(block, sizeof(key) + sizeof(value));
+    memcpy(block + sizeof(key) + sizeof(value), &crc, sizeof(crc));
+#endif
+}
+
 uwlkv_offset erase_nvram(uwlkv_offset size, uwlkv_offset reserved)
 {
     mock_nvram_init();
@@ -70,7 +101,11 @@ TEST_CASE("Initialization", "[init]")
     auto ret = erase_nvram(100, 90);
     CHECK(0 == ret);
     ret = init_uwlkv(0, 0);
-    CHECK(((FLASH_REGION_SIZE - FLASH_RESERVE_SIZE) / UWLKV_ENTRY_SIZE) == ret);
+#ifdef UWLKV_EEPROM
+    CHECK((UWLKV_MAX_ENTRIES * ((FLASH_REGION_SIZE - UWLKV_METADATA_SIZE) / UWLKV_MAX_ENTRIES / UWLKV_ENTRY_SIZE)) == ret);
+#else
+    CHECK(((FLASH_MAIN_SIZE - UWLKV_METADATA_SIZE) / UWLKV_ENTRY_SIZE) == ret);
+#endif
 
     auto entries = uwlkv_get_entries_number();
     CHECK(0 == entries);
@@ -82,7 +117,11 @@ TEST_CASE("Writing and reading values", "[read_write]")
 {
     SECTION("Easy values")
     {
+#ifdef UWLKV_KEYS
+        auto test_key   = GENERATE(as<uwlkv_key>{}, UWLKV_KEY_BRIGHTNESS, UWLKV_KEY_PARAMETER_10, UWLKV_KEY_PARAMETER_18, UWLKV_KEY_BOOT_COUNT);
+#else
         auto test_key   = GENERATE(as<uwlkv_key>{}, 0, 10, 100, 40000);
+#endif
         auto test_value = GENERATE(100, 1000, 65000, 0);
 
         auto ret = uwlkv_set_value(test_key, test_value);
@@ -137,8 +176,31 @@ TEST_CASE("Writing and reading values", "[read_write]")
         CHECK(UWLKV_E_SUCCESS == ret);
         // New one
         ret = uwlkv_set_value(UWLKV_MAX_ENTRIES, test_value);
+#ifdef UWLKV_KEYS
+        CHECK(UWLKV_E_UNKNOWN_KEY == ret);
+#else
         CHECK(UWLKV_E_NO_SPACE == ret);
+#endif
+    }
+
+#ifndef UWLKV_KEYS
+    SECTION("Refused write takes no block")
+    {
+        erase_nvram(0, 0);
+        for (uwlkv_key key = 0; key < UWLKV_MAX_ENTRIES; key++)
+        {
+            uwlkv_set_value(key, key);
+        }
+        CHECK(UWLKV_E_NO_SPACE == uwlkv_set_value(UWLKV_MAX_ENTRIES, 1));
+
+        // The next write goes right after the last entry, so it is found after a reboot
+        CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(1, 111));
+        init_uwlkv(0, 0);
+        uwlkv_value value;
+        CHECK(UWLKV_E_SUCCESS == uwlkv_get_value(1, &value));
+        CHECK(111 == value);
     }
+#endif
 }
 
 uint8_t compare_stored_values(std::map<uwlkv_key, uwlkv_value> &map)
@@ -197,6 +259,7 @@ TEST_CASE("Data wraps", "[wraps]")
         CHECK(0 == compare_stored_values(values));
     }
 
+#ifndef UWLKV_EEPROM
     SECTION("Interrupted erase of main area")
     {
         mock_flash_set_erase(RESERVED_AREA, ERASE_DISABLED);
@@ -211,6 +274,19 @@ TEST_CASE("Data wraps", "[wraps]")
         CHECK(0 == compare_stored_values(values));
     }
 
+    SECTION("Power loss after erase of main area")
+    {
+        mock_flash_set_erase(RESERVED_AREA, ERASE_DISABLED);
+        uwlkv_set_value(10, 10000);
+
+        mock_flash_set_erase(RESERVED_AREA, ERASE_ENABLED);
+        mock_flash_erase_main();
+        mock_flash_set(RESERVED_AREA, UWLKV_O_ERASE_FINISHED, UWLKV_ERASED_BYTE_VALUE);
+
+        init_uwlkv(0, 0);
+        CHECK(0 == compare_stored_values(values));
+    }
+
     SECTION("Interrupted erase of reserved area")
     {
         mock_flash_fill_with_random(RESERVED_AREA);
@@ -251,6 +327,7 @@ TEST_CASE("Data wraps", "[wraps]")
         init_uwlkv(0, 0);
         CHECK(0 == compare_stored_values(values));
     }
+#endif
 
     // Finally making sure that library works normally after recovery
     fill_main(values, UWLKV_MAX_ENTRIES, 100);
@@ -262,4 +339,1512 @@ TEST_CASE("Data wraps", "[wraps]")
     CHECK(0 == compare_stored_values(values));
     init_uwlkv(0, 0);
     CHECK(0 == compare_stored_values(values));
-}
\ No newline at end of file
+}
+
+TEST_CASE("Lookups after wraps", "[lookup]")
+{
+    const auto capacity = erase_nvram(0, 0);
+    std::map<uwlkv_key, uwlkv_value> values;
+
+    // Keys are written in descending order, so compaction has to reorder them
+    for (uwlkv_offset i = 0; i < (capacity * 3); i++)
+    {
+        const uwlkv_key   key   = (uwlkv_key)(UWLKV_MAX_ENTRIES - 1 - (i % UWLKV_MAX_ENTRIES));
+        const uwlkv_value value = (uwlkv_value)i;
+        CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(key, value));
+        values[key] = value;
+    }
+    CHECK(0 == compare_stored_values(values));
+
+    uwlkv_value value;
+#ifdef UWLKV_KEYS
+    CHECK(UWLKV_E_UNKNOWN_KEY == uwlkv_get_value(UWLKV_MAX_ENTRIES, &value));
+#else
+    CHECK(UWLKV_E_NOT_EXIST == uwlkv_get_value(UWLKV_MAX_ENTRIES, &value));
+#endif
+
+    init_uwlkv(0, 0);
+    CHECK(0 == compare_stored_values(values));
+    CHECK(UWLKV_MAX_ENTRIES == uwlkv_get_entries_number());
+
+#ifdef UWLKV_RAMLESS
+    // Compacted entries form a sorted prefix of main area
+    uwlkv_key previous = 0;
+    for (uwlkv_key i = 0; i < UWLKV_MAX_ENTRIES; i++)
+    {
+        uint8_t block[UWLKV_ENTRY_SIZE];
+        mock_flash_read(block, (uint32_t)(UWLKV_METADATA_SIZE + i * UWLKV_ENTRY_SIZE), UWLKV_ENTRY_SIZE);
+        uwlkv_key key;
+        memcpy(&key, block, sizeof(key));
+        if (i > 0)
+        {
+            CHECK(key > previous);
+        }
+        previous = key;
+    }
+#endif
+}
+
+TEST_CASE("Deleting values", "[delete]")
+{
+    const auto capacity = erase_nvram(0, 0);
+    std::map<uwlkv_key, uwlkv_value> values;
+    fill_main(values, UWLKV_MAX_ENTRIES, 0);
+
+    uwlkv_value value;
+    CHECK(UWLKV_E_RESERVED_KEY == uwlkv_set_value(UWLKV_TOMBSTONE_KEY, 1));
+    CHECK(UWLKV_E_RESERVED_KEY == uwlkv_get_value(UWLKV_TOMBSTONE_KEY, &value));
+    CHECK(UWLKV_E_RESERVED_KEY == uwlkv_delete_value(UWLKV_TOMBSTONE_KEY));
+
+    CHECK(UWLKV_E_SUCCESS == uwlkv_delete_value(5));
+    values.erase(5);
+    CHECK(UWLKV_E_NOT_EXIST == uwlkv_get_value(5, &value));
+    CHECK(UWLKV_E_NOT_EXIST == uwlkv_delete_value(5));
+    CHECK((UWLKV_MAX_ENTRIES - 1) == uwlkv_get_entries_number());
+    CHECK(1 == uwlkv_get_free_entries());
+    CHECK(0 == compare_stored_values(values));
+
+#ifndef UWLKV_KEYS
+    SECTION("Freed key is reused")
+    {
+        CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(UWLKV_MAX_ENTRIES, 1));
+        values[UWLKV_MAX_ENTRIES] = 1;
+        CHECK(UWLKV_E_NO_SPACE == uwlkv_set_value(5, 1));
+    }
+#endif
+
+    SECTION("Deleted key is set again")
+    {
+        CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(5, 1));
+        values[5] = 1;
+    }
+
+    SECTION("Deletion survives restart")
+    {
+        init_uwlkv(0, 0);
+        CHECK(UWLKV_E_NOT_EXIST == uwlkv_get_value(5, &value));
+        CHECK((UWLKV_MAX_ENTRIES - 1) == uwlkv_get_entries_number());
+    }
+
+    SECTION("Failed delete")
+    {
+        mock_nvram_disable_write();
+        CHECK(UWLKV_E_NVRAM_ERROR == uwlkv_delete_value(6));
+        mock_nvram_enable_write();
+        CHECK(UWLKV_E_SUCCESS == uwlkv_get_value(6, &value));
+    }
+    CHECK(0 == compare_stored_values(values));
+
+    // Wrap-around drops deleted key, so only remaining ones are copied
+    for (uwlkv_offset i = 0; i < capacity; i++)
+    {
+        CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(0, (uwlkv_value)i));
+        values[0] = (uwlkv_value)i;
+    }
+    init_uwlkv(0, 0);
+    CHECK(0 == compare_stored_values(values));
+    CHECK(values.size() == uwlkv_get_entries_number());
+    if (values.find(5) == values.end())
+    {
+        CHECK(UWLKV_E_NOT_EXIST == uwlkv_get_value(5, &value));
+    }
+}
+
+#ifndef UWLKV_EEPROM
+TEST_CASE("Compaction on request", "[compact]")
+{
+    const auto capacity = erase_nvram(0, 0);
+    std::map<uwlkv_key, uwlkv_value> values;
+    fill_main(values, capacity / 2, 0);
+    CHECK(UWLKV_E_SUCCESS == uwlkv_delete_value(5));
+    values.erase(5);
+
+    const auto erases = mock_flash_get_erases(MAIN_AREA);
+    CHECK(UWLKV_E_SUCCESS == uwlkv_compact());
+    CHECK((erases + 1) == mock_flash_get_erases(MAIN_AREA));
+    CHECK(0 == compare_stored_values(values));
+    CHECK(values.size() == uwlkv_get_entries_number());
+
+    // Only live entries are left, the rest of main area is available before the next wrap-around
+    for (uwlkv_offset i = 0; i < (capacity - values.size()); i++)
+    {
+        CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(0, (uwlkv_value)i));
+        values[0] = (uwlkv_value)i;
+    }
+    CHECK((erases + 1) == mock_flash_get_erases(MAIN_AREA));
+
+    init_uwlkv(0, 0);
+    CHECK(0 == compare_stored_values(values));
+    uwlkv_value value;
+    CHECK(UWLKV_E_NOT_EXIST == uwlkv_get_value(5, &value));
+}
+#endif
+
+int collect_value(uwlkv_key key, uwlkv_value value, void * context)
+{
+    auto &collected = *static_cast<std::map<uwlkv_key, uwlkv_value> *>(context);
+    collected[key] = value;
+
+    return 0;
+}
+
+int stop_after_first(uwlkv_key, uwlkv_value, void * context)
+{
+    *static_cast<int *>(context) += 1;
+
+    return 1;
+}
+
+TEST_CASE("Iterating over values", "[foreach]")
+{
+    const auto capacity = erase_nvram(0, 0);
+    std::map<uwlkv_key, uwlkv_value> values;
+    std::map<uwlkv_key, uwlkv_value> collected;
+
+    CHECK(UWLKV_E_SUCCESS == uwlkv_foreach(&collect_value, &collected));
+    CHECK(collected.empty());
+
+    fill_main(values, capacity + UWLKV_MAX_ENTRIES, 0);
+    uwlkv_delete_value(3);
+    values.erase(3);
+
+    mock_flash_reset_reads();
+    CHECK(UWLKV_E_SUCCESS == uwlkv_foreach(&collect_value, &collected));
+    CHECK(collected == values);
+#if !defined(UWLKV_RAMLESS) && !defined(UWLKV_EEPROM)
+    // Entries written one after another are fetched in bulk
+    CHECK(mock_flash_get_reads() <= ((UWLKV_MAX_ENTRIES / UWLKV_SCAN_ENTRIES) + 2));
+#endif
+
+    int visited = 0;
+    CHECK(UWLKV_E_SUCCESS == uwlkv_foreach(&stop_after_first, &visited));
+    CHECK(1 == visited);
+}
+
+#ifdef UWLKV_LAZY_INIT
+TEST_CASE("Lazy initialization", "[lazy]")
+{
+    const auto capacity = erase_nvram(0, 0);
+    std::map<uwlkv_key, uwlkv_value> values;
+    fill_main(values, capacity * 2 + capacity / 2, 0);
+    CHECK(UWLKV_E_SUCCESS == uwlkv_delete_value(3));
+    values.erase(3);
+
+    mock_flash_reset_reads();
+    init_uwlkv(0, 0);
+    const auto eager_reads = mock_flash_get_reads();
+
+    // Only ends of areas are searched for
+    const auto interface = mock_interface(0, 0);
+    mock_flash_reset_reads();
+    CHECK(capacity == uwlkv_init_lazy(&interface));
+    CHECK(mock_flash_get_reads() < eager_reads / 2);
+
+    uwlkv_value value;
+    CHECK(0 == compare_stored_values(values));
+    CHECK(UWLKV_E_NOT_EXIST == uwlkv_get_value(3, &value));
+
+    SECTION("Map is built in steps")
+    {
+        auto left = uwlkv_init_step(0);
+        CHECK(0 < left);
+        while (left)
+        {
+            const auto next = uwlkv_init_step(1);
+            CHECK(next < left);
+            CHECK(0 == compare_stored_values(values));
+            CHECK(UWLKV_E_NOT_EXIST == uwlkv_get_value(3, &value));
+            left = next;
+        }
+        CHECK(values.size() == uwlkv_get_entries_number());
+    }
+
+    SECTION("Write completes the map")
+    {
+        CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(3, 33));
+        values[3] = 33;
+        CHECK(0 == uwlkv_init_step(0));
+        CHECK(0 == compare_stored_values(values));
+        CHECK(values.size() == uwlkv_get_entries_number());
+    }
+
+    // The map built in steps is the same as the one built at once
+    fill_main(values, capacity, 100);
+    init_uwlkv(0, 0);
+    CHECK(0 == compare_stored_values(values));
+    CHECK(values.size() == uwlkv_get_entries_number());
+}
+#endif
+
+#ifdef UWLKV_HOT_COLD
+TEST_CASE("Hot and cold entries", "[hot_cold]")
+{
+    const auto capacity = erase_nvram(0, 0);
+    const auto cold_erases = mock_flash_get_erases(COLD_AREA);
+    std::map<uwlkv_key, uwlkv_value> values;
+
+    // Only key 0 changes, others are written once and should stay in cold area
+    for (uwlkv_key key = 1; key < UWLKV_MAX_ENTRIES; key++)
+    {
+        uwlkv_set_value(key, key);
+        values[key] = key;
+    }
+    fill_main(values, 0, 0);
+    for (uwlkv_offset i = 0; i < (capacity * 4); i++)
+    {
+        uwlkv_set_value(0, (uwlkv_value)i);
+        values[0] = (uwlkv_value)i;
+    }
+    CHECK(0 == compare_stored_values(values));
+    CHECK(cold_erases == mock_flash_get_erases(COLD_AREA));
+    CHECK(mock_flash_get_erases(MAIN_AREA) >= 4);
+
+    // Cold entries don't occupy main area, so wraps are rarer than without cold area
+    const auto main_erases = mock_flash_get_erases(MAIN_AREA);
+    for (uwlkv_offset i = 0; i < (capacity - 2); i++)
+    {
+        uwlkv_set_value(0, (uwlkv_value)i);
+        values[0] = (uwlkv_value)i;
+    }
+    CHECK(mock_flash_get_erases(MAIN_AREA) <= (main_erases + 1));
+
+    SECTION("Cold key becomes hot")
+    {
+        for (uwlkv_offset i = 0; i < (capacity * 2); i++)
+        {
+            uwlkv_set_value(5, (uwlkv_value)i);
+            values[5] = (uwlkv_value)i;
+        }
+    }
+
+    SECTION("Deleted cold key stays deleted")
+    {
+        CHECK(UWLKV_E_SUCCESS == uwlkv_delete_value(7));
+        values.erase(7);
+        for (uwlkv_offset i = 0; i < (capacity * 2); i++)
+        {
+            uwlkv_set_value(0, (uwlkv_value)i);
+            values[0] = (uwlkv_value)i;
+        }
+        init_uwlkv(0, 0);
+
+        uwlkv_value value;
+        CHECK(UWLKV_E_NOT_EXIST == uwlkv_get_value(7, &value));
+    }
+
+    SECTION("Key deleted by a wrap-around stays deleted")
+    {
+        // Key 5 is in cold area and gets a newer value, which stays hot in the next wrap-around
+        CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(5, 222));
+        const auto erases = mock_flash_get_erases(MAIN_AREA);
+        for (uwlkv_offset i = 0; erases == mock_flash_get_erases(MAIN_AREA); i++)
+        {
+            uwlkv_set_value(0, (uwlkv_value)i);
+            values[0] = (uwlkv_value)i;
+        }
+
+        // Main area is filled, so the tombstone starts a wrap-around, which must not move key 5
+        const auto last_block = (uint32_t)(UWLKV_METADATA_SIZE
+                              + ((FLASH_MAIN_SIZE - UWLKV_METADATA_SIZE) / UWLKV_ENTRY_SIZE - 1) * UWLKV_ENTRY_SIZE);
+        const auto main_full = [last_block]()
+        {
+            uint8_t block[UWLKV_ENTRY_SIZE];
+            mock_flash_read(block, last_block, UWLKV_ENTRY_SIZE);
+            for (auto byte : block)
+            {
+                if (UWLKV_ERASED_BYTE_VALUE != byte)
+                {
+                    return true;
+                }
+            }
+            return false;
+        };
+        for (uwlkv_value i = 0; !main_full(); i++)
+        {
+            uwlkv_set_value(0, i);
+            values[0] = i;
+        }
+        CHECK(UWLKV_E_SUCCESS == uwlkv_delete_value(5));
+        CHECK(erases + 2 == mock_flash_get_erases(MAIN_AREA));
+        values.erase(5);
+
+        // One more wrap-around, cold area is not erased
+        for (uwlkv_offset i = 0; i < capacity; i++)
+        {
+            uwlkv_set_value(0, (uwlkv_value)i);
+            values[0] = (uwlkv_value)i;
+        }
+        CHECK(cold_erases == mock_flash_get_erases(COLD_AREA));
+        init_uwlkv(0, 0);
+
+        uwlkv_value value;
+        CHECK(UWLKV_E_NOT_EXIST == uwlkv_get_value(5, &value));
+    }
+
+    SECTION("Cold area overflow")
+    {
+        // Every key is updated between two wraps and then left alone, so cold area fills up
+        for (int round = 0; round < 4; round++)
+        {
+            fill_main(values, capacity, round * 1000);
+            for (uwlkv_offset i = 0; i < (capacity * 2); i++)
+            {
+                uwlkv_set_value(0, (uwlkv_value)i);
+                values[0] = (uwlkv_value)i;
+            }
+        }
+        CHECK(mock_flash_get_erases(COLD_AREA) > cold_erases);
+    }
+
+    SECTION("Interrupted erase of main and cold areas")
+    {
+        // Reserved area holds a copy of all entries, like restart_map_with_cold() leaves it
+        auto offset = (uint32_t)(FLASH_REGION_SIZE - FLASH_RESERVE_SIZE + UWLKV_METADATA_SIZE);
+        for (auto const& entry : values)
+        {
+            uint8_t block[UWLKV_ENTRY_SIZE];
+            encode_entry(block, entry.first, entry.second);
+            mock_flash_write(block, offset, UWLKV_ENTRY_SIZE);
+            offset += UWLKV_ENTRY_SIZE;
+        }
+
+        mock_flash_fill_with_random(MAIN_AREA);
+        mock_flash_fill_with_random(COLD_AREA);
+        mock_flash_set(RESERVED_AREA, UWLKV_O_ERASE_STARTED,  UWLKV_NVRAM_FULL_ERASE_STARTED);
+        mock_flash_set(RESERVED_AREA, UWLKV_O_ERASE_FINISHED, UWLKV_ERASED_BYTE_VALUE);
+    }
+
+    init_uwlkv(0, 0);
+    CHECK(0 == compare_stored_values(values));
+}
+#endif
+
+#if defined(UWLKV_STATS) || defined(UWLKV_TRACE)
+static uint32_t fake_time;
+
+uint32_t fake_timestamp(void)
+{
+    return fake_time++;
+}
+#endif
+
+#ifdef UWLKV_STATS
+TEST_CASE("Statistics", "[stats]")
+{
+    const auto capacity = erase_nvram(0, 0);
+    uwlkv_stats stats;
+    uwlkv_get_stats(&stats);
+    CHECK(stats.boots[UWLKV_S_BLANK] >= 1);
+
+    uwlkv_set_timestamp_hook(&fake_timestamp);
+    uwlkv_reset_stats();
+    mock_flash_reset_reads();
+
+    CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(1, 100));
+    uwlkv_value value;
+    CHECK(UWLKV_E_SUCCESS == uwlkv_get_value(1, &value));
+    uwlkv_get_stats(&stats);
+#ifdef UWLKV_EEPROM
+    // Slot and its sequence number
+    CHECK(2 == stats.writes);
+#else
+    CHECK(1 == stats.writes);
+#endif
+    CHECK(UWLKV_ENTRY_SIZE == stats.bytes_written);
+    CHECK(mock_flash_get_reads() == stats.reads);
+    CHECK(stats.bytes_read >= UWLKV_ENTRY_SIZE);
+    CHECK(stats.lookups >= 2);
+    CHECK(0 == stats.erases);
+    CHECK(0 == stats.compactions);
+
+    for (uwlkv_offset i = 0; i < capacity; i++)
+    {
+        uwlkv_set_value(1, (uwlkv_value)i);
+    }
+    uwlkv_get_stats(&stats);
+#ifndef UWLKV_EEPROM
+    CHECK(1 == stats.compactions);
+    CHECK(stats.erases >= 2);
+    CHECK(stats.compaction_time >= 1);
+#endif
+    CHECK(stats.compaction_time == stats.max_compaction_time);
+    CHECK(stats.max_lookup_probes >= 1);
+    CHECK(stats.lookup_probes >= stats.max_lookup_probes);
+
+    init_uwlkv(0, 0);
+    uwlkv_get_stats(&stats);
+    CHECK(1 == stats.boots[UWLKV_S_CLEAN]);
+
+    uwlkv_set_timestamp_hook(nullptr);
+}
+#endif
+
+#ifdef UWLKV_TRACE
+TEST_CASE("Event trace", "[trace]")
+{
+    const auto capacity = erase_nvram(0, 0);
+    uwlkv_set_timestamp_hook(&fake_timestamp);
+
+    uwlkv_trace_event events[UWLKV_TRACE_SIZE];
+    uint32_t position = 0;
+    while (uwlkv_get_trace(events, UWLKV_TRACE_SIZE, &position)) {}
+
+    CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(7, 100));
+    auto copied = uwlkv_get_trace(events, UWLKV_TRACE_SIZE, &position);
+#ifdef UWLKV_EEPROM
+    // New key reads its free ring, write reads sequence number of the previous slot and writes
+    // the slot and its sequence number
+    REQUIRE(12 == copied);
+#else
+    REQUIRE(6 == copied);
+#endif
+    CHECK(UWLKV_OP_SET_VALUE == events[0].operation);
+    CHECK(1 == events[0].begin);
+    CHECK(7 == events[0].data);
+    CHECK(UWLKV_OP_GET_NEXT_BLOCK == events[1].operation);
+    CHECK(UWLKV_OP_NVRAM_WRITE == events[copied - 3].operation);
+    CHECK(UWLKV_OP_SET_VALUE == events[copied - 1].operation);
+    CHECK(0 == events[copied - 1].begin);
+    for (uint32_t i = 1; i < copied; i++)
+    {
+        CHECK(events[i - 1].timestamp < events[i].timestamp);
+    }
+
+    SECTION("Nested operations are balanced")
+    {
+        for (uwlkv_offset i = 0; i < capacity; i++)
+        {
+            uwlkv_set_value(7, (uwlkv_value)i);
+        }
+
+        position = 0;
+        copied = uwlkv_get_trace(events, UWLKV_TRACE_SIZE, &position);
+        CHECK(UWLKV_TRACE_SIZE - 1 == copied);
+        CHECK(0 == uwlkv_get_trace(events, UWLKV_TRACE_SIZE, &position));
+
+        /* Oldest events were overwritten, but all complete pairs must match */
+        uint8_t depth[UWLKV_OP_NUMBER] = { 0 };
+        uint32_t pairs = 0;
+        for (uint32_t i = 0; i < copied; i++)
+        {
+            REQUIRE(events[i].operation < UWLKV_OP_NUMBER);
+            if (events[i].begin)
+            {
+                depth[events[i].operation]++;
+            }
+            else if (depth[events[i].operation])
+            {
+                depth[events[i].operation]--;
+                pairs++;
+            }
+        }
+        CHECK(pairs > 0);
+    }
+
+#ifndef UWLKV_EEPROM
+    SECTION("Wrap-around is traced")
+    {
+        uint32_t restarts = 0;
+        uint32_t prepared = 0;
+        for (uwlkv_offset i = 0; i < capacity; i++)
+        {
+            uwlkv_set_value(7, (uwlkv_value)i);
+            while ((copied = uwlkv_get_trace(events, UWLKV_TRACE_SIZE, &position)) != 0)
+            {
+                for (uint32_t j = 0; j < copied; j++)
+                {
+                    if (0 == events[j].begin)
+                    {
+                        continue;
+                    }
+                    if (UWLKV_OP_RESTART_MAP == events[j].operation)
+                    {
+                        restarts++;
+                    }
+                    if (UWLKV_OP_PREPARE_AREA == events[j].operation)
+                    {
+                        prepared++;
+                        CHECK((UWLKV_MAIN == events[j].data || UWLKV_RESERVED == events[j].data));
+                    }
+                }
+            }
+        }
+        CHECK(1 == restarts);
+        CHECK(2 == prepared);
+    }
+#endif
+
+    uwlkv_set_timestamp_hook(nullptr);
+}
+#endif
+
+#ifdef UWLKV_KEYS
+TEST_CASE("Key registry", "[keys]")
+{
+    static_assert(20 == UWLKV_MAX_ENTRIES, "Map has a slot per registered key");
+
+    erase_nvram(0, 0);
+    uwlkv_value value;
+    CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(UWLKV_KEY_BOOT_COUNT, 1));
+    CHECK(UWLKV_E_SUCCESS == uwlkv_get_value(UWLKV_KEY_BOOT_COUNT, &value));
+    CHECK(1 == value);
+
+    CHECK(UWLKV_E_UNKNOWN_KEY == uwlkv_set_value(500, 1));
+    CHECK(UWLKV_E_UNKNOWN_KEY == uwlkv_get_value(500, &value));
+    CHECK(UWLKV_E_UNKNOWN_KEY == uwlkv_delete_value(500));
+    CHECK(1 == uwlkv_get_entries_number());
+
+    // Entry of a key, which is no longer registered, is skipped on boot
+    uint8_t block[UWLKV_ENTRY_SIZE];
+    encode_entry(block, 500, 5);
+    mock_flash_write(block, UWLKV_METADATA_SIZE + UWLKV_ENTRY_SIZE, UWLKV_ENTRY_SIZE);
+
+    init_uwlkv(0, 0);
+    CHECK(1 == uwlkv_get_entries_number());
+    CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(UWLKV_KEY_VOLUME, 2));
+    CHECK(UWLKV_E_SUCCESS == uwlkv_delete_value(UWLKV_KEY_BOOT_COUNT));
+    init_uwlkv(0, 0);
+    CHECK(UWLKV_E_SUCCESS == uwlkv_get_value(UWLKV_KEY_VOLUME, &value));
+    CHECK(2 == value);
+    CHECK(UWLKV_E_NOT_EXIST == uwlkv_get_value(UWLKV_KEY_BOOT_COUNT, &value));
+}
+#endif
+
+#ifdef UWLKV_CRC
+uint32_t bitwise_crc32(const uint8_t * data, uint32_t size)
+{
+    uint32_t crc = 0xFFFFFFFFu;
+    for (uint32_t i = 0; i < size; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ ((crc & 1u) ? 0xEDB88320u : 0u);
+        }
+    }
+
+    return ~crc;
+}
+
+TEST_CASE("Entry checksum", "[crc]")
+{
+    const uint8_t check[] = "123456789";
+    CHECK(0xCBF43926u == uwlkv_crc32(check, 9));
+
+    uint8_t data[40];
+    for (uint8_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (uint8_t)(i * 37 + 1);
+    }
+    // All combinations of 8 byte, 4 byte and single byte steps
+    for (uint32_t size = 0; size < sizeof(data); size++)
+    {
+        CHECK(bitwise_crc32(data + 1, size) == uwlkv_crc32(data + 1, size));
+    }
+
+    erase_nvram(0, 0);
+    CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(1, 10));
+    CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(2, 20));
+
+#ifndef UWLKV_EEPROM
+    SECTION("Torn write is ignored on boot")
+    {
+        // Power loss before checksum was written
+        uint8_t block[UWLKV_ENTRY_SIZE];
+        encode_entry(block, 1, 11);
+        memset(&block[sizeof(uwlkv_key) + sizeof(uwlkv_value)], UWLKV_ERASED_BYTE_VALUE, sizeof(uwlkv_crc));
+        mock_flash_write(block, UWLKV_METADATA_SIZE + 2 * UWLKV_ENTRY_SIZE, UWLKV_ENTRY_SIZE);
+
+        init_uwlkv(0, 0);
+        uwlkv_value value;
+        CHECK(UWLKV_E_SUCCESS == uwlkv_get_value(1, &value));
+        CHECK(10 == value);
+
+        // Damaged block is skipped, not overwritten
+        CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(1, 12));
+        init_uwlkv(0, 0);
+        CHECK(UWLKV_E_SUCCESS == uwlkv_get_value(1, &value));
+        CHECK(12 == value);
+    }
+
+    SECTION("Damaged entry is reported and dropped by wrap-around")
+    {
+        // Value of key 2 is the second entry
+        mock_flash_set(MAIN_AREA, UWLKV_METADATA_SIZE + UWLKV_ENTRY_SIZE + sizeof(uwlkv_key), 0x55);
+        uwlkv_value value;
+#ifdef UWLKV_RAMLESS
+        // RAM-less lookup skips damaged entries like boot does
+        CHECK(UWLKV_E_NOT_EXIST == uwlkv_get_value(2, &value));
+        CHECK(UWLKV_E_SUCCESS == uwlkv_get_value(1, &value));
+#else
+        CHECK(UWLKV_E_CORRUPTED == uwlkv_get_value(2, &value));
+#endif
+
+        const auto capacity = init_uwlkv(0, 0);
+        CHECK(UWLKV_E_NOT_EXIST == uwlkv_get_value(2, &value));
+        CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(2, 21));
+
+        mock_flash_set(MAIN_AREA, UWLKV_METADATA_SIZE + sizeof(uwlkv_key), 0x55);
+        for (uwlkv_offset i = 0; i < capacity; i++)
+        {
+            uwlkv_set_value(3, (uwlkv_value)i);
+        }
+        CHECK(UWLKV_E_NOT_EXIST == uwlkv_get_value(1, &value));
+        CHECK(UWLKV_E_SUCCESS == uwlkv_get_value(2, &value));
+        CHECK(21 == value);
+    }
+#endif
+}
+#endif
+
+#ifdef UWLKV_EEPROM
+TEST_CASE("EEPROM slot rings", "[eeprom]")
+{
+    const auto capacity = erase_nvram(0, 0);
+    REQUIRE(capacity >= 2 * UWLKV_MAX_ENTRIES);
+
+    // Each set is two writes (slot and its sequence number), each get is a single read,
+    // nothing is ever erased
+    for (uwlkv_offset i = 0; i < capacity * 3; i++)
+    {
+        const auto writes = mock_nvram_get_traffic().writes;
+        CHECK(UWLKV_E_SUCCESS == uwlkv_set_value((uwlkv_key)(i % 3), (uwlkv_value)i));
+        CHECK(writes + 2 == mock_nvram_get_traffic().writes);
+    }
+    for (auto erases : mock_nvram_get_traffic().erases)
+    {
+        CHECK(0 == erases);
+    }
+
+    mock_flash_reset_reads();
+    uwlkv_value value;
+    CHECK(UWLKV_E_SUCCESS == uwlkv_get_value(2, &value));
+    CHECK(1 == mock_flash_get_reads());
+    CHECK((uwlkv_value)(capacity * 3 - 1) == value);
+
+    SECTION("Newest slot is found after any number of laps")
+    {
+        // More writes than there are sequence numbers
+        for (uwlkv_value i = 0; i < 300; i++)
+        {
+            CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(4, i));
+            init_uwlkv(0, 0);
+            CHECK(UWLKV_E_SUCCESS == uwlkv_get_value(4, &value));
+            CHECK(i == value);
+        }
+        CHECK(UWLKV_E_SUCCESS == uwlkv_get_value(0, &value));
+        CHECK((uwlkv_value)(capacity * 3 - 3) == value);
+    }
+
+    SECTION("Torn write keeps the old value")
+    {
+        // Power is lost while the slot is written, its sequence number isn't written then
+        const auto cut = GENERATE(1u, 2u);
+        mock_nvram_cut_power(cut, 1 == cut);
+        uwlkv_set_value(1, -1);
+        mock_nvram_cut_power(0, true);
+
+        init_uwlkv(0, 0);
+        CHECK(UWLKV_E_SUCCESS == uwlkv_get_value(1, &value));
+        CHECK((uwlkv_value)(capacity * 3 - 2) == value);
+
+        CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(1, 11));
+        init_uwlkv(0, 0);
+        CHECK(UWLKV_E_SUCCESS == uwlkv_get_value(1, &value));
+        CHECK(11 == value);
+    }
+
+    SECTION("Deleted key frees its ring")
+    {
+        for (uwlkv_key key = 0; key < UWLKV_MAX_ENTRIES; key++)
+        {
+            CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(key, key));
+        }
+        CHECK(UWLKV_E_SUCCESS == uwlkv_delete_value(5));
+
+        init_uwlkv(0, 0);
+        CHECK(UWLKV_E_NOT_EXIST == uwlkv_get_value(5, &value));
+        CHECK(UWLKV_MAX_ENTRIES - 1 == uwlkv_get_entries_number());
+
+        CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(5, 50));
+        init_uwlkv(0, 0);
+        CHECK(UWLKV_MAX_ENTRIES == uwlkv_get_entries_number());
+        for (uwlkv_key key = 0; key < UWLKV_MAX_ENTRIES; key++)
+        {
+            CHECK(UWLKV_E_SUCCESS == uwlkv_get_value(key, &value));
+            CHECK(((5 == key) ? 50 : key) == value);
+        }
+    }
+
+    SECTION("New key isn't written if its ring can't be scanned")
+    {
+        // Reads of single slots work, scans of rings fail
+        auto interface = mock_interface(0, 0);
+        interface.read = [](uint8_t * data, uwlkv_offset start, uwlkv_offset length)
+        {
+            return (length > UWLKV_ENTRY_SIZE) ? 1 : mock_flash_read(data, start, length);
+        };
+        REQUIRE(capacity == uwlkv_init(&interface));
+
+        const auto writes = mock_nvram_get_traffic().writes;
+        CHECK(UWLKV_E_NVRAM_ERROR == uwlkv_set_value(5, 50));
+        CHECK(writes == mock_nvram_get_traffic().writes);
+
+        init_uwlkv(0, 0);
+        CHECK(UWLKV_E_NOT_EXIST == uwlkv_get_value(5, &value));
+        CHECK(UWLKV_E_SUCCESS == uwlkv_get_value(2, &value));
+        CHECK((uwlkv_value)(capacity * 3 - 1) == value);
+    }
+
+    SECTION("Unknown content is formatted")
+    {
+        mock_flash_fill_with_random(MAIN_AREA);
+        mock_flash_fill_with_random(RESERVED_AREA);
+        init_uwlkv(0, 0);
+        CHECK(0 == uwlkv_get_entries_number());
+        CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(3, 30));
+        init_uwlkv(0, 0);
+        CHECK(1 == uwlkv_get_entries_number());
+    }
+
+    SECTION("Log written by the flash engine is formatted")
+    {
+        mock_flash_fill_with_random(MAIN_AREA);
+        mock_flash_fill_with_random(RESERVED_AREA);
+        mock_flash_set(MAIN_AREA, UWLKV_O_ERASE_STARTED,  UWLKV_NVRAM_ERASE_STARTED);
+        mock_flash_set(MAIN_AREA, UWLKV_O_ERASE_FINISHED, UWLKV_NVRAM_ERASE_FINISHED);
+        init_uwlkv(0, 0);
+        CHECK(0 == uwlkv_get_entries_number());
+    }
+
+#ifdef UWLKV_CRC
+    SECTION("Damaged newest slot falls back to the previous one")
+    {
+        erase_nvram(0, 0);
+        CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(7, 70));
+        CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(7, 71));
+        // Value of the second slot of the first ring
+        mock_flash_set(MAIN_AREA, UWLKV_METADATA_SIZE + UWLKV_ENTRY_SIZE + sizeof(uwlkv_key), 0x55);
+
+        init_uwlkv(0, 0);
+        CHECK(UWLKV_E_SUCCESS == uwlkv_get_value(7, &value));
+        CHECK(70 == value);
+
+        CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(7, 72));
+        init_uwlkv(0, 0);
+        CHECK(UWLKV_E_SUCCESS == uwlkv_get_value(7, &value));
+        CHECK(72 == value);
+    }
+
+    SECTION("Damaged tombstone keeps the key deleted")
+    {
+        erase_nvram(0, 0);
+        CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(7, 70));
+        CHECK(UWLKV_E_SUCCESS == uwlkv_delete_value(7));
+        // Deleted key of the tombstone in the second slot of the first ring
+        mock_flash_set(MAIN_AREA, UWLKV_METADATA_SIZE + UWLKV_ENTRY_SIZE + sizeof(uwlkv_key), 0x55);
+
+        init_uwlkv(0, 0);
+        CHECK(UWLKV_E_NOT_EXIST == uwlkv_get_value(7, &value));
+        CHECK(0 == uwlkv_get_entries_number());
+    }
+#endif
+}
+#endif
+
+#ifdef UWLKV_WEAR
+TEST_CASE("Wear counters", "[wear]")
+{
+    const auto capacity = erase_nvram(0, 0);
+    uwlkv_wear wear;
+    uwlkv_get_wear(&wear);
+    for (auto erases : wear.erases)
+    {
+        CHECK(1 == erases);
+    }
+    CHECK(0 == wear.writes);
+    CHECK(UWLKV_ENDURANCE - 1 == wear.remaining_erases);
+    CHECK(capacity == wear.writes_per_erase);
+    CHECK(wear.remaining_writes == wear.remaining_erases * wear.writes_per_erase);
+    CHECK(UINT32_MAX == uwlkv_wear_time_left(&wear, 100));
+
+    // Wrap around twice
+    for (uwlkv_offset i = 0; i < capacity * 2; i++)
+    {
+        uwlkv_set_value(1, (uwlkv_value)i);
+    }
+    uwlkv_get_wear(&wear);
+    CHECK(3 == wear.erases[UWLKV_MAIN]);
+    CHECK(3 == wear.erases[UWLKV_RESERVED]);
+    CHECK(capacity * 2 == wear.writes);
+    CHECK(UWLKV_ENDURANCE - 3 == wear.remaining_erases);
+
+    const auto time_left = uwlkv_wear_time_left(&wear, wear.writes);
+    CHECK(wear.remaining_writes == time_left);
+
+    SECTION("Counters survive reboot")
+    {
+        init_uwlkv(0, 0);
+        uwlkv_get_wear(&wear);
+        CHECK(3 == wear.erases[UWLKV_MAIN]);
+        CHECK(3 == wear.erases[UWLKV_RESERVED]);
+        CHECK(0 == wear.writes);
+    }
+
+    SECTION("Counters survive interrupted erase of main area")
+    {
+        const auto main_erases = mock_flash_get_erases(MAIN_AREA);
+        mock_flash_set_erase(RESERVED_AREA, ERASE_DISABLED);
+        while (main_erases == mock_flash_get_erases(MAIN_AREA))
+        {
+            uwlkv_set_value(1, 0);
+        }
+        mock_flash_set_erase(RESERVED_AREA, ERASE_ENABLED);
+        mock_flash_fill_with_random(MAIN_AREA);
+        mock_flash_set(RESERVED_AREA, UWLKV_O_ERASE_FINISHED, UWLKV_ERASED_BYTE_VALUE);
+
+        init_uwlkv(0, 0);
+        uwlkv_get_wear(&wear);
+        CHECK(5 == wear.erases[UWLKV_MAIN]);
+        CHECK(4 == wear.erases[UWLKV_RESERVED]);
+    }
+
+    SECTION("Counters survive repeated erase of reserved area")
+    {
+        // Erase of reserved area was interrupted, each boot erases it again
+        mock_flash_set(MAIN_AREA, UWLKV_O_ERASE_FINISHED, UWLKV_ERASED_BYTE_VALUE);
+        mock_flash_set(RESERVED_AREA, UWLKV_METADATA_SIZE, 0);
+
+        for (uint32_t reserve_erases = 4; reserve_erases <= 5; reserve_erases++)
+        {
+            init_uwlkv(0, 0);
+            uwlkv_get_wear(&wear);
+            CHECK(3 == wear.erases[UWLKV_MAIN]);
+            CHECK(reserve_erases == wear.erases[UWLKV_RESERVED]);
+        }
+
+        // Wrap-around erases counters of reserved area together with it
+        for (uwlkv_offset i = 0; i < capacity; i++)
+        {
+            uwlkv_set_value(1, (uwlkv_value)i);
+        }
+        uwlkv_wear before;
+        uwlkv_get_wear(&before);
+        CHECK(4 == before.erases[UWLKV_MAIN]);
+        CHECK(7 == before.erases[UWLKV_RESERVED]);
+
+        init_uwlkv(0, 0);
+        uwlkv_get_wear(&wear);
+        CHECK(before.erases[UWLKV_MAIN] == wear.erases[UWLKV_MAIN]);
+        CHECK(before.erases[UWLKV_RESERVED] == wear.erases[UWLKV_RESERVED]);
+    }
+
+    SECTION("Worn out NVRAM")
+    {
+        for (uwlkv_offset i = 0; i < capacity * UWLKV_ENDURANCE; i++)
+        {
+            uwlkv_set_value(1, (uwlkv_value)i);
+        }
+        uwlkv_get_wear(&wear);
+        CHECK(0 == wear.remaining_erases);
+        CHECK(0 == wear.remaining_writes);
+        CHECK(0 == uwlkv_wear_time_left(&wear, 1000));
+    }
+}
+#endif
+
+#ifdef UWLKV_MIGRATE
+/* Layout of a previous firmware: main area is smaller, reserved one starts earlier and NVRAM
+ * ends earlier. Mock erases areas of the default layout, so the old one is never wrapped around */
+static const uwlkv_offset OLD_LAYOUT_SIZE     = FLASH_REGION_SIZE - 64;
+static const uwlkv_offset OLD_LAYOUT_RESERVED = FLASH_RESERVE_SIZE - 32;
+
+/* Boots blank NVRAM with a layout and fills its main area without a wrap-around */
+std::map<uwlkv_key, uwlkv_value> fill_layout(uwlkv_offset size, uwlkv_offset reserved)
+{
+    mock_nvram_init();
+    const auto capacity = init_uwlkv(size, reserved);
+    REQUIRE(capacity > UWLKV_MAX_ENTRIES);
+
+    std::map<uwlkv_key, uwlkv_value> values;
+    for (uwlkv_offset i = 0; i < capacity - 1; i++)
+    {
+        const auto key = (uwlkv_key)(i % UWLKV_MAX_ENTRIES);
+        uwlkv_set_value(key, (uwlkv_value)i);
+        values[key] = (uwlkv_value)i;
+    }
+
+    return values;
+}
+
+/* Erase functions of the old layout. Power may be lost right after main area erase */
+static bool cut_after_old_erase = false;
+
+static int erase_old_range(uwlkv_offset start, uwlkv_offset end)
+{
+    if (!mock_nvram_powered())
+    {
+        return 3;
+    }
+
+    for (uwlkv_offset offset = start; offset < end; offset++)
+    {
+        mock_flash_set(MAIN_AREA, offset, UWLKV_ERASED_BYTE_VALUE);
+    }
+
+    return 0;
+}
+
+static int erase_old_main(void)
+{
+    const auto ret = erase_old_range(0, OLD_LAYOUT_SIZE - OLD_LAYOUT_RESERVED);
+    if (cut_after_old_erase)
+    {
+        mock_nvram_cut_power(1, false);
+    }
+
+    return ret;
+}
+
+static int erase_old_reserve(void)
+{
+    return erase_old_range(OLD_LAYOUT_SIZE - OLD_LAYOUT_RESERVED, OLD_LAYOUT_SIZE);
+}
+
+void check_values(const std::map<uwlkv_key, uwlkv_value> & values)
+{
+    CHECK(values.size() == uwlkv_get_entries_number());
+    for (auto const& entry : values)
+    {
+        uwlkv_value value;
+        CHECK(UWLKV_E_SUCCESS == uwlkv_get_value(entry.first, &value));
+        CHECK(entry.second == value);
+    }
+}
+
+TEST_CASE("Layout migration", "[migrate]")
+{
+    SECTION("Main area grows and reserved one moves")
+    {
+        auto values = fill_layout(OLD_LAYOUT_SIZE, OLD_LAYOUT_RESERVED);
+        const auto main_erases = mock_flash_get_erases(MAIN_AREA);
+#ifdef UWLKV_STATS
+        uwlkv_reset_stats();
+#endif
+
+        const auto capacity = init_uwlkv(0, 0);
+        CHECK(capacity > 0);
+        CHECK(main_erases + 1 == mock_flash_get_erases(MAIN_AREA));
+        check_values(values);
+
+        // The new layout is kept, the next boot doesn't move anything
+        init_uwlkv(0, 0);
+        CHECK(main_erases + 1 == mock_flash_get_erases(MAIN_AREA));
+        check_values(values);
+#ifdef UWLKV_STATS
+        uwlkv_stats stats;
+        uwlkv_get_stats(&stats);
+        CHECK(1 == stats.migrations);
+        CHECK(1 == stats.compactions);
+#endif
+
+        // Wrap around in the new layout
+        for (uwlkv_offset i = 0; i < capacity; i++)
+        {
+            CHECK(UWLKV_E_SUCCESS == uwlkv_set_value(1, (uwlkv_value)i));
+            values[1] = (uwlkv_value)i;
+        }
+        init_uwlkv(0, 0);
+        check_values(values);
+    }
+
+    SECTION("Power loss during migration")
+    {
+        const bool torn = GENERATE(false, true);
+        for (uint32_t cut = 1; ; cut++)
+        {
+            const auto values = fill_layout(OLD_LAYOUT_SIZE, OLD_LAYOUT_RESERVED);
+            mock_nvram_cut_power(cut, torn);
+            init_uwlkv(0, 0);
+            const bool interrupted = !mock_nvram_powered();
+
+            mock_nvram_cut_power(0, torn);
+            CHECK(init_uwlkv(0, 0) > 0);
+            check_values(values);
+            if (!interrupted)
+            {
+                break;
+            }
+
+            // Recovery of a cut migration is an ordinary boot of the new layout
+            init_uwlkv(0, 0);
+            check_values(values);
+        }
+    }
+
+#ifndef UWLKV_HOT_COLD
+    SECTION("Live entries overlap the new reserved area")
+    {
+        const auto values = fill_layout(FLASH_REGION_SIZE, OLD_LAYOUT_RESERVED);
+
+        CHECK(0 == init_uwlkv(0, 0));
+        CHECK(UWLKV_E_NOT_STARTED == uwlkv_set_value(1, 1));
+
+        // NVRAM is not touched, the old firmware boots it as before
+        CHECK(init_uwlkv(FLASH_REGION_SIZE, OLD_LAYOUT_RESERVED) > 0);
+        check_values(values);
+    }
+
+    SECTION("Power loss in a wrap-around of the old layout")
+    {
+        auto values = fill_layout(OLD_LAYOUT_SIZE, OLD_LAYOUT_RESERVED);
+        auto old = mock_interface(OLD_LAYOUT_SIZE, OLD_LAYOUT_RESERVED);
+        old.erase_main    = &erase_old_main;
+        old.erase_reserve = &erase_old_reserve;
+        REQUIRE(uwlkv_init(&old) > 0);
+
+        // Main area loses its flags and the old reserved area holds the only copy of entries
+        cut_after_old_erase = true;
+        for (uwlkv_value i = 0; mock_nvram_powered(); i++)
+        {
+            uwlkv_set_value(1, i);
+            if (mock_nvram_powered())
+            {
+                values[1] = i;
+            }
+        }
+        cut_after_old_erase = false;
+        mock_nvram_cut_power(0, false);
+
+        // Old reserved area overlaps the new one, so NVRAM is not touched
+        CHECK(0 == init_uwlkv(0, 0));
+
+        // The old firmware completes its wrap-around, then the update migrates entries
+        REQUIRE(uwlkv_init(&old) > 0);
+        check_values(values);
+        CHECK(init_uwlkv(0, 0) > 0);
+        check_values(values);
+    }
+#endif
+
+    SECTION("Header of another format")
+    {
+        fill_layout(0, 0);
+        mock_flash_set(MAIN_AREA, UWLKV_O_LAYOUT, UWLKV_LAYOUT_VERSION + 1);
+
+        CHECK(0 == init_uwlkv(0, 0));
+    }
+}
+#endif
+
+/* NVRAM in RAM for C++ stores, each instantiation has its own memory */
+template <uwlkv_offset Size, uwlkv_offset Reserved>
+struct ram_layout
+{
+    static constexpr uwlkv_offset size     = Size;
+    static constexpr uwlkv_offset reserved = Reserved;
+    static uint8_t memory[Size];
+
+    static int read(uint8_t * data, uwlkv_offset start, uwlkv_offset length)
+    {
+        memcpy(data, &memory[start], length);
+        return 0;
+    }
+
+    static int write(uint8_t * data, uwlkv_offset start, uwlkv_offset length)
+    {
+        memcpy(&memory[start], data, length);
+        return 0;
+    }
+
+    static int erase_main(void)
+    {
+        memset(memory, UWLKV_ERASED_BYTE_VALUE, Size - Reserved);
+        return 0;
+    }
+
+    static int erase_reserve(void)
+    {
+        memset(&memory[Size - Reserved], UWLKV_ERASED_BYTE_VALUE, Reserved);
+        return 0;
+    }
+
+#ifdef UWLKV_HOT_COLD
+    static constexpr uwlkv_offset cold = 0;
+
+    static int erase_cold(void)
+    {
+        return 0;
+    }
+#endif
+};
+
+template <uwlkv_offset Size, uwlkv_offset Reserved>
+uint8_t ram_layout<Size, Reserved>::memory[Size];
+
+TEST_CASE("C++ store", "[store]")
+{
+    // Two configurations in one program
+    using small_store = uwlkv::Store<uint8_t, int16_t, 4, ram_layout<512, 256>>;
+    using large_store = uwlkv::Store<uint16_t, uint32_t, 16, ram_layout<1024, 256>>;
+    static_assert(UWLKV_ENTRY_SIZE == small_store::entry_size, "Entries are the ones of C library");
+
+    memset(ram_layout<512, 256>::memory, 0, 512);
+    small_store small;
+    large_store large;
+    CHECK(UWLKV_E_NOT_STARTED == small.set(1, 1));
+    CHECK(small.init() > 0);
+    CHECK(large.init() > 0);
+    CHECK(4 == small.free_entries());
+
+    SECTION("Values survive wrap-arounds and reboots")
+    {
+        for (int i = 0; i < 100; i++)
+        {
+            CHECK(UWLKV_E_SUCCESS == small.set((uint8_t)(i % 4), (int16_t)-i));
+            CHECK(UWLKV_E_SUCCESS == large.set((uint16_t)(i % 16), (uint32_t)i << 20));
+        }
+
+        small_store small_rebooted;
+        large_store large_rebooted;
+        small_rebooted.init();
+        large_rebooted.init();
+        for (int i = 100 - 16; i < 100; i++)
+        {
+            int16_t  small_value;
+            uint32_t large_value;
+            if (i >= 100 - 4)
+            {
+                CHECK(UWLKV_E_SUCCESS == small_rebooted.get((uint8_t)(i % 4), small_value));
+                CHECK(-i == small_value);
+            }
+            CHECK(UWLKV_E_SUCCESS == large_rebooted.get((uint16_t)(i % 16), large_value));
+            CHECK(((uint32_t)i << 20) == large_value);
+        }
+        CHECK(4 == small_rebooted.get_entries_number());
+        CHECK(16 == large_rebooted.get_entries_number());
+    }
+
+    SECTION("Keys limit")
+    {
+#ifdef UWLKV_KEYS
+        const uint8_t last_key = 3;
+#else
+        // Narrow keys never hit the reserved key
+        const uint8_t last_key = UINT8_MAX;
+#endif
+        CHECK(UWLKV_E_SUCCESS == small.set(last_key, 1));
+        CHECK(UWLKV_E_RESERVED_KEY == large.set(UWLKV_TOMBSTONE_KEY, 0));
+
+        for (uint8_t key = 0; key < 3; key++)
+        {
+            small.set(key, key);
+        }
+        CHECK(0 == small.free_entries());
+        CHECK(UWLKV_E_NO_SPACE == small.set(4, 4));
+        CHECK(UWLKV_E_SUCCESS == small.set(2, 4));
+
+        // Refused write takes no block, so the next one is found after a reboot
+        small_store rebooted;
+        rebooted.init();
+        int16_t value;
+        CHECK(UWLKV_E_SUCCESS == rebooted.get(2, value));
+        CHECK(4 == value);
+        CHECK(UWLKV_E_SUCCESS == rebooted.get(last_key, value));
+        CHECK(1 == value);
+        CHECK(UWLKV_E_NO_SPACE == rebooted.set(4, 4));
+    }
+
+    SECTION("Deleting values")
+    {
+        small.set(1, 10);
+        small.set(2, 20);
+        CHECK(UWLKV_E_SUCCESS == small.remove(1));
+        CHECK(UWLKV_E_NOT_EXIST == small.remove(1));
+
+        small_store rebooted;
+        rebooted.init();
+        int16_t value;
+        CHECK(UWLKV_E_NOT_EXIST == rebooted.get(1, value));
+        CHECK(UWLKV_E_SUCCESS == rebooted.get(2, value));
+        CHECK(20 == value);
+
+        int visited = 0;
+        rebooted.for_each([&visited](uint8_t, int16_t) { visited += 1; return 0; });
+        CHECK(1 == visited);
+    }
+}
+
+#ifndef UWLKV_EEPROM
+struct mock_layout
+{
+    static constexpr uwlkv_offset size     = FLASH_REGION_SIZE;
+    static constexpr uwlkv_offset reserved = FLASH_RESERVE_SIZE;
+
+    static int read(uint8_t * data, uwlkv_offset start, uwlkv_offset length)
+    {
+        return mock_flash_read(data, start, length);
+    }
+
+    static int write(uint8_t * data, uwlkv_offset start, uwlkv_offset length)
+    {
+        return mock_flash_write(data, start, length);
+    }
+
+    static int erase_main(void)
+    {
+        return mock_flash_erase_main();
+    }
+
+    static int erase_reserve(void)
+    {
+        return mock_flash_erase_reserve();
+    }
+
+#ifdef UWLKV_HOT_COLD
+    static constexpr uwlkv_offset cold = FLASH_COLD_SIZE;
+
+    static int erase_cold(void)
+    {
+        return mock_flash_erase_cold();
+    }
+#endif
+};
+
+TEST_CASE("C++ store shares NVRAM format", "[store]")
+{
+    const auto capacity = erase_nvram(0, 0);
+    std::map<uwlkv_key, uwlkv_value> values;
+    fill_main(values, capacity + 5, 0);
+
+    uwlkv::Store<uwlkv_key, uwlkv_value, UWLKV_MAX_ENTRIES, mock_layout> store;
+    CHECK(capacity == store.init());
+    for (auto const& entry : values)
+    {
+        uwlkv_value value;
+        CHECK(UWLKV_E_SUCCESS == store.get(entry.first, value));
+        CHECK(entry.second == value);
+    }
+
+    for (uwlkv_offset i = 0; i < capacity; i++)
+    {
+        store.set(3, (uwlkv_value)i);
+    }
+    store.remove(4);
+    values[3] = (uwlkv_value)capacity - 1;
+    values.erase(4);
+
+    init_uwlkv(0, 0);
+    CHECK(0 == compare_stored_values(values));
+    uwlkv_value value;
+    CHECK(UWLKV_E_NOT_EXIST == uwlkv_get_value(4, &value));
+}
+#endif
+
+/* NVRAM device of a shard, each instantiation has its own memory and erase hook */
+template <uint8_t Shard>
+struct shard_nvram
+{
+    static uint8_t memory[FLASH_REGION_SIZE];
+    static void (* on_erase_main)(void);
+
+    static int read(uint8_t * data, uwlkv_offset start, uwlkv_offset length)
+    {
+        memcpy(data, &memory[start], length);
+        return 0;
+    }
+
+    static int write(uint8_t * data, uwlkv_offset start, uwlkv_offset length)
+    {
+        memcpy(&memory[start], data, length);
+        return 0;
+    }
+
+    static int erase_main(void)
+    {
+        if (on_erase_main)
+        {
+            on_erase_main();
+        }
+        memset(memory, UWLKV_ERASED_BYTE_VALUE, FLASH_MAIN_SIZE);
+        return 0;
+    }
+
+    static int erase_reserve(void)
+    {
+        memset(&memory[FLASH_REGION_SIZE - FLASH_RESERVE_SIZE], UWLKV_ERASED_BYTE_VALUE, FLASH_RESERVE_SIZE);
+        return 0;
+    }
+
+#ifdef UWLKV_HOT_COLD
+    static int erase_cold(void)
+    {
+        memset(&memory[FLASH_MAIN_SIZE], UWLKV_ERASED_BYTE_VALUE, FLASH_COLD_SIZE);
+        return 0;
+    }
+#endif
+
+    static uwlkv_nvram_interface interface(void)
+    {
+        uwlkv_nvram_interface interface;
+        memset(&interface, 0, sizeof(interface));
+        interface.read          = &read;
+        interface.write         = &write;
+        interface.erase_main    = &erase_main;
+        interface.erase_reserve = &erase_reserve;
+        interface.size          = FLASH_REGION_SIZE;
+        interface.reserved      = FLASH_RESERVE_SIZE;
+#ifdef UWLKV_HOT_COLD
+        interface.erase_cold    = &erase_cold;
+        interface.cold          = FLASH_COLD_SIZE;
+#endif
+        return interface;
+    }
+};
+
+template <uint8_t Shard>
+uint8_t shard_nvram<Shard>::memory[FLASH_REGION_SIZE];
+template <uint8_t Shard>
+void (* shard_nvram<Shard>::on_erase_main)(void);
+
+static const uint8_t SHARDS = 3;
+static uint8_t       shard_locked[SHARDS];
+static uint32_t      shard_locks;
+static uwlkv_shards  shards;
+
+static void lock_shard(uint8_t shard)
+{
+    CHECK(0 == shard_locked[shard]);
+    shard_locked[shard] = 1;
+    shard_locks += 1;
+}
+
+static void unlock_shard(uint8_t shard)
+{
+    CHECK(1 == shard_locked[shard]);
+    shard_locked[shard] = 0;
+}
+
+#ifndef UWLKV_EEPROM
+static uwlkv_key key_of_shard(uint8_t shard)
+{
+    for (uwlkv_key key = 0; key < UWLKV_MAX_ENTRIES; key++)
+    {
+        if (shard == uwlkv_shard_of(&shards, key))
+        {
+            return key;
+        }
+    }
+    return UWLKV_MAX_ENTRIES;
+}
+#endif
+
+TEST_CASE("Sharded stores", "[shards]")
+{
+    memset(shard_nvram<0>::memory, 0, FLASH_REGION_SIZE);
+    memset(shard_nvram<1>::memory, 0, FLASH_REGION_SIZE);
+    memset(shard_nvram<2>::memory, 0, FLASH_REGION_SIZE);
+    const uwlkv_nvram_interface interfaces[SHARDS] =
+        { shard_nvram<0>::interface(), shard_nvram<1>::interface(), shard_nvram<2>::interface() };
+
+    static uwlkv_store stores[SHARDS];
+    shards.stores = stores;
+    shards.number = SHARDS;
+    shards.lock   = &lock_shard;
+    shards.unlock = &unlock_shard;
+    shard_locks   = 0;
+
+    uwlkv_shards no_shards = { stores, 0, nullptr, nullptr };
+    CHECK(0 == uwlkv_shards_init(&no_shards, interfaces, nullptr));
+
+    uint8_t failed = 0;
+    const auto capacity = uwlkv_shards_init(&shards, interfaces, &failed);
+    CHECK(capacity > UWLKV_MAX_ENTRIES);
+    CHECK(SHARDS == failed);
+
+    SECTION("Keys are spread and survive wrap-arounds and reboots")
+    {
+        uwlkv_key per_shard[SHARDS] = { 0 };
+        for (uwlkv_key key = 0; key < UWLKV_MAX_ENTRIES; key++)
+        {
+            per_shard[uwlkv_shard_of(&shards, key)] += 1;
+        }
+        for (uint8_t shard = 0; shard < SHARDS; shard++)
+        {
+            CHECK(0 < per_shard[shard]);
+        }
+
+        for (uwlkv_offset i = 0; i < capacity * 3; i++)
+        {
+            CHECK(UWLKV_E_SUCCESS == uwlkv_shards_set_value(&shards, (uwlkv_key)(i % UWLKV_MAX_ENTRIES), (uwlkv_value)i));
+        }
+        CHECK(UWLKV_E_SUCCESS == uwlkv_shards_delete_value(&shards, 0));
+        CHECK(UWLKV_MAX_ENTRIES - 1 == uwlkv_shards_get_entries_number(&shards));
+        CHECK(per_shard[0] - 1 == uwlkv_store_get_entries_number(&stores[0]));
+        CHECK(0 < shard_locks);
+
+        REQUIRE(capacity == uwlkv_shards_init(&shards, interfaces, nullptr));
+        uwlkv_value value;
+        CHECK(UWLKV_E_NOT_EXIST == uwlkv_shards_get_value(&shards, 0, &value));
+        for (uwlkv_offset i = capacity * 3 - UWLKV_MAX_ENTRIES; i < capacity * 3; i++)
+        {
+            if (0 == i % UWLKV_MAX_ENTRIES)
+            {
+                continue;
+            }
+            CHECK(UWLKV_E_SUCCESS == uwlkv_shards_get_value(&shards, (uwlkv_key)(i % UWLKV_MAX_ENTRIES), &value));
+            CHECK((uwlkv_value)i == value);
+        }
+
+        int visited = 0;
+        CHECK(UWLKV_E_SUCCESS == uwlkv_shards_foreach(&shards,
+            [](uwlkv_key, uwlkv_value, void * context) { *(int *)context += 1; return 0; }, &visited));
+        CHECK(UWLKV_MAX_ENTRIES - 1 == visited);
+
+        visited = 0;
+        CHECK(UWLKV_E_SUCCESS == uwlkv_shards_foreach(&shards,
+            [](uwlkv_key, uwlkv_value, void * context) { *(int *)context += 1; return 1; }, &visited));
+        CHECK(1 == visited);
+    }
+
+    SECTION("Shard which can't start leaves all of them stopped")
+    {
+        uwlkv_nvram_interface broken[SHARDS] = { interfaces[0], interfaces[1], interfaces[2] };
+        broken[1].size = UWLKV_METADATA_SIZE;
+
+        CHECK(0 == uwlkv_shards_init(&shards, broken, &failed));
+        CHECK(1 == failed);
+        uwlkv_value value;
+        CHECK(UWLKV_E_NOT_STARTED == uwlkv_store_get_value(&stores[0], 0, &value));
+        CHECK(UWLKV_E_NOT_STARTED == uwlkv_store_set_value(&stores[0], 0, 1));
+        CHECK(UWLKV_E_NOT_STARTED == uwlkv_store_get_value(&stores[1], 0, &value));
+    }
+
+#ifndef UWLKV_EEPROM
+    SECTION("Wrap-around of one shard doesn't block others")
+    {
+        /* Shard 1 is used while shard 0 is in the middle of its wrap-around */
+        shard_nvram<0>::on_erase_main = []()
+        {
+            uwlkv_value value;
+            CHECK(1 == shard_locked[0]);
+            CHECK(UWLKV_E_SUCCESS == uwlkv_shards_set_value(&shards, key_of_shard(1), 42));
+            CHECK(UWLKV_E_SUCCESS == uwlkv_shards_get_value(&shards, key_of_shard(1), &value));
+            CHECK(42 == value);
+        };
+
+        for (uwlkv_offset i = 0; i <= capacity; i++)
+        {
+            CHECK(UWLKV_E_SUCCESS == uwlkv_shards_set_value(&shards, key_of_shard(0), (uwlkv_value)i));
+        }
+        shard_nvram<0>::on_erase_main = nullptr;
+
+        uwlkv_value value;
+        CHECK(UWLKV_E_SUCCESS == uwlkv_shards_get_value(&shards, key_of_shard(0), &value));
+        CHECK((uwlkv_value)capacity == value);
+        CHECK(UWLKV_E_SUCCESS == uwlkv_shards_get_value(&shards, key_of_shard(1), &value));
+        CHECK(42 == value);
+        CHECK(2 == uwlkv_shards_get_entries_number(&shards));
+    }
+#endif
+}
@@ -0,0 +1,281 @@
+/* Host-side NVRAM emulator for tools. Unlike the mock used by unit tests, it emulates flash
+ * semantics (programming only clears bits), counts traffic, cuts power at a given operation
+ * and advances a virtual clock by the time a real part would spend on each operation.
+ * Power cut during erase leaves only a part of the area erased. After power cut all
+ * operations are ignored until flash_power_on().
+ * With UWLKV_EEPROM writes replace bytes, as EEPROM does, and wear is counted per page.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "flash.h"
+
+/* Typical datasheet figures */
+static const flash_timing parts[] =
+{
+    /* Operations complete instantly */
+    { "instant",  0,      0,     1,   0,       0,     1,     0         },
+    /* SPI NOR (W25Q class) on a 50 MHz single SPI bus: 256 byte pages, 4 KiB sectors */
+    { "nor",      1000,   160,   256, 700000,  160,   4096,  45000000  },
+    /* I2C EEPROM (24xx class) on a 400 kHz bus: 64 byte pages, erase is writing pages with 0xFF */
+    { "eeprom",   90000,  22500, 64,  5000000, 22500, 64,    6440000   },
+    /* Internal MCU flash (STM32F4 class): 32 bit words, 16 KiB sectors */
+    { "mcu",      0,      5,     4,   16000,   0,     16384, 250000000 },
+};
+
+static uint8_t *             flash;
+static uint32_t *            page_writes;
+static uint32_t              flash_size;
+static uint32_t              reserved_size;
+static uint32_t              cold_size;
+static const flash_timing *  timing;
+static flash_traffic         traffic;
+static uint64_t              clock_ns;
+static uint8_t               powered;
+static uint32_t              operations_to_cut;
+static uint64_t              random_state;
+
+/**
+ * @brief	Finds timing of a part by name.
+ *
+ * @param 	name	Part name.
+ *
+ * @returns	Timing or null if there is no such part.
+ */
+const flash_timing * flash_find_part(const char * name)
+{
+    for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++)
+    {
+        if (0 == strcmp(name, parts[i].name))
+        {
+            return &parts[i];
+        }
+    }
+
+    return NULL;
+}
+
+/** @brief	Prints names of known parts to stderr, separated by a given string. */
+void flash_list_parts(const char * separator)
+{
+    for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++)
+    {
+        fprintf(stderr, "%s%s", (0 == i) ? "" : separator, parts[i].name);
+    }
+}
+
+/**
+ * @brief	Allocates erased NVRAM.
+ *
+ * @param 	size       	NVRAM size.
+ * @param 	reserved   	Reserved area size.
+ * @param 	cold       	Cold area size, 0 without UWLKV_HOT_COLD.
+ * @param 	part_timing	Timing of emulated part.
+ * @param 	seed       	Seed for the size of partial erases.
+ *
+ * @returns	0 on success.
+ */
+int flash_init(uint32_t size, uint32_t reserved, uint32_t cold, const flash_timing * part_timing, uint64_t seed)
+{
+    flash       = malloc(size);
+    page_writes = calloc(size / part_timing->page_size + 1, sizeof(uint32_t));
+    if ((NULL == flash) || (NULL == page_writes))
+    {
+        flash_free();
+        return 1;
+    }
+
+    memset(flash, UWLKV_ERASED_BYTE_VALUE, size);
+    memset(&traffic, 0, sizeof(traffic));
+    flash_size    = size;
+    reserved_size = reserved;
+    cold_size     = cold;
+    timing        = part_timing;
+    clock_ns      = 0;
+    powered       = 1;
+    random_state  = seed ? seed : 1;
+
+    return 0;
+}
+
+void flash_free(void)
+{
+    free(flash);
+    free(page_writes);
+    flash       = NULL;
+    page_writes = NULL;
+}
+
+/** @brief	xorshift64* generator, so results don't depend on platform rand() */
+static uint64_t next_random(void)
+{
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+
+    return random_state * 0x2545F4914F6CDD1DULL;
+}
+
+/**
+ * @brief	Counts an operation and cuts power when scheduled.
+ *
+ * @returns	1 if operation should take effect.
+ */
+static int operation_allowed(void)
+{
+    if (!powered)
+    {
+        return 0;
+    }
+
+    if (operations_to_cut && (0 == --operations_to_cut))
+    {
+        powered = 0;
+    }
+
+    return 1;
+}
+
+static int flash_read(uint8_t * data, uint32_t start, uint32_t length)
+{
+    traffic.reads      += 1;
+    traffic.bytes_read += length;
+    clock_ns           += timing->read_overhead + (uint64_t)timing->read_byte * length;
+    memcpy(data, flash + start, length);
+
+    return 0;
+}
+
+static int flash_write(uint8_t * data, uint32_t start, uint32_t length)
+{
+    if ((0 == length) || !operation_allowed())
+    {
+        return 0;
+    }
+
+    const uint32_t pages = (start + length - 1) / timing->page_size - start / timing->page_size + 1;
+    traffic.writes        += 1;
+    traffic.bytes_written += length;
+    clock_ns              += (uint64_t)timing->page_program * pages + (uint64_t)timing->program_byte * length;
+    for (uint32_t page = start / timing->page_size; page < (start / timing->page_size + pages); page++)
+    {
+        page_writes[page] += 1;
+        if (page_writes[page] > traffic.max_page_writes)
+        {
+            traffic.max_page_writes = page_writes[page];
+        }
+    }
+    for (uint32_t i = 0; i < length; i++)
+    {
+#ifdef UWLKV_EEPROM
+        flash[start + i] = data[i];
+#else
+        /* Programming can only clear bits */
+        if (data[i] & ~flash[start + i])
+        {
+            traffic.overwrites += 1;
+        }
+        flash[start + i] &= data[i];
+#endif
+    }
+
+    return 0;
+}
+
+static void flash_erase(const uwlkv_area area, const uint32_t start, uint32_t length)
+{
+    const uint8_t cut_now = 1 == operations_to_cut;
+    if (!operation_allowed())
+    {
+        return;
+    }
+
+    if (cut_now)
+    {
+        length = (uint32_t)(next_random() % length);
+    }
+
+    const uint32_t sectors = (length + timing->sector_size - 1) / timing->sector_size;
+    traffic.erases[area] += 1;
+    traffic.bytes_erased += length;
+    clock_ns             += (uint64_t)timing->sector_erase * sectors;
+    memset(flash + start, UWLKV_ERASED_BYTE_VALUE, length);
+}
+
+static int flash_erase_main(void)
+{
+    flash_erase(UWLKV_MAIN, 0, flash_size - reserved_size - cold_size);
+
+    return 0;
+}
+
+static int flash_erase_reserve(void)
+{
+    flash_erase(UWLKV_RESERVED, flash_size - reserved_size, reserved_size);
+
+    return 0;
+}
+
+#ifdef UWLKV_HOT_COLD
+static int flash_erase_cold(void)
+{
+    flash_erase(UWLKV_COLD, flash_size - reserved_size - cold_size, cold_size);
+
+    return 0;
+}
+#endif
+
+/**
+ * @brief	Fills library interface with emulator functions and sizes.
+ *
+ * @param [out]	interface	Interface to be passed to uwlkv_init().
+ */
+void flash_interface(uwlkv_nvram_interface * interface)
+{
+    interface->read          = &flash_read;
+    interface->write         = &flash_write;
+    interface->erase_main    = &flash_erase_main;
+    interface->erase_reserve = &flash_erase_reserve;
+    interface->size          = flash_size;
+    interface->reserved      = reserved_size;
+#ifdef UWLKV_HOT_COLD
+    interface->erase_cold    = &flash_erase_cold;
+    interface->cold          = cold_size;
+#endif
+}
+
+/**
+ * @brief	Restores power.
+ *
+ * @param 	operations	Number of write and erase operations until the next power cut,
+ * 						0 to keep power on.
+ */
+void flash_power_on(const uint32_t operations)
+{
+    powered           = 1;
+    operations_to_cut = operations;
+}
+
+/** @brief	Returns 0 if power was cut. */
+uint8_t flash_powered(void)
+{
+    return powered;
+}
+
+/** @brief	Returns virtual time spent on all operations, in nanoseconds. */
+uint64_t flash_clock(void)
+{
+    return clock_ns;
+}
+
+const flash_traffic * flash_get_traffic(void)
+{
+    return &traffic;
+}
+
+/** @brief	Returns emulated memory, so its content can be saved and restored by tools. */
+uint8_t * flash_memory(void)
+{
+    return flash;
+}
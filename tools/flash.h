@@ -0,0 +1,51 @@
+#ifndef UWLKV_TOOLS_FLASH_H
+#define UWLKV_TOOLS_FLASH_H
+
+#include <stdint.h>
+#include "uwlkv.h"
+
+/* Timing of a flash part. All times are in nanoseconds */
+typedef struct
+{
+    const char * name;
+    uint32_t     read_overhead;         /* Command and address of a read */
+    uint32_t     read_byte;             /* Transfer of one byte */
+    uint32_t     page_size;             /* Programming unit */
+    uint32_t     page_program;          /* Programming of one page, once per page touched */
+    uint32_t     program_byte;          /* Transfer of one byte to be programmed */
+    uint32_t     sector_size;           /* Erase unit */
+    uint32_t     sector_erase;          /* Erase of one sector */
+} flash_timing;
+
+typedef struct
+{
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t erases[3];                 /* By uwlkv_area */
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t bytes_erased;
+    uint32_t overwrites;                /* Writes which tried to set programmed bits */
+    uint32_t max_page_writes;           /* Writes to the most written page */
+} flash_traffic;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+const flash_timing * flash_find_part(const char * name);
+void flash_list_parts(const char * separator);
+int flash_init(uint32_t size, uint32_t reserved, uint32_t cold, const flash_timing * timing, uint64_t seed);
+void flash_free(void);
+void flash_interface(uwlkv_nvram_interface * interface);
+void flash_power_on(uint32_t operations_to_cut);
+uint8_t flash_powered(void);
+uint64_t flash_clock(void);
+const flash_traffic * flash_get_traffic(void);
+uint8_t * flash_memory(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,661 @@
+/* Host tool for raw NVRAM images: dumps read out of returned devices and images for factory
+ * programming. It is built for every library variant (uwlkv_image, uwlkv_image_hot_cold, ...),
+ * use the one matching the firmware, because NVRAM layout depends on enabled features.
+ *
+ * An image is mapped to memory and accessed by the library through an NVRAM interface, so its
+ * layout is decoded by storage.c itself. Images are created and copied in chunks and erases
+ * skip pages which are erased already, so multi-megabyte images are never loaded as a whole.
+ * dump and verify map an image privately: recovery done by the library on boot is not saved.
+ *
+ * Usage: uwlkv_image <command> <files> --reserved N [--option value]..., see usage().
+ * Manifest is a text file with one "key value" pair per line, numbers may be decimal or hex,
+ * '#' starts a comment. dump prints the same format, so its output may be used as manifest.
+ * Exit code is 1 if verification fails and 2 on usage or I/O errors.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "uwlkv.h"
+#include "entry.h"
+
+#ifdef UWLKV_EEPROM
+#error "Image tool decodes the log of storage.c, UWLKV_EEPROM layout is not supported"
+#endif
+
+#define CHUNK_SIZE      (64 * 1024)     /* Unit of streamed copies and of erase checks */
+#define KEYS_NUMBER     (1UL << (8 * sizeof(uwlkv_key)))
+
+typedef struct
+{
+    uint32_t     size;                  /* Image size, generate only. Others use file size */
+    uint32_t     reserved;              /* Reserved area size */
+    uint32_t     cold;                  /* Cold area size, with UWLKV_HOT_COLD */
+    const char * manifest;              /* Expected values, verify only */
+} image_config;
+
+typedef struct
+{
+    uwlkv_key   keys[UWLKV_MAX_ENTRIES];
+    uwlkv_value values[UWLKV_MAX_ENTRIES];
+    uint32_t    number;
+} manifest;
+
+/* Raw content of areas, as found before boot */
+typedef struct
+{
+    uint32_t entries;
+    uint32_t tombstones;
+    uint32_t corrupted;                 /* Entries with wrong checksum, with UWLKV_CRC */
+    uint32_t garbage;                   /* Programmed bytes after the first free block */
+} area_scan;
+
+/* Keys found by replay of raw entries, compared to what the library found */
+typedef struct
+{
+    const uint8_t *     live;           /* Presence of keys, by key */
+    const uwlkv_value * last;           /* Last value of keys, by key */
+    uint32_t            unknown;        /* Live keys not in UWLKV_KEYS, ignored by design */
+    uint32_t            inconsistent;   /* Keys with different presence or value */
+} live_keys;
+
+static image_config config;
+static uint8_t *    image;
+static uint32_t     image_size;
+static uint32_t     boot_writes;
+static uint32_t     boot_erases;
+
+static int image_read(uint8_t * data, uwlkv_offset start, uwlkv_offset size)
+{
+    if ((start + size) > image_size)
+    {
+        return 1;
+    }
+
+    memcpy(data, &image[start], size);
+    return 0;
+}
+
+static int image_write(uint8_t * data, uwlkv_offset start, uwlkv_offset size)
+{
+    if ((start + size) > image_size)
+    {
+        return 1;
+    }
+
+    boot_writes += 1;
+    memcpy(&image[start], data, size);
+    return 0;
+}
+
+/** @brief	Erases a range chunk by chunk. Erased chunks are not written, so they stay clean. */
+static int erase_range(const uint32_t start, const uint32_t end)
+{
+    boot_erases += 1;
+    for (uint32_t chunk = start; chunk < end; chunk += CHUNK_SIZE)
+    {
+        const uint32_t size = ((end - chunk) < CHUNK_SIZE) ? (end - chunk) : CHUNK_SIZE;
+        if (!uwlkv_is_block_erased(&image[chunk], size))
+        {
+            memset(&image[chunk], UWLKV_ERASED_BYTE_VALUE, size);
+        }
+    }
+
+    return 0;
+}
+
+static uint32_t cold_size(void)
+{
+#ifdef UWLKV_HOT_COLD
+    return config.cold;
+#else
+    return 0;
+#endif
+}
+
+static uint32_t main_end(void)
+{
+    return image_size - config.reserved - cold_size();
+}
+
+static int erase_main(void)
+{
+    return erase_range(0, main_end());
+}
+
+static int erase_reserve(void)
+{
+    return erase_range(image_size - config.reserved, image_size);
+}
+
+#ifdef UWLKV_HOT_COLD
+static int erase_cold(void)
+{
+    return erase_range(main_end(), image_size - config.reserved);
+}
+#endif
+
+/**
+ * @brief	Maps an image file to memory.
+ *
+ * @param 	path  	Image file.
+ * @param 	shared	1 to write changes back to the file, 0 to keep them private.
+ *
+ * @returns	0 on success.
+ */
+static int image_open(const char * path, const int shared)
+{
+    const int file = open(path, shared ? O_RDWR : O_RDONLY);
+    if (file < 0)
+    {
+        perror(path);
+        return 1;
+    }
+
+    struct stat status;
+    if (fstat(file, &status) || (status.st_size <= 0) || ((uint64_t)status.st_size > UINT32_MAX))
+    {
+        fprintf(stderr, "%s: image size must be from 1 byte to 4 GiB\n", path);
+        close(file);
+        return 1;
+    }
+
+    image_size = (uint32_t)status.st_size;
+    if (((uint64_t)config.reserved + cold_size()) >= image_size)
+    {
+        fprintf(stderr, "%s: reserved and cold areas don't fit into %lu bytes\n", path, (unsigned long)image_size);
+        close(file);
+        return 1;
+    }
+    image      = mmap(NULL, image_size, PROT_READ | PROT_WRITE, shared ? MAP_SHARED : MAP_PRIVATE, file, 0);
+    close(file);
+    if (MAP_FAILED == image)
+    {
+        perror(path);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int image_close(void)
+{
+    const int ret = msync(image, image_size, MS_SYNC) | munmap(image, image_size);
+    if (ret)
+    {
+        perror("msync");
+    }
+
+    return ret;
+}
+
+/**
+ * @brief	Initializes the library with the mapped image and counts NVRAM writes and erases done
+ * 			by boot. They are zero for a clean image.
+ *
+ * @returns	NVRAM capacity in entries, 0 if the image doesn't fit the layout.
+ */
+static uwlkv_offset image_boot(void)
+{
+    uwlkv_nvram_interface interface;
+    interface.read          = &image_read;
+    interface.write         = &image_write;
+    interface.erase_main    = &erase_main;
+    interface.erase_reserve = &erase_reserve;
+    interface.size          = image_size;
+    interface.reserved      = config.reserved;
+#ifdef UWLKV_HOT_COLD
+    interface.erase_cold    = &erase_cold;
+    interface.cold          = config.cold;
+#endif
+
+    boot_writes = 0;
+    boot_erases = 0;
+    const uwlkv_offset capacity = uwlkv_init(&interface);
+    if (0 == capacity)
+    {
+        fprintf(stderr, "Image of %lu bytes doesn't fit %u keys with this layout\n",
+                (unsigned long)image_size, UWLKV_MAX_ENTRIES);
+    }
+
+    return capacity;
+}
+
+/**
+ * @brief	Writes a file of erased bytes or a copy of another file, chunk by chunk.
+ *
+ * @param 	path  	Output file.
+ * @param 	source	File to copy or NULL.
+ * @param 	size  	Size of erased file.
+ *
+ * @returns	0 on success.
+ */
+static int write_file(const char * path, const char * source, uint32_t size)
+{
+    static uint8_t chunk[CHUNK_SIZE];
+    FILE * input = NULL;
+    if (source)
+    {
+        input = fopen(source, "rb");
+        if (NULL == input)
+        {
+            perror(source);
+            return 1;
+        }
+    }
+    else
+    {
+        memset(chunk, UWLKV_ERASED_BYTE_VALUE, sizeof(chunk));
+    }
+
+    FILE * output = fopen(path, "wb");
+    if (NULL == output)
+    {
+        perror(path);
+        if (input)
+        {
+            fclose(input);
+        }
+        return 1;
+    }
+
+    int ret = 0;
+    size_t length;
+    do
+    {
+        length = input ? fread(chunk, 1, CHUNK_SIZE, input)
+                       : ((size < CHUNK_SIZE) ? size : CHUNK_SIZE);
+        size  -= input ? 0 : (uint32_t)length;
+        ret    = (length != fwrite(chunk, 1, length, output));
+    } while ((length > 0) && (0 == ret));
+
+    if (input)
+    {
+        ret |= ferror(input);
+        fclose(input);
+    }
+    ret |= fclose(output);
+    if (ret)
+    {
+        perror(path);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief	Reads a manifest. A key listed twice gets the last value.
+ *
+ * @returns	0 on success.
+ */
+static int read_manifest(const char * path, manifest * values)
+{
+    FILE * file = fopen(path, "r");
+    if (NULL == file)
+    {
+        perror(path);
+        return 1;
+    }
+
+    char line[256];
+    unsigned long number = 0;
+    int bad_line = 0;
+    values->number = 0;
+    while (!bad_line && fgets(line, sizeof(line), file))
+    {
+        number += 1;
+        char * comment = strchr(line, '#');
+        if (comment)
+        {
+            *comment = '\0';
+        }
+
+        char * end;
+        const unsigned long key = strtoul(line, &end, 0);
+        if (end == line)
+        {
+            bad_line = (strspn(line, " \t\r\n") != strlen(line));
+            continue;
+        }
+
+        char * value_end;
+        const long long value = strtoll(end, &value_end, 0);
+        bad_line = (value_end == end) || (strspn(value_end, " \t\r\n") != strlen(value_end))
+                || (key >= KEYS_NUMBER);
+        if (bad_line)
+        {
+            continue;
+        }
+
+        uint32_t i = 0;
+        while ((i < values->number) && (values->keys[i] != (uwlkv_key)key))
+        {
+            i++;
+        }
+        if (i == UWLKV_MAX_ENTRIES)
+        {
+            fprintf(stderr, "%s:%lu: more than %u keys\n", path, number, UWLKV_MAX_ENTRIES);
+            fclose(file);
+            return 1;
+        }
+
+        values->keys[i]   = (uwlkv_key)key;
+        values->values[i] = (uwlkv_value)value;
+        values->number   += (i == values->number);
+    }
+
+    fclose(file);
+    if (bad_line)
+    {
+        fprintf(stderr, "%s:%lu: expected \"key value\"\n", path, number);
+    }
+
+    return bad_line;
+}
+
+/**
+ * @brief	Scans entries of an area the way storage.c does on boot and replays them.
+ *
+ * @param 	   	start	Offset of the first entry.
+ * @param 	   	end  	End of the area.
+ * @param [out]	scan 	Raw content found.
+ * @param [out]	live 	Presence of keys after replay, by key.
+ * @param [out]	last 	Last value of keys, by key.
+ */
+static void scan_area(const uint32_t start, const uint32_t end, area_scan * scan,
+                      uint8_t * live, uwlkv_value * last)
+{
+    uint32_t offset;
+    for (offset = start; (offset + UWLKV_ENTRY_SIZE) <= end; offset += UWLKV_ENTRY_SIZE)
+    {
+        uwlkv_key key;
+        uwlkv_value value;
+        const uwlkv_error ret = uwlkv_decode_entry(&image[offset], &key, &value);
+        if (UWLKV_E_NOT_EXIST == ret)
+        {
+            break;
+        }
+
+        scan->entries += 1;
+        if (UWLKV_E_CORRUPTED == ret)
+        {
+            scan->corrupted += 1;
+        }
+        else if (UWLKV_TOMBSTONE_KEY == key)
+        {
+            scan->tombstones += 1;
+            live[(uwlkv_key)value] = 0;
+        }
+        else
+        {
+            live[key] = 1;
+            last[key] = value;
+        }
+    }
+
+    for (; offset < end; offset++)
+    {
+        scan->garbage += (UWLKV_ERASED_BYTE_VALUE != image[offset]);
+    }
+}
+
+/** @brief	Counts keys found by the library, but not by replay of raw entries. */
+static int check_live(uwlkv_key key, uwlkv_value value, void * context)
+{
+    live_keys * found = context;
+    found->inconsistent += !found->live[key] || (value != found->last[key]);
+
+    return 0;
+}
+
+static int print_value(uwlkv_key key, uwlkv_value value, void * context)
+{
+    (void)context;
+    printf("%lu %ld\n", (unsigned long)key, (long)value);
+
+    return 0;
+}
+
+static int dump(const char * path)
+{
+    if (image_open(path, 0))
+    {
+        return 2;
+    }
+
+    const uwlkv_offset capacity = image_boot();
+    if (0 == capacity)
+    {
+        return 2;
+    }
+
+    printf("# size %lu, reserved %lu, cold %lu, capacity %lu entries\n", (unsigned long)image_size,
+           (unsigned long)config.reserved, (unsigned long)cold_size(), (unsigned long)capacity);
+    printf("# %s, %u keys of %u\n", (boot_writes || boot_erases) ? "recovered on boot" : "clean",
+           uwlkv_get_entries_number(), UWLKV_MAX_ENTRIES);
+#ifdef UWLKV_WEAR
+    uwlkv_wear wear;
+    uwlkv_get_wear(&wear);
+    printf("# erases main %lu, reserved %lu", (unsigned long)wear.erases[UWLKV_MAIN],
+           (unsigned long)wear.erases[UWLKV_RESERVED]);
+#ifdef UWLKV_HOT_COLD
+    printf(", cold %lu", (unsigned long)wear.erases[UWLKV_COLD]);
+#endif
+    printf(", %lu writes until UWLKV_ENDURANCE\n", (unsigned long)wear.remaining_writes);
+#endif
+    uwlkv_foreach(&print_value, NULL);
+
+    munmap(image, image_size);
+    return 0;
+}
+
+static int verify(const char * path)
+{
+    manifest expected;
+    if (    (config.manifest && read_manifest(config.manifest, &expected))
+        ||  image_open(path, 0) )
+    {
+        return 2;
+    }
+
+    uint8_t * live = calloc(KEYS_NUMBER, 1);
+    uwlkv_value * last = calloc(KEYS_NUMBER, sizeof(uwlkv_value));
+    if ((NULL == live) || (NULL == last))
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 2;
+    }
+
+    /* Cold area is indexed before main one */
+    area_scan scan = { 0, 0, 0, 0 };
+    scan_area(main_end(), image_size - config.reserved, &scan, live, last);
+    scan_area(UWLKV_METADATA_SIZE, main_end(), &scan, live, last);
+
+    const uwlkv_offset capacity = image_boot();
+    if (0 == capacity)
+    {
+        return 2;
+    }
+    const uint8_t clean = (0 == boot_writes) && (0 == boot_erases);
+
+    /* Raw content is compared only if nothing was interrupted, otherwise boot replaces it */
+    live_keys found = { live, last, 0, 0 };
+    if (clean)
+    {
+        for (uint32_t key = 0; key < KEYS_NUMBER; key++)
+        {
+            uwlkv_value value;
+            const uwlkv_error ret = live[key] ? uwlkv_get_value((uwlkv_key)key, &value) : UWLKV_E_SUCCESS;
+            if (UWLKV_E_UNKNOWN_KEY == ret)
+            {
+                found.unknown += 1;
+            }
+            else if (live[key] && ((UWLKV_E_SUCCESS != ret) || (value != last[key])))
+            {
+                found.inconsistent += 1;
+            }
+        }
+        uwlkv_foreach(&check_live, &found);
+    }
+
+    uint32_t mismatches = 0;
+    if (config.manifest)
+    {
+        for (uint32_t i = 0; i < expected.number; i++)
+        {
+            uwlkv_value value;
+            mismatches += (UWLKV_E_SUCCESS != uwlkv_get_value(expected.keys[i], &value))
+                       || (value != expected.values[i]);
+        }
+
+        /* All expected keys were found, so any other key is an extra one */
+        const uwlkv_key keys = uwlkv_get_entries_number();
+        mismatches += (keys > expected.number) ? (keys - expected.number) : 0;
+    }
+
+    const uint32_t errors = mismatches + (clean ? (scan.corrupted + (scan.garbage > 0) + found.inconsistent) : 0);
+
+    printf("state                   %s\n", clean ? "clean" : "recovered on boot");
+    printf("boot_writes             %lu\n", (unsigned long)boot_writes);
+    printf("boot_erases             %lu\n", (unsigned long)boot_erases);
+    printf("capacity_entries        %lu\n", (unsigned long)capacity);
+    printf("keys                    %lu\n", (unsigned long)uwlkv_get_entries_number());
+    printf("entries                 %lu\n", (unsigned long)scan.entries);
+    printf("tombstones              %lu\n", (unsigned long)scan.tombstones);
+    printf("corrupted               %lu\n", (unsigned long)scan.corrupted);
+    printf("garbage_bytes           %lu\n", (unsigned long)scan.garbage);
+    printf("unknown_keys            %lu\n", (unsigned long)found.unknown);
+    printf("inconsistent_keys       %lu\n", (unsigned long)found.inconsistent);
+    printf("mismatches              %lu\n", (unsigned long)mismatches);
+    printf("errors                  %lu\n", (unsigned long)errors);
+
+    free(last);
+    free(live);
+    munmap(image, image_size);
+
+    return errors ? 1 : 0;
+}
+
+static int compact(const char * path, const char * output)
+{
+    /* The same file may be given twice to compact in place */
+    if (    ((0 != strcmp(path, output)) && write_file(output, path, 0))
+        ||  image_open(output, 1) )
+    {
+        return 2;
+    }
+
+    if (0 == image_boot())
+    {
+        image_close();
+        return 2;
+    }
+
+    const uwlkv_error ret = uwlkv_compact();
+    printf("%s: %u keys compacted\n", output, uwlkv_get_entries_number());
+
+    return (image_close() || (UWLKV_E_SUCCESS != ret)) ? 2 : 0;
+}
+
+static int generate(const char * path, const char * output)
+{
+    manifest values;
+    if (read_manifest(path, &values) || write_file(output, NULL, config.size) || image_open(output, 1))
+    {
+        return 2;
+    }
+
+    if (0 == image_boot())
+    {
+        image_close();
+        return 2;
+    }
+
+    int errors = 0;
+    for (uint32_t i = 0; i < values.number; i++)
+    {
+        const uwlkv_error ret = uwlkv_set_value(values.keys[i], values.values[i]);
+        if (UWLKV_E_SUCCESS != ret)
+        {
+            fprintf(stderr, "Key %lu: error %d\n", (unsigned long)values.keys[i], (int)ret);
+            errors += 1;
+        }
+    }
+    printf("%s: %lu keys written\n", output, (unsigned long)(values.number - (uint32_t)errors));
+
+    return (image_close() || errors) ? 2 : 0;
+}
+
+static void usage(const char * name)
+{
+    fprintf(stderr,
+        "Usage: %s <command> <files> --reserved N [--option value]...\n"
+        "  dump <image>                 print live keys and values as manifest, with wear state\n"
+        "  verify <image>               check that boot finds all written keys\n"
+        "  compact <image> <output>     recover an interrupted wrap-around and compact\n"
+        "  generate <manifest> <output> write compacted image with values from manifest\n"
+        "Options:\n"
+        "  --size N                     image size in bytes, generate only\n"
+        "  --reserved N                 reserved area size\n"
+        "  --cold N                     cold area size, hot/cold builds only\n"
+        "  --manifest FILE              verify: expect exactly these values\n",
+        name);
+}
+
+static int parse_arguments(int argc, char * argv[], const int first)
+{
+    for (int i = first; i < argc; i += 2)
+    {
+        if (i + 1 >= argc)
+        {
+            return 1;
+        }
+
+        const char * option = argv[i];
+        const char * value  = argv[i + 1];
+        if      (0 == strcmp(option, "--size"))         config.size     = (uint32_t)strtoul(value, NULL, 0);
+        else if (0 == strcmp(option, "--reserved"))     config.reserved = (uint32_t)strtoul(value, NULL, 0);
+        else if (0 == strcmp(option, "--cold"))         config.cold     = (uint32_t)strtoul(value, NULL, 0);
+        else if (0 == strcmp(option, "--manifest"))     config.manifest = value;
+        else return 1;
+    }
+
+    return 0 == config.reserved;
+}
+
+int main(int argc, char * argv[])
+{
+    const char * command = (argc > 1) ? argv[1] : "";
+    const int files = (0 == strcmp(command, "compact") || 0 == strcmp(command, "generate")) ? 2 : 1;
+    if ((argc < 2 + files) || parse_arguments(argc, argv, 2 + files))
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (0 == strcmp(command, "dump"))
+    {
+        return dump(argv[2]);
+    }
+    if (0 == strcmp(command, "verify"))
+    {
+        return verify(argv[2]);
+    }
+    if (0 == strcmp(command, "compact"))
+    {
+        return compact(argv[2], argv[3]);
+    }
+    if ((0 == strcmp(command, "generate")) && (config.size > 0))
+    {
+        return generate(argv[2], argv[3]);
+    }
+
+    usage(argv[0]);
+    return 2;
+}
@@ -0,0 +1,480 @@
+/* Host tool which replays a synthetic workload through the library against a large emulated
+ * NVRAM and reports flash traffic, wear and latency. It is built for every library variant
+ * (uwlkv_sim, uwlkv_sim_ramless, ...) to compare engine modes and to tune NVRAM layout.
+ *
+ * Workload: keys are picked with Zipfian popularity and written in bursts, each write is
+ * followed by reads of random keys. Device is rebooted periodically and power is cut at random
+ * NVRAM operations: interrupted erase leaves a part of an area erased, all later operations
+ * are lost until reboot. After every reboot all values are compared to the last acknowledged
+ * ones, a value being written during power loss may have either state.
+ *
+ * Latency of each operation is measured with a virtual clock of the emulated part (see
+ * flash.c) and collected into histograms. Writes which caused a wrap-around are reported
+ * separately as compactions.
+ *
+ * Usage: uwlkv_sim [--option value]..., see usage() for options.
+ * Exit code is non-zero if any value was lost or corrupted.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "uwlkv.h"
+#include "flash.h"
+
+#define HISTOGRAM_SUB_BUCKETS       (16)    /* Buckets per power of two, ~6% precision */
+#define HISTOGRAM_BUCKETS           (64 * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct
+{
+    uint32_t     size;                  /* NVRAM size */
+    uint32_t     reserved;              /* Reserved area size */
+    uint32_t     cold;                  /* Cold area size, with UWLKV_HOT_COLD */
+    const char * part;                  /* Emulated flash part */
+    uint32_t     keys;                  /* Number of keys in use */
+    double       zipf;                  /* Zipf exponent of key popularity, 0 for uniform */
+    uint32_t     burst;                 /* Consecutive writes of a picked key */
+    uint32_t     writes;                /* Writes to replay */
+    uint32_t     reads;                 /* Reads after each write */
+    uint32_t     reboot_every;          /* Writes between clean reboots, 0 to disable */
+    uint32_t     power_cut_every;       /* Mean NVRAM operations between power cuts, 0 to disable */
+    uint64_t     seed;
+} sim_config;
+
+typedef struct
+{
+    const char * name;
+    uint64_t     count;
+    uint64_t     total;
+    uint64_t     max;
+    uint32_t     buckets[HISTOGRAM_BUCKETS];
+} latency_histogram;
+
+typedef enum
+{
+    LATENCY_GET,
+    LATENCY_SET,
+    LATENCY_COMPACTION,
+    LATENCY_BOOT,
+    LATENCY_NUMBER
+} latency_operation;
+
+static sim_config        config = { 16384, 2048, 2048, "nor", UWLKV_MAX_ENTRIES, 1.0, 1, 1000000, 1, 0, 0, 1 };
+static latency_histogram latencies[LATENCY_NUMBER] =
+{
+    { .name = "get" }, { .name = "set" }, { .name = "compaction" }, { .name = "boot" }
+};
+static uint64_t          random_state;
+
+/** @brief	xorshift64* generator, so results don't depend on platform rand() */
+static uint64_t next_random(void)
+{
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+
+    return random_state * 0x2545F4914F6CDD1DULL;
+}
+
+static uint32_t random_below(const uint32_t limit)
+{
+    return (uint32_t)(next_random() % limit);
+}
+
+/**
+ * @brief	Maps a value to a log-linear bucket: exact below HISTOGRAM_SUB_BUCKETS, then
+ * 			HISTOGRAM_SUB_BUCKETS buckets for each power of two.
+ */
+static uint32_t histogram_bucket(const uint64_t value)
+{
+    if (value < HISTOGRAM_SUB_BUCKETS)
+    {
+        return (uint32_t)value;
+    }
+
+    uint32_t msb = 0;
+    while (value >> (msb + 1))
+    {
+        msb++;
+    }
+
+    const uint32_t shift = msb - 4;
+    return (shift + 1) * HISTOGRAM_SUB_BUCKETS + (uint32_t)((value >> shift) - HISTOGRAM_SUB_BUCKETS);
+}
+
+/** @brief	Returns the smallest value of a bucket. */
+static uint64_t histogram_value(const uint32_t bucket)
+{
+    if (bucket < HISTOGRAM_SUB_BUCKETS)
+    {
+        return bucket;
+    }
+
+    const uint32_t shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    return (uint64_t)(HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS) << shift;
+}
+
+static void histogram_add(const latency_operation operation, const uint64_t value)
+{
+    latency_histogram * histogram = &latencies[operation];
+    histogram->count += 1;
+    histogram->total += value;
+    histogram->max    = (value > histogram->max) ? value : histogram->max;
+    histogram->buckets[histogram_bucket(value)] += 1;
+}
+
+/**
+ * @brief	Returns a percentile with precision of a bucket.
+ *
+ * @param 	histogram	The histogram.
+ * @param 	fraction 	Percentile, e.g. 0.99.
+ */
+static uint64_t histogram_percentile(const latency_histogram * histogram, const double fraction)
+{
+    const uint64_t target = (uint64_t)ceil((double)histogram->count * fraction);
+    uint64_t seen = 0;
+    for (uint32_t bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++)
+    {
+        seen += histogram->buckets[bucket];
+        if (seen >= target)
+        {
+            const uint64_t value = histogram_value(bucket);
+            return (value < histogram->max) ? value : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
+
+#if defined(UWLKV_STATS) || defined(UWLKV_TRACE)
+/** @brief	Timestamp hook for the library, in microseconds of virtual time. */
+static uint32_t virtual_time(void)
+{
+    return (uint32_t)(flash_clock() / 1000);
+}
+#endif
+
+static uwlkv_offset boot(void)
+{
+    uwlkv_nvram_interface interface;
+    flash_interface(&interface);
+    flash_power_on(0);
+
+    const uint64_t started = flash_clock();
+#ifdef UWLKV_LAZY_INIT
+    /* Boot time is time to the first read, the map is built by the following calls */
+    const uwlkv_offset capacity = uwlkv_init_lazy(&interface);
+#else
+    const uwlkv_offset capacity = uwlkv_init(&interface);
+#endif
+    histogram_add(LATENCY_BOOT, flash_clock() - started);
+
+    flash_power_on(config.power_cut_every ? (1 + random_below(config.power_cut_every * 2)) : 0);
+
+    return capacity;
+}
+
+/**
+ * @brief	Compares stored values to expected ones.
+ *
+ * @param 	expected     	Last acknowledged values, by key.
+ * @param 	written      	Presence of a value, by key.
+ * @param 	pending      	Key which was being written during power loss or UWLKV_TOMBSTONE_KEY.
+ * @param 	pending_value	Its new value.
+ *
+ * @returns	Number of lost or corrupted values.
+ */
+static uint32_t verify(const uwlkv_value * expected, const uint8_t * written,
+                       const uwlkv_key pending, const uwlkv_value pending_value)
+{
+    uint32_t errors = 0;
+    for (uwlkv_key key = 0; key < config.keys; key++)
+    {
+        uwlkv_value value;
+        const uwlkv_error ret = uwlkv_get_value(key, &value);
+        if (key == pending)
+        {
+            if ((UWLKV_E_SUCCESS == ret) && (value == pending_value))
+            {
+                continue;
+            }
+            if (!written[key] && (UWLKV_E_NOT_EXIST == ret))
+            {
+                continue;
+            }
+        }
+
+        if (!written[key])
+        {
+            errors += (UWLKV_E_NOT_EXIST != ret);
+        }
+        else
+        {
+            errors += (UWLKV_E_SUCCESS != ret) || (value != expected[key]);
+        }
+    }
+
+    return errors;
+}
+
+/**
+ * @brief	Builds cumulative distribution of key popularity: P(k) ~ 1 / (k + 1)^s.
+ *
+ * @param [out]	cdf	Distribution, config.keys elements.
+ */
+static void build_zipf(double * cdf)
+{
+    double sum = 0;
+    for (uint32_t k = 0; k < config.keys; k++)
+    {
+        sum   += 1.0 / pow((double)(k + 1), config.zipf);
+        cdf[k] = sum;
+    }
+    for (uint32_t k = 0; k < config.keys; k++)
+    {
+        cdf[k] /= sum;
+    }
+}
+
+static uwlkv_key pick_key(const double * cdf)
+{
+    const double x = (double)(next_random() >> 11) / (double)(1ULL << 53);
+    uint32_t low  = 0;
+    uint32_t high = config.keys - 1;
+    while (low < high)
+    {
+        const uint32_t middle = (low + high) / 2;
+        if (cdf[middle] < x)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return (uwlkv_key)low;
+}
+
+/**
+ * @brief	Reads random keys and checks their values.
+ *
+ * @returns	Number of wrong values.
+ */
+static uint32_t read_values(const double * cdf, const uwlkv_value * expected, const uint8_t * written)
+{
+    uint32_t errors = 0;
+    for (uint32_t i = 0; i < config.reads; i++)
+    {
+        const uwlkv_key key = pick_key(cdf);
+        uwlkv_value value;
+
+        const uint64_t started = flash_clock();
+        const uwlkv_error ret = uwlkv_get_value(key, &value);
+        histogram_add(LATENCY_GET, flash_clock() - started);
+
+        errors += written[key] ? ((UWLKV_E_SUCCESS != ret) || (value != expected[key]))
+                               : (UWLKV_E_NOT_EXIST != ret);
+    }
+
+    return errors;
+}
+
+static void usage(const char * name)
+{
+    fprintf(stderr,
+        "Usage: %s [--option value]...\n"
+        "  --size N             NVRAM size in bytes (%u)\n"
+        "  --reserved N         reserved area size (%u)\n"
+        "  --cold N             cold area size, hot/cold builds only (%u)\n"
+        "  --part NAME          emulated flash timing: ",
+        name, config.size, config.reserved, config.cold);
+    flash_list_parts(", ");
+    fprintf(stderr, " (%s)\n"
+        "  --keys N             keys in use, up to %u (%u)\n"
+        "  --zipf S             Zipf exponent of key popularity, 0 for uniform (%.2f)\n"
+        "  --burst N            consecutive writes of a picked key (%u)\n"
+        "  --writes N           writes to replay (%u)\n"
+        "  --reads N            reads of random keys after each write (%u)\n"
+        "  --reboot-every N     writes between clean reboots, 0 to disable (%u)\n"
+        "  --power-cut-every N  mean NVRAM operations between power cuts, 0 to disable (%u)\n"
+        "  --seed N             random seed (%llu)\n",
+        config.part, UWLKV_MAX_ENTRIES, config.keys, config.zipf, config.burst, config.writes,
+        config.reads, config.reboot_every, config.power_cut_every, (unsigned long long)config.seed);
+}
+
+static int parse_arguments(int argc, char * argv[])
+{
+    for (int i = 1; i < argc; i += 2)
+    {
+        if (i + 1 >= argc)
+        {
+            return 1;
+        }
+
+        const char * option = argv[i];
+        const char * value  = argv[i + 1];
+        if      (0 == strcmp(option, "--size"))             config.size            = (uint32_t)strtoul(value, NULL, 0);
+        else if (0 == strcmp(option, "--reserved"))         config.reserved        = (uint32_t)strtoul(value, NULL, 0);
+        else if (0 == strcmp(option, "--cold"))             config.cold            = (uint32_t)strtoul(value, NULL, 0);
+        else if (0 == strcmp(option, "--part"))             config.part            = value;
+        else if (0 == strcmp(option, "--keys"))             config.keys            = (uint32_t)strtoul(value, NULL, 0);
+        else if (0 == strcmp(option, "--zipf"))             config.zipf            = atof(value);
+        else if (0 == strcmp(option, "--burst"))            config.burst           = (uint32_t)strtoul(value, NULL, 0);
+        else if (0 == strcmp(option, "--writes"))           config.writes          = (uint32_t)strtoul(value, NULL, 0);
+        else if (0 == strcmp(option, "--reads"))            config.reads           = (uint32_t)strtoul(value, NULL, 0);
+        else if (0 == strcmp(option, "--reboot-every"))     config.reboot_every    = (uint32_t)strtoul(value, NULL, 0);
+        else if (0 == strcmp(option, "--power-cut-every"))  config.power_cut_every = (uint32_t)strtoul(value, NULL, 0);
+        else if (0 == strcmp(option, "--seed"))             config.seed            = strtoull(value, NULL, 0);
+        else return 1;
+    }
+
+    return (0 == config.keys) || (config.keys > UWLKV_MAX_ENTRIES) || (0 == config.burst)
+        || (NULL == flash_find_part(config.part));
+}
+
+int main(int argc, char * argv[])
+{
+    if (parse_arguments(argc, argv))
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+#ifdef UWLKV_HOT_COLD
+    const uint32_t cold = config.cold;
+#else
+    const uint32_t cold = 0;
+#endif
+    double * cdf = malloc(config.keys * sizeof(double));
+    uwlkv_value * expected = calloc(config.keys, sizeof(uwlkv_value));
+    uint8_t * written = calloc(config.keys, 1);
+    if (    (NULL == cdf) || (NULL == expected) || (NULL == written)
+        ||  flash_init(config.size, config.reserved, cold, flash_find_part(config.part), config.seed) )
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 2;
+    }
+
+    random_state = config.seed ? config.seed : 1;
+    build_zipf(cdf);
+#if defined(UWLKV_STATS) || defined(UWLKV_TRACE)
+    uwlkv_set_timestamp_hook(&virtual_time);
+#endif
+
+    const uwlkv_offset capacity = boot();
+    if (0 == capacity)
+    {
+        fprintf(stderr, "NVRAM layout is too small for %u keys\n", UWLKV_MAX_ENTRIES);
+        return 2;
+    }
+
+    const flash_traffic * traffic = flash_get_traffic();
+    uint32_t reboots = 0;
+    uint32_t power_cuts = 0;
+    uint32_t errors = 0;
+    uint32_t done = 0;
+    while (done < config.writes)
+    {
+        const uwlkv_key key = pick_key(cdf);
+        for (uint32_t i = 0; (i < config.burst) && (done < config.writes); i++, done++)
+        {
+            const uwlkv_value value = (uwlkv_value)done;
+            const uint32_t erases  = traffic->erases[UWLKV_MAIN];
+            const uint64_t started = flash_clock();
+            const uwlkv_error ret  = uwlkv_set_value(key, value);
+            if (!flash_powered())
+            {
+                power_cuts += 1;
+                boot();
+                errors += verify(expected, written, key, value);
+
+                uwlkv_value stored;
+                if (UWLKV_E_SUCCESS == uwlkv_get_value(key, &stored))
+                {
+                    expected[key] = stored;
+                    written[key]  = 1;
+                }
+                continue;
+            }
+
+            histogram_add((erases == traffic->erases[UWLKV_MAIN]) ? LATENCY_SET : LATENCY_COMPACTION,
+                          flash_clock() - started);
+            if (UWLKV_E_SUCCESS != ret)
+            {
+                errors += 1;
+                continue;
+            }
+            expected[key] = value;
+            written[key]  = 1;
+            errors += read_values(cdf, expected, written);
+
+            if (config.reboot_every && (0 == (done + 1) % config.reboot_every))
+            {
+                reboots += 1;
+                boot();
+                errors += verify(expected, written, UWLKV_TOMBSTONE_KEY, 0);
+            }
+        }
+    }
+
+    reboots += 1;
+    boot();
+    errors += verify(expected, written, UWLKV_TOMBSTONE_KEY, 0);
+
+    const double payload = (double)config.writes * UWLKV_ENTRY_SIZE;
+    uint32_t worn = 0;
+    for (uint8_t area = 0; area < 3; area++)
+    {
+        worn = (traffic->erases[area] > worn) ? traffic->erases[area] : worn;
+    }
+#ifdef UWLKV_EEPROM
+    /* EEPROM is never erased, its pages wear by writes */
+    worn = traffic->max_page_writes;
+#endif
+
+    printf("part                    %s\n", config.part);
+    printf("capacity_entries        %lu\n", (unsigned long)capacity);
+    printf("writes                  %lu\n", (unsigned long)config.writes);
+    printf("reboots                 %lu\n", (unsigned long)reboots);
+    printf("power_cuts              %lu\n", (unsigned long)power_cuts);
+    printf("erases_main             %lu\n", (unsigned long)traffic->erases[UWLKV_MAIN]);
+    printf("erases_reserved         %lu\n", (unsigned long)traffic->erases[UWLKV_RESERVED]);
+    printf("erases_cold             %lu\n", (unsigned long)traffic->erases[UWLKV_COLD]);
+    printf("records_per_erase       %.2f\n", traffic->erases[UWLKV_MAIN] ? (double)config.writes / traffic->erases[UWLKV_MAIN] : 0.0);
+    printf("erased_bytes_per_byte   %.3f\n", (double)traffic->bytes_erased / payload);
+    printf("written_bytes_per_byte  %.3f\n", (double)traffic->bytes_written / payload);
+    printf("flash_reads             %lu\n", (unsigned long)traffic->reads);
+    printf("flash_bytes_read        %llu\n", (unsigned long long)traffic->bytes_read);
+    printf("flash_writes            %lu\n", (unsigned long)traffic->writes);
+    printf("flash_bytes_written     %llu\n", (unsigned long long)traffic->bytes_written);
+    printf("flash_bytes_erased      %llu\n", (unsigned long long)traffic->bytes_erased);
+    printf("flash_busy_ms           %.3f\n", (double)flash_clock() / 1e6);
+    printf("writes_to_endurance     %.0f\n", worn ? (double)config.writes * UWLKV_ENDURANCE / worn : 0.0);
+    for (uint8_t operation = 0; operation < LATENCY_NUMBER; operation++)
+    {
+        const latency_histogram * histogram = &latencies[operation];
+        printf("%s_count%*s%llu\n", histogram->name, (int)(17 - strlen(histogram->name)), "",
+               (unsigned long long)histogram->count);
+        if (histogram->count)
+        {
+            printf("%s_p50_us%*s%.3f\n", histogram->name, (int)(16 - strlen(histogram->name)), "",
+                   (double)histogram_percentile(histogram, 0.50) / 1e3);
+            printf("%s_p99_us%*s%.3f\n", histogram->name, (int)(16 - strlen(histogram->name)), "",
+                   (double)histogram_percentile(histogram, 0.99) / 1e3);
+            printf("%s_max_us%*s%.3f\n", histogram->name, (int)(16 - strlen(histogram->name)), "",
+                   (double)histogram->max / 1e3);
+        }
+    }
+    printf("overwrites              %lu\n", (unsigned long)traffic->overwrites);
+    printf("errors                  %lu\n", (unsigned long)errors);
+
+    flash_free();
+    free(written);
+    free(expected);
+    free(cdf);
+
+    return (errors || traffic->overwrites) ? 1 : 0;
+}
@@ -0,0 +1,87 @@
+/* Host tool which converts a raw dump of uwlkv_trace_event array, as returned by
+ * uwlkv_get_trace(), to Chrome trace JSON. Result may be opened with chrome://tracing or
+ * https://ui.perfetto.dev. The dump must be made by a target with the same structure layout
+ * (little-endian, 32-bit alignment), which is the case for usual microcontrollers.
+ *
+ * Usage: trace2json <dump.bin> [ticks per microsecond] > trace.json
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "uwlkv.h"
+
+static const char * const operation_names[UWLKV_OP_NUMBER] =
+{
+    "uwlkv_set_value",
+    "uwlkv_get_value",
+    "uwlkv_delete_value",
+    "uwlkv_get_next_block",
+    "restart_map",
+    "prepare_area",
+    "nvram_read",
+    "nvram_write",
+    "nvram_erase",
+};
+
+int main(int argc, char * argv[])
+{
+    if ((argc < 2) || (argc > 3))
+    {
+        fprintf(stderr, "Usage: %s <dump.bin> [ticks per microsecond]\n", argv[0]);
+        return 1;
+    }
+
+    double ticks_per_us = 1.0;
+    if (argc == 3)
+    {
+        ticks_per_us = atof(argv[2]);
+        if (ticks_per_us <= 0.0)
+        {
+            fprintf(stderr, "Invalid ticks per microsecond: %s\n", argv[2]);
+            return 1;
+        }
+    }
+
+    FILE * dump = fopen(argv[1], "rb");
+    if (NULL == dump)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    uwlkv_trace_event event;
+    uint32_t first_timestamp = 0;
+    unsigned long events = 0;
+
+    printf("{\"traceEvents\":[");
+    while (1 == fread(&event, sizeof(event), 1, dump))
+    {
+        if (event.operation >= UWLKV_OP_NUMBER)
+        {
+            fprintf(stderr, "Unknown operation %u in event %lu\n", event.operation, events);
+            continue;
+        }
+
+        if (0 == events)
+        {
+            first_timestamp = event.timestamp;
+        }
+
+        /* Unsigned difference survives a single timer overflow */
+        const uint32_t ticks = event.timestamp - first_timestamp;
+        printf("%s\n{\"name\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":1,"
+               "\"args\":{\"data\":%lu}}",
+               (0 == events) ? "" : ",",
+               operation_names[event.operation],
+               event.begin ? "B" : "E",
+               (double)ticks / ticks_per_us,
+               (unsigned long)event.data);
+        events += 1;
+    }
+    printf("\n]}\n");
+
+    fclose(dump);
+    fprintf(stderr, "%lu events converted\n", events);
+
+    return 0;
+}